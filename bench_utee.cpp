@@ -0,0 +1,362 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "utee.h"
+#include "utee_arena.h"
+#include "utee_stats.h"
+#include "bench_enclave.h"
+#include "framework.h"
+
+/** File name of the benchmark enclave */
+#define BENCH_ENCLAVE "bench_enclave"
+/** Number of calls before the measurement starts */
+#define BENCH_WARMUP 100
+
+/** One benchmark: an ECALL with a payload size */
+typedef struct {
+    /** Name of the benchmark */
+    const char* name;
+    /** ECALL to call */
+    uint64_t call;
+    /** Payload in bytes, split into multiple ECALLs if it exceeds UTEE_MAX_DATA_SIZE (passed in the arena for BENCH_ECALL_ARENA) */
+    size_t payload;
+    /** Number of ECALLs submitted together with utee_ecall_batch(), 1 for single ECALLs */
+    int batch;
+} bench_case_t;
+
+/** Result of one benchmark client, shared between the client processes */
+typedef struct {
+    /** Latency of the transfers of this client */
+    utee_histogram_t latency;
+    /** Time the client needed for all transfers */
+    uint64_t elapsed;
+    /** 1 if the client could not connect to the enclave */
+    int failed;
+} bench_result_t;
+
+/** Placement of the benchmark client and the enclave threads */
+typedef struct {
+    /** Name of the placement */
+    const char* name;
+    /** CPU of the client */
+    int client;
+    /** CPU of the enclave threads */
+    int enclave;
+} bench_placement_t;
+
+/** Start barrier of the benchmark clients, in shared memory */
+typedef struct {
+    volatile int ready;
+    volatile int go;
+} bench_barrier_t;
+
+// ---------------------------------------------------------------------------
+static uint64_t ocall_noop(uint64_t p1, uint64_t p2, uint64_t p3, uint64_t p4, uint64_t p5, uint64_t p6, uint64_t len, void* data) {
+    UNUSED(p1);
+    UNUSED(p2);
+    UNUSED(p3);
+    UNUSED(p4);
+    UNUSED(p5);
+    UNUSED(p6);
+    UNUSED(len);
+    UNUSED(data);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+static void bench_client(const bench_case_t* bc, int iterations, bench_result_t* result) {
+    utee_msg_t* msg = (utee_msg_t*)calloc(UTEE_MAX_MESSAGE_SIZE, bc->batch);
+    utee_msg_t* batch[UTEE_ECALL_SLOTS];
+    for(int i = 0; i < bc->batch; i++) {
+        batch[i] = (utee_msg_t*)((char*)msg + i * UTEE_MAX_MESSAGE_SIZE);
+        batch[i]->call = bc->call;
+        batch[i]->param[0] = BENCH_OCALL_NOOP;
+    }
+    void* payload = NULL;
+    if(bc->call == BENCH_ECALL_ARENA) {
+        // the payload is written once and referenced by its offset
+        payload = utee_arena_alloc(bc->payload);
+        if(payload) memset(payload, 0x5a, bc->payload);
+        msg->param[0] = utee_arena_offset(payload);
+        msg->param[1] = bc->payload;
+    }
+
+    uint64_t start = utee_stats_now();
+    for(int i = -BENCH_WARMUP; i < iterations; i++) {
+        if(!i) start = utee_stats_now();
+        uint64_t t0 = utee_stats_now();
+        if(bc->batch > 1) {
+            utee_ecall_batch(batch, bc->batch);
+            if(i >= 0) utee_stats_record(&(result->latency), utee_stats_now() - t0);
+            continue;
+        }
+        if(bc->call == BENCH_ECALL_ARENA) {
+            utee_ecall(msg);
+            if(i >= 0) utee_stats_record(&(result->latency), utee_stats_now() - t0);
+            continue;
+        }
+        // payloads larger than the channel are transferred in chunks
+        size_t left = bc->payload;
+        do {
+            msg->len = left < UTEE_MAX_DATA_SIZE ? left : UTEE_MAX_DATA_SIZE;
+            utee_ecall(msg);
+            left -= msg->len;
+        } while(left);
+        if(i >= 0) utee_stats_record(&(result->latency), utee_stats_now() - t0);
+    }
+    result->elapsed = utee_stats_now() - start;
+    utee_arena_free(payload);
+    free(msg);
+}
+
+// ---------------------------------------------------------------------------
+static int bench_run(const bench_case_t* bc, int clients, int cpu, int iterations, bench_result_t* results, bench_barrier_t* barrier, utee_histogram_t* latency, double* throughput) {
+    memset(results, 0, sizeof(bench_result_t) * clients);
+    barrier->ready = 0;
+    barrier->go = 0;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    pid_t pids[UTEE_MAX_CLIENTS];
+    fflush(NULL);
+
+    for(int c = 0; c < clients; c++) {
+        pid_t pid = pids[c] = fork();
+        if(pid == -1) {
+            fprintf(stderr, TAG_FAIL "Could not start benchmark client\n");
+            return 1;
+        }
+        if(pid == 0) {
+            if(cpu != -1) {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                CPU_SET((cpu + c) % cpus, &set);
+                sched_setaffinity(0, sizeof(set), &set);
+            }
+            // every client has its own channel set
+            utee_enclave_disconnect();
+            results[c].failed = (utee_enclave_load(BENCH_ENCLAVE) == -1);
+            __sync_fetch_and_add(&(barrier->ready), 1);
+            while(!barrier->go) sched_yield();
+            if(!results[c].failed) {
+                bench_client(bc, iterations, &results[c]);
+            }
+            exit(0);
+        }
+    }
+    while(barrier->ready < clients) usleep(1000);
+    barrier->go = 1;
+    for(int c = 0; c < clients; c++) {
+        waitpid(pids[c], NULL, 0);
+    }
+
+    // merge the results of all clients
+    memset(latency, 0, sizeof(utee_histogram_t));
+    uint64_t elapsed = 0;
+    for(int c = 0; c < clients; c++) {
+        if(results[c].failed) {
+            fprintf(stderr, TAG_FAIL "Benchmark client could not connect to the enclave\n");
+            return 1;
+        }
+        for(int b = 0; b < UTEE_STATS_BUCKETS; b++) {
+            latency->bucket[b] += results[c].latency.bucket[b];
+        }
+        latency->count += results[c].latency.count;
+        latency->sum += results[c].latency.sum;
+        if(results[c].latency.max > latency->max) latency->max = results[c].latency.max;
+        if(results[c].elapsed > elapsed) elapsed = results[c].elapsed;
+    }
+    *throughput = elapsed ? latency->count * bc->batch * 1e9 / elapsed : 0;
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+static void bench_json_latency(FILE* json, const utee_histogram_t* latency) {
+    fprintf(json, "\"latency_ns\": {\"mean\": %.1f, \"p50\": %lu, \"p90\": %lu, \"p99\": %lu, \"p999\": %lu, \"max\": %lu}",
+        latency->count ? (double)latency->sum / latency->count : 0.0,
+        (unsigned long)utee_stats_percentile(latency, 50.0), (unsigned long)utee_stats_percentile(latency, 90.0),
+        (unsigned long)utee_stats_percentile(latency, 99.0), (unsigned long)utee_stats_percentile(latency, 99.9),
+        (unsigned long)latency->max);
+}
+
+// ---------------------------------------------------------------------------
+static int bench_topology(int cpu, const char* field) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, field);
+    FILE* f = fopen(path, "r");
+    int value = -1;
+    if(f) {
+        if(fscanf(f, "%d", &value) != 1) value = -1;
+        fclose(f);
+    }
+    return value;
+}
+
+// ---------------------------------------------------------------------------
+static int bench_placements(bench_placement_t* placement) {
+    // the client runs on the first CPU, the enclave on the same CPU, on its 
+    // SMT sibling, on another core of the same socket, or on another socket
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int client = 0, sibling = -1, socket = -1, remote = -1;
+    int package = bench_topology(client, "physical_package_id"), core = bench_topology(client, "core_id");
+    for(int cpu = 1; cpu < cpus; cpu++) {
+        int p = bench_topology(cpu, "physical_package_id"), c = bench_topology(cpu, "core_id");
+        if(p == package && c == core) {
+            if(sibling == -1) sibling = cpu;
+        } else if(p == package) {
+            if(socket == -1) socket = cpu;
+        } else if(remote == -1) {
+            remote = cpu;
+        }
+    }
+    int n = 0;
+    placement[n++] = (bench_placement_t){ "same-cpu", client, client };
+    if(sibling != -1) placement[n++] = (bench_placement_t){ "core-pair", client, sibling };
+    if(socket != -1) placement[n++] = (bench_placement_t){ "same-socket", client, socket };
+    if(remote != -1) placement[n++] = (bench_placement_t){ "cross-socket", client, remote };
+    return n;
+}
+
+// ---------------------------------------------------------------------------
+static int bench_placement(FILE* json, int iterations, bench_result_t* results, bench_barrier_t* barrier) {
+    const bench_case_t noop = { "noop", BENCH_ECALL_NOOP, 0, 1 };
+    bench_placement_t placement[4];
+    int n = bench_placements(placement);
+    if(n < 4) {
+        fprintf(stderr, TAG_INFO "Only %d of 4 placements (same CPU, core pair, same socket, cross socket) exist on this machine\n", n);
+    }
+    utee_msg_t* msg = (utee_msg_t*)calloc(UTEE_MAX_MESSAGE_SIZE, 1);
+    msg->call = BENCH_ECALL_AFFINITY;
+
+    fprintf(json, "{\n  \"benchmark\": \"bench_utee\",\n  \"mode\": \"placement\",\n  \"iterations\": %d,\n  \"cpus\": %ld,\n  \"results\": [",
+        iterations, sysconf(_SC_NPROCESSORS_ONLN));
+    for(int i = 0; i < n; i++) {
+        utee_histogram_t latency;
+        double throughput;
+        msg->param[0] = placement[i].enclave;
+        if(utee_ecall(msg) || bench_run(&noop, 1, placement[i].client, iterations, results, barrier, &latency, &throughput)) {
+            free(msg);
+            return 1;
+        }
+        fprintf(stderr, TAG_INFO "%-12s client CPU %3d, enclave CPU %3d: p50 %7.1f us, p99 %7.1f us, %9.0f transfers/s\n",
+            placement[i].name, placement[i].client, placement[i].enclave,
+            utee_stats_percentile(&latency, 50.0) / 1e3, utee_stats_percentile(&latency, 99.0) / 1e3, throughput);
+        fprintf(json, "%s\n    {\"placement\": \"%s\", \"client_cpu\": %d, \"enclave_cpu\": %d, \"transfers\": %lu, \"throughput\": %.1f, ",
+            i ? "," : "", placement[i].name, placement[i].client, placement[i].enclave, (unsigned long)latency.count, throughput);
+        bench_json_latency(json, &latency);
+        fprintf(json, "}");
+    }
+    fprintf(json, "\n  ]\n}\n");
+
+    // the enclave may use all CPUs again
+    msg->param[0] = -1;
+    utee_ecall(msg);
+    free(msg);
+    return 0;
+}
+
+/**
+ * Microbenchmark of the UTEE IPC layer
+ *
+ * Measures the round-trip latency distribution and throughput of no-op
+ * ECALLs (single and batched), ECALLs containing a synchronous or 
+ * asynchronous OCALL, and echo ECALLs with payloads from 0 bytes to beyond
+ * UTEE_MAX_DATA_SIZE (transferred in chunks or in the shared arena), for different numbers of 
+ * concurrent clients, with and without pinning the clients to CPUs. The 
+ * results are written as JSON. In placement mode (-p), the no-op latency 
+ * is measured with the client and the enclave on the same CPU, on the two
+ * CPUs of a core pair, on two cores of a socket, and on different sockets.
+ */
+int main(int argc, char* argv[]) {
+    int iterations = 10000, max_clients = 4, placement = 0, opt;
+    const char* output = NULL;
+    while((opt = getopt(argc, argv, "n:c:o:p")) != -1) {
+        switch(opt) {
+            case 'n': iterations = atoi(optarg); break;
+            case 'c': max_clients = atoi(optarg); break;
+            case 'o': output = optarg; break;
+            case 'p': placement = 1; break;
+            default:
+                fprintf(stderr, "Usage: %s [-n iterations] [-c max clients] [-o output.json] [-p]\n", argv[0]);
+                return 1;
+        }
+    }
+    if(max_clients < 1 || max_clients >= UTEE_MAX_CLIENTS) {
+        fprintf(stderr, TAG_FAIL "Number of clients must be between 1 and %d\n", UTEE_MAX_CLIENTS - 1);
+        return 1;
+    }
+    FILE* json = output ? fopen(output, "w") : stdout;
+    if(!json) {
+        fprintf(stderr, TAG_FAIL "Could not open file '%s'\n", output);
+        return 2;
+    }
+
+    if(utee_register_ocall(ocall_noop) != BENCH_OCALL_NOOP) {
+        fprintf(stderr, TAG_FAIL "Could not register OCALL\n");
+        return 3;
+    }
+    if(utee_enclave_load(BENCH_ENCLAVE) == -1) {
+        fprintf(stderr, TAG_FAIL "Failed to start enclave. Is " COLOR_CYAN BENCH_ENCLAVE COLOR_RESET " in the current folder?\n");
+        return 4;
+    }
+
+    const bench_case_t cases[] = {
+        { "noop", BENCH_ECALL_NOOP, 0, 1 },
+        { "batch", BENCH_ECALL_NOOP, 0, UTEE_ECALL_SLOTS },
+        { "ocall", BENCH_ECALL_OCALL, 0, 1 },
+        { "async", BENCH_ECALL_OCALL_ASYNC, 0, 1 },
+        { "echo", BENCH_ECALL_ECHO, 0, 1 },
+        { "echo", BENCH_ECALL_ECHO, 64, 1 },
+        { "echo", BENCH_ECALL_ECHO, 256, 1 },
+        { "echo", BENCH_ECALL_ECHO, 1024, 1 },
+        { "echo", BENCH_ECALL_ECHO, 2048, 1 },
+        { "echo", BENCH_ECALL_ECHO, UTEE_MAX_DATA_SIZE, 1 },
+        { "echo", BENCH_ECALL_ECHO, 4 * UTEE_MAX_MESSAGE_SIZE, 1 },
+        { "echo", BENCH_ECALL_ECHO, 16 * UTEE_MAX_MESSAGE_SIZE, 1 },
+        { "arena", BENCH_ECALL_ARENA, 16 * UTEE_MAX_MESSAGE_SIZE, 1 },
+    };
+    bench_result_t* results = (bench_result_t*)mmap(NULL, sizeof(bench_result_t) * max_clients, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    bench_barrier_t* barrier = (bench_barrier_t*)mmap(NULL, sizeof(bench_barrier_t), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if(results == MAP_FAILED || barrier == MAP_FAILED) {
+        fprintf(stderr, TAG_FAIL "Could not allocate shared memory\n");
+        return 5;
+    }
+    if(placement) {
+        int failed = bench_placement(json, iterations, results, barrier);
+        if(output) fclose(json);
+        return failed ? 6 : 0;
+    }
+
+    fprintf(json, "{\n  \"benchmark\": \"bench_utee\",\n  \"iterations\": %d,\n  \"max_data_size\": %zu,\n  \"cpus\": %ld,\n  \"results\": [",
+        iterations, UTEE_MAX_DATA_SIZE, sysconf(_SC_NPROCESSORS_ONLN));
+    int first = 1;
+    for(int pinned = 0; pinned <= 1; pinned++) {
+        int cpu = pinned ? 0 : -1;
+        for(int clients = 1; clients <= max_clients; clients *= 2) {
+            for(size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+                const bench_case_t* bc = &cases[i];
+                utee_histogram_t latency;
+                double throughput;
+                int chunks = (bc->payload && bc->call != BENCH_ECALL_ARENA) ? (bc->payload + UTEE_MAX_DATA_SIZE - 1) / UTEE_MAX_DATA_SIZE : 1;
+                int n = iterations / chunks > 100 ? iterations / chunks : 100;
+                if(bench_run(bc, clients, cpu, n, results, barrier, &latency, &throughput)) {
+                    return 6;
+                }
+                fprintf(stderr, TAG_INFO "%-5s %6zu B, %d client(s), %-8s: p50 %7.1f us, p99 %7.1f us, %9.0f transfers/s\n",
+                    bc->name, bc->payload, clients, pinned ? "pinned" : "unpinned",
+                    utee_stats_percentile(&latency, 50.0) / 1e3, utee_stats_percentile(&latency, 99.0) / 1e3, throughput);
+                fprintf(json, "%s\n    {\"test\": \"%s\", \"payload\": %zu, \"chunks\": %d, \"batch\": %d, \"clients\": %d, \"pinned\": %s, \"transfers\": %lu, \"throughput\": %.1f, ",
+                    first ? "" : ",", bc->name, bc->payload, chunks, bc->batch, clients, pinned ? "true" : "false",
+                    (unsigned long)latency.count, throughput);
+                bench_json_latency(json, &latency);
+                fprintf(json, "}");
+                first = 0;
+            }
+        }
+    }
+    fprintf(json, "\n  ]\n}\n");
+    if(output) fclose(json);
+    return 0;
+}
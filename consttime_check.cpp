@@ -0,0 +1,150 @@
+#include <vector>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "trustlib_bn.h"
+#include "framework.h"
+
+/** Exponents of every size whose traces are compared */
+#define CHECK_EXPONENTS 8
+
+/** An operation of the exponentiation and the address it accesses */
+typedef struct {
+    char op;
+    const void* address;
+} trace_event_t;
+
+typedef std::vector<trace_event_t> trace_t;
+
+static trace_t trace;
+static uint64_t random_state = 0x9e3779b97f4a7c15ull;
+
+// ---------------------------------------------------------------------------
+void trustlib_bn_trace(char op, const void* address) {
+    trace.push_back({ op, address });
+}
+
+// ---------------------------------------------------------------------------
+static uint64_t next_random() {
+    // xorshift, the check is reproducible
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+// ---------------------------------------------------------------------------
+static void random_bn(trustlib_bn_t* r, int bits) {
+    trustlib_bn_set(r, 0);
+    for(int i = 0; i < bits / 64; i++) {
+        r->limb[i] = next_random();
+    }
+    // exactly bits bits
+    r->limb[bits / 64 - 1] |= 1ull << 63;
+}
+
+// ---------------------------------------------------------------------------
+static trace_t record(int consttime, const trustlib_mont_t* ctx, trustlib_bn_t* r, const trustlib_bn_t* base, const trustlib_bn_t* exp, int bits) {
+    // always called from here, so the stack addresses of the exponentiation are the same for every exponent
+    trace.clear();
+    if(consttime) {
+        trustlib_mont_exp_consttime(ctx, r, base, exp, bits);
+    } else {
+        trustlib_mont_exp(ctx, r, base, exp);
+    }
+    return trace;
+}
+
+// ---------------------------------------------------------------------------
+static int same_trace(const trace_t& a, const trace_t& b) {
+    if(a.size() != b.size()) {
+        return 0;
+    }
+    for(size_t i = 0; i < a.size(); i++) {
+        if(a[i].op != b[i].op || a[i].address != b[i].address) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// ---------------------------------------------------------------------------
+static int check_size(int bits) {
+    trustlib_bn_t m, base, exp[CHECK_EXPONENTS];
+    trustlib_mont_t ctx;
+    random_bn(&m, bits);
+    m.limb[0] |= 1;
+    if(trustlib_mont_init(&ctx, &m)) {
+        printf(TAG_FAIL "Could not initialize a %d-bit modulus\n", bits);
+        return 1;
+    }
+    random_bn(&base, bits);
+    base.limb[bits / 64 - 1] >>= 1;
+    // the extremes, only the top bit and all bits set, and random exponents of the same length
+    trustlib_bn_set(&exp[0], 0);
+    exp[0].limb[bits / 64 - 1] = 1ull << 63;
+    trustlib_bn_set(&exp[1], 0);
+    memset(exp[1].limb, 0xff, bits / 8);
+    for(int i = 2; i < CHECK_EXPONENTS; i++) {
+        random_bn(&exp[i], bits);
+    }
+
+    int failed = 0;
+    trace_t first;
+    for(int i = 0; i < CHECK_EXPONENTS; i++) {
+        trustlib_bn_t expected, result;
+        trace_t t = record(1, &ctx, &result, &base, &exp[i], bits);
+        record(0, &ctx, &expected, &base, &exp[i], bits);
+        if(trustlib_bn_cmp(&result, &expected)) {
+            printf(TAG_FAIL "%d bits: wrong result for exponent %d\n", bits, i);
+            failed = 1;
+        }
+        if(!i) {
+            first = t;
+        } else if(!same_trace(first, t)) {
+            printf(TAG_FAIL "%d bits: trace of exponent %d differs from exponent 0\n", bits, i);
+            failed = 1;
+        }
+    }
+    // the tracer has to see the leak of the variable-time exponentiation
+    trustlib_bn_t r;
+    trace_t sparse = record(0, &ctx, &r, &base, &exp[0], bits);
+    trace_t dense = record(0, &ctx, &r, &base, &exp[1], bits);
+    if(same_trace(sparse, dense)) {
+        printf(TAG_FAIL "%d bits: tracer does not see the exponent of trustlib_mont_exp()\n", bits);
+        failed = 1;
+    }
+    if(!failed) {
+        printf(TAG_OK "%d bits: %d exponents, identical traces of %zu operations\n", bits, CHECK_EXPONENTS, first.size());
+    }
+    return failed;
+}
+
+/**
+ * Check that the constant-time exponentiation does not depend on the exponent
+ *
+ * trustlib_bn.cpp is built with TRUSTLIB_BN_TRACE, so every operand of a
+ * Montgomery multiplication and every entry of the window table that is
+ * read is recorded with its address, in order. A page-level tracer like
+ * the attack sees a coarser view of the same accesses. For moduli of the
+ * sizes of keys and CRT primes, trustlib_mont_exp_consttime() is run with
+ * several exponents of the same length, all traces have to be identical
+ * and all results correct. As a control, the traces of the variable-time
+ * trustlib_mont_exp() have to differ, otherwise the tracer could not see
+ * a leak at all.
+ *
+ * Built and run with "make check".
+ */
+int main() {
+    static const int sizes[] = { 256, 512, 1024, 2048, 4096 };
+    int failed = 0;
+    for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        failed |= check_size(sizes[i]);
+    }
+    if(failed) {
+        printf(TAG_FAIL "Constant-time exponentiation depends on the exponent\n");
+        return 1;
+    }
+    printf(TAG_OK "Constant-time exponentiation does not depend on the exponent\n");
+    return 0;
+}
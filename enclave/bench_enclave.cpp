@@ -0,0 +1,178 @@
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <libgen.h>
+#include "utee.h"
+#include "utee_arena.h"
+#include "bench_enclave.h"
+
+/**
+ * The no-op ECALL
+ *
+ * Returns immediately, measures the bare cost of an ECALL round trip.
+ *
+ * @return always 0
+ */
+uint64_t ecall_noop(uint64_t p1, uint64_t p2, uint64_t p3, uint64_t p4, uint64_t p5, uint64_t p6, uint64_t len, void* data) {
+    UNUSED(p1);
+    UNUSED(p2);
+    UNUSED(p3);
+    UNUSED(p4);
+    UNUSED(p5);
+    UNUSED(p6);
+    UNUSED(len);
+    UNUSED(data);
+    return 0;
+}
+
+/**
+ * The echo ECALL
+ *
+ * Reads the complete data of the ECALL and returns it unchanged to the caller.
+ *
+ * @param len Length of the data
+ * @param data The data to echo
+ * @return A checksum over the data
+ */
+uint64_t ecall_echo(uint64_t p1, uint64_t p2, uint64_t p3, uint64_t p4, uint64_t p5, uint64_t p6, uint64_t len, void* data) {
+    UNUSED(p1);
+    UNUSED(p2);
+    UNUSED(p3);
+    UNUSED(p4);
+    UNUSED(p5);
+    UNUSED(p6);
+    uint64_t sum = 0;
+    for(uint64_t i = 0; i < len; i++) {
+        sum += ((unsigned char*)data)[i];
+    }
+    return sum;
+}
+
+/**
+ * The OCALL ECALL
+ *
+ * Forwards the data of the ECALL to an OCALL of the caller, measures an
+ * ECALL round trip that contains an OCALL round trip.
+ *
+ * @param p1 Number of the OCALL to call
+ * @param len Length of the data
+ * @param data The data to forward
+ * @return The result of the OCALL
+ */
+uint64_t ecall_ocall(uint64_t p1, uint64_t p2, uint64_t p3, uint64_t p4, uint64_t p5, uint64_t p6, uint64_t len, void* data) {
+    UNUSED(p2);
+    UNUSED(p3);
+    UNUSED(p4);
+    UNUSED(p5);
+    UNUSED(p6);
+    char buffer[UTEE_MAX_MESSAGE_SIZE];
+    utee_msg_t* msg = (utee_msg_t*)buffer;
+    msg->call = p1;
+    msg->len = len;
+    memcpy(msg->data, data, len);
+    return utee_ocall(msg);
+}
+
+/**
+ * The asynchronous OCALL ECALL
+ *
+ * Queues an OCALL of the caller without waiting for its result, measures 
+ * the cost of a fire-and-forget OCALL inside an ECALL round trip.
+ *
+ * @param p1 Number of the OCALL to call
+ * @param len Length of the data
+ * @param data The data to forward
+ * @return 0 if the OCALL was queued
+ */
+uint64_t ecall_ocall_async(uint64_t p1, uint64_t p2, uint64_t p3, uint64_t p4, uint64_t p5, uint64_t p6, uint64_t len, void* data) {
+    UNUSED(p2);
+    UNUSED(p3);
+    UNUSED(p4);
+    UNUSED(p5);
+    UNUSED(p6);
+    char buffer[UTEE_MAX_MESSAGE_SIZE];
+    utee_msg_t* msg = (utee_msg_t*)buffer;
+    msg->call = p1;
+    msg->len = len;
+    memcpy(msg->data, data, len);
+    return utee_ocall_async(msg);
+}
+
+/**
+ * The affinity ECALL
+ *
+ * Pins all enclave threads to one CPU, used to measure the latency for
+ * different placements of client and enclave.
+ *
+ * @param p1 CPU to pin the enclave to, -1 to allow all CPUs again
+ * @return 0 on success, 1 otherwise
+ */
+uint64_t ecall_affinity(uint64_t p1, uint64_t p2, uint64_t p3, uint64_t p4, uint64_t p5, uint64_t p6, uint64_t len, void* data) {
+    UNUSED(p2);
+    UNUSED(p3);
+    UNUSED(p4);
+    UNUSED(p5);
+    UNUSED(p6);
+    UNUSED(len);
+    UNUSED(data);
+    char cpus[32] = "";
+    if((int64_t)p1 >= 0) {
+        snprintf(cpus, sizeof(cpus), "%d", (int)p1);
+    }
+    return utee_enclave_affinity(cpus);
+}
+
+/**
+ * The arena ECALL
+ *
+ * Reads a payload that the caller placed in the shared arena, measures
+ * large transfers that are not copied through the channel.
+ *
+ * @param p1 Offset of the payload in the arena
+ * @param p2 Length of the payload
+ * @return A checksum over the payload, -1 if the offset is invalid
+ */
+uint64_t ecall_arena(uint64_t p1, uint64_t p2, uint64_t p3, uint64_t p4, uint64_t p5, uint64_t p6, uint64_t len, void* data) {
+    UNUSED(p3);
+    UNUSED(p4);
+    UNUSED(p5);
+    UNUSED(p6);
+    UNUSED(len);
+    UNUSED(data);
+    unsigned char* payload = (unsigned char*)utee_arena_ptr(p1);
+    if(!payload || (p2 && !utee_arena_ptr(p1 + p2 - 1))) {
+        return -1;
+    }
+    uint64_t sum = 0;
+    for(uint64_t i = 0; i < p2; i++) {
+        sum += payload[i];
+    }
+    return sum;
+}
+
+/**
+ * Host application for the benchmark enclave
+ *
+ * Registers the no-op, echo, (asynchronous) OCALL, affinity, and arena ECALLs used by bench_utee, and starts the enclave.
+ */
+int main(int argc, char* argv[]) {
+    int daemon = (argc > 1 && !strcmp(argv[1], UTEE_DAEMON_ARG));
+    if(daemon && utee_enclave_daemon()) {
+        std::cout << "[!] Failed to start daemon" << std::endl;
+        return -5;
+    }
+    if(utee_enclave_init(basename(argv[0]))) {
+        std::cout << "[!] Failed to initialize enclave" << std::endl;
+        return -1;
+    }
+    if(utee_register_ecall(ecall_noop) != BENCH_ECALL_NOOP || utee_register_ecall(ecall_echo) != BENCH_ECALL_ECHO || utee_register_ecall(ecall_ocall) != BENCH_ECALL_OCALL || utee_register_ecall(ecall_ocall_async) != BENCH_ECALL_OCALL_ASYNC
+        || utee_register_ecall(ecall_affinity) != BENCH_ECALL_AFFINITY || utee_register_ecall(ecall_arena) != BENCH_ECALL_ARENA) {
+        std::cout << "[!] Failed to register ECALLs" << std::endl;
+        return -2;
+    }
+    if(utee_enclave_start()) {
+        std::cout << "[!] Failed to start enclave" << std::endl;
+        return -4;
+    }
+    utee_cleanup();
+}
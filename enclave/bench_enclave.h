@@ -0,0 +1,20 @@
+#ifndef _BENCH_ENCLAVE_H_
+#define _BENCH_ENCLAVE_H_
+
+/** ECALL number of the no-op ECALL */
+#define BENCH_ECALL_NOOP  1
+/** ECALL number of the echo ECALL */
+#define BENCH_ECALL_ECHO  2
+/** ECALL number of the ECALL that calls an OCALL of the caller */
+#define BENCH_ECALL_OCALL 3
+/** ECALL number of the ECALL that calls an OCALL of the caller asynchronously */
+#define BENCH_ECALL_OCALL_ASYNC 4
+/** ECALL number of the ECALL that pins the enclave threads to a CPU */
+#define BENCH_ECALL_AFFINITY 5
+/** ECALL number of the ECALL that reads a payload from the shared arena */
+#define BENCH_ECALL_ARENA 6
+
+/** OCALL number of the no-op OCALL provided by the benchmark */
+#define BENCH_OCALL_NOOP  1
+
+#endif
@@ -1,12 +1,61 @@
 #include <string>
 #include <cstring>
 #include <fstream>
+#include <sstream>
 #include <iostream>
+#include <time.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/random.h>
 
 #include "InfInt.h"
 #include "trustlib.h"
+#include "trustlib_wire.h"
+#include "trustlib_keyring.h"
+#include "trustlib_sha256.h"
+#include "trustlib_cache.h"
+#include "trustlib_blind.h"
+#include "utee_trace.h"
 
-static InfInt n, e, d;
+/** Key of trustlib_sign() and trustlib_verify(), replaced as a whole when the keys are reloaded */
+typedef struct {
+    InfInt n, e, d;
+    /** Key as read from key.params, handed to the successor in a hot restart */
+    std::string params;
+    /** Hex-encoded public key, encoded once by the keyring */
+    trustlib_sign_param_t param;
+    /** The same key in the keyring it was loaded with, NULL if the keyring rejected it */
+    const trustlib_key_t* key;
+    /** 1 if n has at most TRUSTLIB_LEGACY_BITS bits, wider keys only sign in the binary formats */
+    int fits;
+} trustlib_legacy_key_t;
+
+static trustlib_legacy_key_t* legacy;
+static pthread_once_t key_loaded = PTHREAD_ONCE_INIT;
+/** Key file handed over in a hot restart */
+static std::string handoff_params;
+/** Only one reload builds a keyring at a time */
+static pthread_mutex_t reload_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** A document that is hashed, see trustlib_stream_begin() */
+typedef struct {
+    /** Handle of the stream, 0 if the stream is free */
+    uint64_t handle;
+    /** 1 while a thread uses the stream */
+    int busy;
+    uint8_t issuer;
+    /** Time of the last use, abandoned documents are discarded after TRUSTLIB_STREAM_IDLE seconds */
+    time_t used;
+    trustlib_sha256_t sha;
+} trustlib_stream_t;
+
+static trustlib_stream_t streams[TRUSTLIB_MAX_STREAMS];
+static pthread_mutex_t streams_lock = PTHREAD_MUTEX_INITIALIZER;
+static_assert(TRUSTLIB_MAX_STREAMS <= 256, "The handle of a stream contains its index in the lower 8 bits");
+
+/** DigestInfo of SHA-256 (RFC 8017), precedes the digest in the signed encoding */
+static const uint8_t sha256_prefix[] = { 0x30, 0x31, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01, 0x65, 0x03, 0x04, 0x02, 0x01, 0x05, 0x00, 0x04, 0x20 };
 
 // -----------------------------------------------------------------------
 static char hexchar(int v) {
@@ -48,7 +97,7 @@ static InfInt unhexlify(char* hex) {
 }
 
 // -----------------------------------------------------------------------
-static InfInt do_sign(InfInt M, InfInt exp) {
+static InfInt do_sign(InfInt M, InfInt exp, const InfInt& n) {
     
     
     // C = (M ^ exp) % n
@@ -62,6 +111,9 @@ static InfInt do_sign(InfInt M, InfInt exp) {
         
         C.reduce(n); // C % n;
         M.reduce(n); // M % n;
+        
+        // the caller does not wait for the result anymore
+        if(utee_ecall_cancelled()) break;
     }
     
     return C;
@@ -77,20 +129,151 @@ static InfInt data2int(const char* msg, int len) {
     return M;
 }
 
+// -----------------------------------------------------------------------
+static int data2bn(const char* msg, int len, trustlib_bn_t* M) {
+    // same number as data2int(), which adds the bytes as signed chars
+    trustlib_bn_t pos, neg, digit;
+    trustlib_bn_set(&pos, 0);
+    trustlib_bn_set(&neg, 0);
+    trustlib_bn_set(&digit, 256);
+    while(len--) {
+        trustlib_bn_mul(&pos, &pos, &digit);
+        trustlib_bn_mul(&neg, &neg, &digit);
+        if(*msg < 0) {
+            neg.limb[0] += -*msg;
+        } else {
+            pos.limb[0] += *msg;
+        }
+        msg++;
+    }
+    // 1 if the number is negative
+    return trustlib_bn_sub(M, &pos, &neg) != 0;
+}
 
 // -----------------------------------------------------------------------
-static void trustlib_init() {
+static const char* trustlib_keys_dir() {
+    const char* dir = getenv(TRUSTLIB_KEYS_ENV);
+    return dir ? dir : TRUSTLIB_KEYS_DIR;
+}
+
+// -----------------------------------------------------------------------
+static std::string trustlib_read_key() {
     std::ifstream params("key.params");
+    std::stringstream content;
+    content << params.rdbuf();
+    return content.str();
+}
+
+// -----------------------------------------------------------------------
+static const trustlib_legacy_key_t* trustlib_legacy_key() {
+    return __atomic_load_n(&legacy, __ATOMIC_ACQUIRE);
+}
+
+// -----------------------------------------------------------------------
+static int trustlib_build_keyring(const std::string& text) {
+    // the wire format selects one of many keys, the first one is key.params
+    int failed = trustlib_keyring_add(text.c_str(), "key.params");
+    trustlib_keyring_load(trustlib_keys_dir());
+    return failed;
+}
+
+// -----------------------------------------------------------------------
+static void trustlib_publish_key(const std::string& text) {
+    trustlib_keyring_t* previous;
+    int empty = trustlib_keyring_publish(&previous);
+    trustlib_legacy_key_t* key = new trustlib_legacy_key_t();
+    std::istringstream params(text);
     std::string s_n, s_d, s_e;
     params >> s_n >> s_e >> s_d;
-    n = s_n;
-    e = s_e;
-    d = s_d;
+    key->n = s_n;
+    key->e = s_e;
+    key->d = s_d;
+    key->params = text;
+    // encoded once by the keyring, the same as hexlify(n) and hexlify(e), unless the keyring rejected the key
+    const trustlib_key_t* first = empty ? NULL : trustlib_keyring_get(NULL);
+    trustlib_bn_t modulus;
+    int parsed = !trustlib_bn_from_dec(&modulus, s_n.c_str());
+    key->fits = parsed && trustlib_bn_bits(&modulus) <= TRUSTLIB_LEGACY_BITS;
+    if(first && parsed && !trustlib_bn_cmp(&modulus, &first->n.m)) {
+        key->key = first;
+        key->param = first->param;
+    } else if(key->fits) {
+        hexlify(key->n, key->param.n);
+        hexlify(key->e, key->param.e);
+    }
+    // ECALLs that started with the previous keys finish with them, the new keys are only freed by the next reload
+    trustlib_legacy_key_t* old = __atomic_exchange_n(&legacy, key, __ATOMIC_SEQ_CST);
+    if(previous || old) {
+        trustlib_keyring_synchronize();
+    }
+    trustlib_keyring_free(previous);
+    delete old;
+}
+
+// -----------------------------------------------------------------------
+static void trustlib_init() {
+    const char* text;
+    size_t len;
+    if(!trustlib_keyring_map(TRUSTLIB_KEY_CACHE, "key.params", trustlib_keys_dir(), &text, &len)) {
+        trustlib_publish_key(std::string(text, len));
+        return;
+    }
+    std::string params = trustlib_read_key();
+    trustlib_build_keyring(params);
+    trustlib_keyring_save(TRUSTLIB_KEY_CACHE, params.data(), params.size());
+    trustlib_publish_key(params);
+}
+
+// -----------------------------------------------------------------------
+void trustlib_preload() {
+    pthread_once(&key_loaded, trustlib_init);
+}
+
+// -----------------------------------------------------------------------
+int trustlib_reload_keys() {
+    trustlib_preload();
+    pthread_mutex_lock(&reload_lock);
+    // the new keys are built while the ECALLs keep signing with the current ones
+    std::string params = trustlib_read_key();
+    int failed = trustlib_build_keyring(params);
+    if(failed) {
+        fprintf(stderr, "[trustlib] Invalid key.params, keeping the previous keys\n");
+        trustlib_keyring_discard();
+    } else {
+        trustlib_keyring_save(TRUSTLIB_KEY_CACHE, params.data(), params.size());
+        trustlib_publish_key(params);
+    }
+    pthread_mutex_unlock(&reload_lock);
+    return failed;
+}
+
+// -----------------------------------------------------------------------
+size_t trustlib_save_key(void* buffer, size_t size) {
+    trustlib_preload();
+    trustlib_keyring_reader reader;
+    const trustlib_legacy_key_t* key = trustlib_legacy_key();
+    if(key->params.size() + 1 > size) {
+        return 0;
+    }
+    memcpy(buffer, key->params.c_str(), key->params.size() + 1);
+    return key->params.size() + 1;
+}
+
+// -----------------------------------------------------------------------
+static void trustlib_restore_keyring() {
+    trustlib_build_keyring(handoff_params);
+    trustlib_publish_key(handoff_params);
+}
+
+// -----------------------------------------------------------------------
+void trustlib_restore_key(const void* state, size_t len) {
+    handoff_params.assign((const char*)state, strnlen((const char*)state, len));
+    pthread_once(&key_loaded, trustlib_restore_keyring);
 }
 
 // -----------------------------------------------------------------------
 void trustlib_sign(trustlib_signed_data_t* data) {
-    if(n == 0) trustlib_init();
+    trustlib_preload();
     
     char data_to_sign[sizeof(trustlib_sign_data_t)];
     memcpy(data_to_sign, (void*)&(data->data), sizeof(trustlib_sign_data_t));
@@ -98,28 +281,381 @@ void trustlib_sign(trustlib_signed_data_t* data) {
         fprintf(stderr, "You are not allowed to sign trusted messages!\n");
         return;
     }
+    UTEE_TRACE_BEGIN("trustlib_sign", 0);
+    // a reload does not free the key while it signs
+    trustlib_keyring_reader reader;
+    const trustlib_legacy_key_t* legacy_key = trustlib_legacy_key();
+    if(!legacy_key->fits) {
+        fprintf(stderr, "Key is too large for this message format!\n");
+        UTEE_TRACE_END("trustlib_sign", 0);
+        return;
+    }
+    // do_sign branches on the bits of d, in constant-time mode the keyring signs
+    static const int consttime = getenv(TRUSTLIB_CONSTTIME_ENV) != NULL;
+    const trustlib_key_t* key = legacy_key->key;
+    if(consttime && key) {
+        trustlib_bn_t M, C;
+        if(data2bn(data_to_sign, sizeof(trustlib_sign_data_t), &M) || trustlib_bn_cmp(&M, &key->n.m) >= 0) {
+            fprintf(stderr, "[trustlib] Message cannot be signed in constant-time mode\n");
+            UTEE_TRACE_END("trustlib_sign", 0);
+            return;
+        }
+        trustlib_blind_sign(key, &M, &C);
+        trustlib_bn_to_hex(&C, data->signature, sizeof(data->signature));
+        data->param = key->param;
+        UTEE_TRACE_END("trustlib_sign", 0);
+        return;
+    }
     InfInt M = data2int(data_to_sign, sizeof(trustlib_sign_data_t)); 
     
-    InfInt C = do_sign(M, d);
+    UTEE_TRACE_BEGIN("do_sign", 0);
+    InfInt C = do_sign(M, legacy_key->d, legacy_key->n);
+    UTEE_TRACE_END("do_sign", 0);
+    if(utee_ecall_cancelled()) {
+        UTEE_TRACE_END("trustlib_sign", 0);
+        return;
+    }
     
     hexlify(C, data->signature);
-    hexlify(n, data->param.n);
-    hexlify(e, data->param.e);
+    data->param = legacy_key->param;
+    UTEE_TRACE_END("trustlib_sign", 0);
 }
 
 // -----------------------------------------------------------------------
 int trustlib_verify(trustlib_signed_data_t* data) {
-    if(n == 0) trustlib_init();
+    trustlib_preload();
+    
+    trustlib_keyring_reader reader;
+    const trustlib_legacy_key_t* legacy_key = trustlib_legacy_key();
+    if(!legacy_key->fits) {
+        return 0;
+    }
+    // the verdict is cached for exactly the checked message, so the client must not modify it meanwhile
+    trustlib_signed_data_t request;
+    memcpy(&request, data, sizeof(request));
+    // tokens are verified again and again, their verdict is cached
+    const trustlib_key_t* key = legacy_key->key;
+    uint8_t digest[TRUSTLIB_SHA256_SIZE], verdict;
+    if(key) {
+        trustlib_cache_digest(TRUSTLIB_CACHE_VERIFY, key->id, &(request.data), sizeof(trustlib_sign_data_t), request.signature, strnlen(request.signature, sizeof(request.signature)), digest);
+        if(trustlib_cache_get(TRUSTLIB_CACHE_VERIFY, digest, &verdict) == 1) {
+            return verdict;
+        }
+    }
     
+    UTEE_TRACE_BEGIN("trustlib_verify", 0);
     char signed_data[sizeof(trustlib_sign_data_t)];
-    memcpy(signed_data, (void*)&(data->data), sizeof(trustlib_sign_data_t));
+    memcpy(signed_data, (void*)&(request.data), sizeof(trustlib_sign_data_t));
     
-    InfInt C = unhexlify(data->signature);
+    InfInt C = unhexlify(request.signature);
     
-    InfInt M = do_sign(C, e);
+    InfInt M = do_sign(C, legacy_key->e, legacy_key->n);
     
     InfInt origM = data2int(signed_data, sizeof(trustlib_sign_data_t));
     
-    return (M == origM);
+    UTEE_TRACE_END("trustlib_verify", 0);
+    verdict = (M == origM);
+    if(key && !utee_ecall_cancelled()) {
+        trustlib_cache_put(digest, &verdict, 1);
+    }
+    return verdict;
 }
 
+// -----------------------------------------------------------------------
+void trustlib_sign_wire(trustlib_wire_t* data) {
+    trustlib_preload();
+    
+    // the client can still modify the message, only a private copy is checked and used
+    trustlib_wire_t request;
+    memcpy(&request, data, sizeof(request));
+    data->signature_len = 0;
+    if(trustlib_wire_validate(&request, sizeof(request))) {
+        fprintf(stderr, "Invalid message format!\n");
+        return;
+    }
+    if(request.issuer == TRUSTLIB_TRUSTED) {
+        fprintf(stderr, "You are not allowed to sign trusted messages!\n");
+        return;
+    }
+    // the fingerprint of the request selects the key, a reload does not free it while it signs
+    trustlib_keyring_reader reader;
+    const trustlib_key_t* key = trustlib_keyring_get(request.fingerprint);
+    if(!key) {
+        fprintf(stderr, "Unknown key!\n");
+        return;
+    }
+    trustlib_sign_data_t data_to_sign;
+    memset(&data_to_sign, 0, sizeof(data_to_sign));
+    data_to_sign.issuer = (trustlib_issuer_t)request.issuer;
+    memcpy(data_to_sign.message, request.payload, request.message_len);
+    UTEE_TRACE_BEGIN("trustlib_sign", 0);
+    // signing is deterministic, a message signed before gets the cached signature
+    uint8_t digest[TRUSTLIB_SHA256_SIZE], signature[TRUSTLIB_SIGNATURE_SIZE];
+    trustlib_cache_digest(TRUSTLIB_CACHE_SIGN, key->id, &data_to_sign, sizeof(data_to_sign), NULL, 0, digest);
+    int len = trustlib_cache_get(TRUSTLIB_CACHE_SIGN, digest, signature);
+    if(len <= 0) {
+        trustlib_bn_t M, C;
+        if(data2bn((char*)&data_to_sign, sizeof(trustlib_sign_data_t), &M) || trustlib_bn_cmp(&M, &key->n.m) >= 0) {
+            UTEE_TRACE_END("trustlib_sign", 0);
+            return;
+        }
+        
+        UTEE_TRACE_BEGIN("do_sign", 0);
+        trustlib_blind_sign(key, &M, &C);
+        UTEE_TRACE_END("do_sign", 0);
+        len = utee_ecall_cancelled() ? -1 : trustlib_bn_to_bytes(&C, signature, sizeof(signature));
+        if(len > 0) {
+            trustlib_cache_put(digest, signature, len);
+        }
+    }
+    if(len > 0) {
+        // the message moves behind the signature
+        memcpy(data->payload, signature, len);
+        memcpy(data->payload + len, request.payload, request.message_len);
+        memcpy(data->fingerprint, key->id, sizeof(key->id));
+        data->signature_len = len;
+    }
+    UTEE_TRACE_END("trustlib_sign", 0);
+}
+
+// -----------------------------------------------------------------------
+int trustlib_verify_wire(const trustlib_wire_t* data) {
+    trustlib_preload();
+    
+    // the client can still modify the message, only a private copy is checked and used
+    trustlib_wire_t request;
+    memcpy(&request, data, sizeof(request));
+    if(trustlib_wire_validate(&request, sizeof(request)) || !request.signature_len) {
+        return 0;
+    }
+    // signatures made with a key that is not in the keyring cannot be verified
+    trustlib_keyring_reader reader;
+    const trustlib_key_t* key = trustlib_keyring_get(request.fingerprint);
+    if(!key || memcmp(request.fingerprint, key->id, sizeof(key->id))) {
+        return 0;
+    }
+    UTEE_TRACE_BEGIN("trustlib_verify", 0);
+    trustlib_sign_data_t signed_data;
+    memset(&signed_data, 0, sizeof(signed_data));
+    signed_data.issuer = (trustlib_issuer_t)request.issuer;
+    memcpy(signed_data.message, request.payload + request.signature_len, request.message_len);
+    
+    uint8_t digest[TRUSTLIB_SHA256_SIZE], verdict;
+    trustlib_cache_digest(TRUSTLIB_CACHE_VERIFY, key->id, &signed_data, sizeof(signed_data), request.payload, request.signature_len, digest);
+    if(trustlib_cache_get(TRUSTLIB_CACHE_VERIFY, digest, &verdict) == 1) {
+        UTEE_TRACE_END("trustlib_verify", 0);
+        return verdict;
+    }
+    trustlib_bn_t C, M, origM;
+    trustlib_bn_from_bytes(&C, request.payload, request.signature_len);
+    verdict = trustlib_bn_cmp(&C, &key->n.m) < 0 && !data2bn((char*)&signed_data, sizeof(trustlib_sign_data_t), &origM);
+    if(verdict) {
+        trustlib_key_verify(key, &C, &M);
+        verdict = !trustlib_bn_cmp(&M, &origM);
+    }
+    trustlib_cache_put(digest, &verdict, 1);
+    
+    UTEE_TRACE_END("trustlib_verify", 0);
+    return verdict;
+}
+
+// -----------------------------------------------------------------------
+static int emsa_encode(const uint8_t* digest, const trustlib_key_t* key, trustlib_bn_t* M) {
+    // EMSA-PKCS1-v1_5: 00 01 ff .. ff 00 DigestInfo digest, as long as n
+    int k = (trustlib_bn_bits(&key->n.m) + 7) / 8;
+    int t = sizeof(sha256_prefix) + TRUSTLIB_DIGEST_SIZE;
+    if(k < t + 11) {
+        return 1;
+    }
+    uint8_t em[TRUSTLIB_SIGNATURE_SIZE];
+    em[0] = 0x00;
+    em[1] = 0x01;
+    memset(em + 2, 0xff, k - t - 3);
+    em[k - t - 1] = 0x00;
+    memcpy(em + k - t, sha256_prefix, sizeof(sha256_prefix));
+    memcpy(em + k - TRUSTLIB_DIGEST_SIZE, digest, TRUSTLIB_DIGEST_SIZE);
+    // the encoding is big endian, the numbers are little endian
+    uint8_t number[TRUSTLIB_SIGNATURE_SIZE];
+    for(int i = 0; i < k; i++) {
+        number[i] = em[k - 1 - i];
+    }
+    trustlib_bn_from_bytes(M, number, k);
+    return 0;
+}
+
+// -----------------------------------------------------------------------
+static trustlib_stream_t* trustlib_stream_acquire(uint64_t stream) {
+    uint64_t index = stream & 0xff;
+    if(!stream || index >= TRUSTLIB_MAX_STREAMS) {
+        return NULL;
+    }
+    trustlib_stream_t* s = &streams[index];
+    // a stream is used by one thread at a time
+    if(!__sync_bool_compare_and_swap(&(s->busy), 0, 1)) {
+        return NULL;
+    }
+    if(s->handle != stream) {
+        __sync_lock_release(&(s->busy));
+        return NULL;
+    }
+    return s;
+}
+
+// -----------------------------------------------------------------------
+static void trustlib_stream_release(trustlib_stream_t* s, int end) {
+    if(end) {
+        s->handle = 0;
+    } else {
+        s->used = time(NULL);
+    }
+    __sync_lock_release(&(s->busy));
+}
+
+// -----------------------------------------------------------------------
+static int trustlib_stream_finish(uint64_t stream, uint8_t* issuer, uint8_t* digest) {
+    trustlib_stream_t* s = trustlib_stream_acquire(stream);
+    if(!s) {
+        return 1;
+    }
+    *issuer = s->issuer;
+    trustlib_sha256_final(&(s->sha), digest);
+    trustlib_stream_release(s, 1);
+    return 0;
+}
+
+// -----------------------------------------------------------------------
+uint64_t trustlib_stream_begin(trustlib_issuer_t issuer) {
+    // handles cannot be guessed, so no client can use the document of another client
+    uint64_t handle = 0, nonce;
+    if(getrandom(&nonce, sizeof(nonce), 0) != sizeof(nonce)) {
+        fprintf(stderr, "Could not create a document!\n");
+        return 0;
+    }
+    nonce = (nonce << 8) ? nonce << 8 : 1ull << 8;
+    time_t now = time(NULL);
+    pthread_mutex_lock(&streams_lock);
+    for(int i = 0; i < TRUSTLIB_MAX_STREAMS && !handle; i++) {
+        trustlib_stream_t* s = &streams[i];
+        if(!__sync_bool_compare_and_swap(&(s->busy), 0, 1)) {
+            continue;
+        }
+        // free streams, or documents abandoned by their client
+        if(!s->handle || now - s->used > TRUSTLIB_STREAM_IDLE) {
+            s->handle = handle = nonce | i;
+            s->issuer = issuer;
+            s->used = now;
+            // the issuer is part of the signed digest
+            trustlib_sha256_init(&(s->sha));
+            trustlib_sha256_update(&(s->sha), &(s->issuer), 1);
+        }
+        __sync_lock_release(&(s->busy));
+    }
+    pthread_mutex_unlock(&streams_lock);
+    if(!handle) {
+        fprintf(stderr, "Too many documents!\n");
+    }
+    return handle;
+}
+
+// -----------------------------------------------------------------------
+int trustlib_stream_update(uint64_t stream, const trustlib_chunk_t* chunks) {
+    trustlib_stream_t* s = trustlib_stream_acquire(stream);
+    if(!s) {
+        return 1;
+    }
+    UTEE_TRACE_BEGIN("trustlib_hash", 0);
+    // every chunk has to be in the arena, a list longer than the arena has a cycle
+    size_t total = 0, limit = utee_arena_size();
+    int valid = 1;
+    for(const trustlib_chunk_t* c = chunks; c && valid; c = c->next.get()) {
+        uint64_t offset = utee_arena_offset(c);
+        if(!utee_arena_ptr(offset) || !utee_arena_ptr(offset + sizeof(trustlib_chunk_t) - 1)) {
+            valid = 0;
+            break;
+        }
+        // read once, the client can still modify the chunk
+        uint64_t len = c->len;
+        total += sizeof(trustlib_chunk_t) + len;
+        valid = len <= TRUSTLIB_CHUNK_SIZE && total <= limit && (!len || utee_arena_ptr(offset + sizeof(trustlib_chunk_t) + len - 1));
+        if(valid) {
+            trustlib_sha256_update(&(s->sha), c->data, len);
+        }
+    }
+    UTEE_TRACE_END("trustlib_hash", 0);
+    // a partially hashed document must not be signed
+    trustlib_stream_release(s, !valid);
+    return !valid;
+}
+
+// -----------------------------------------------------------------------
+void trustlib_stream_abort(uint64_t stream) {
+    trustlib_stream_t* s = trustlib_stream_acquire(stream);
+    if(s) {
+        trustlib_stream_release(s, 1);
+    }
+}
+
+// -----------------------------------------------------------------------
+void trustlib_sign_stream(uint64_t stream, trustlib_doc_signature_t* signature) {
+    trustlib_preload();
+    
+    signature->signature_len = 0;
+    uint8_t issuer, digest[TRUSTLIB_DIGEST_SIZE];
+    if(trustlib_stream_finish(stream, &issuer, digest)) {
+        fprintf(stderr, "Unknown document!\n");
+        return;
+    }
+    if(issuer == TRUSTLIB_TRUSTED) {
+        fprintf(stderr, "You are not allowed to sign trusted messages!\n");
+        return;
+    }
+    trustlib_keyring_reader reader;
+    uint8_t fingerprint[TRUSTLIB_FINGERPRINT_SIZE];
+    memcpy(fingerprint, signature->fingerprint, sizeof(fingerprint));
+    const trustlib_key_t* key = trustlib_keyring_get(fingerprint);
+    trustlib_bn_t M, C;
+    if(!key || emsa_encode(digest, key, &M)) {
+        fprintf(stderr, "Unknown key!\n");
+        return;
+    }
+    UTEE_TRACE_BEGIN("trustlib_sign", 0);
+    trustlib_blind_sign(key, &M, &C);
+    int len = trustlib_bn_to_bytes(&C, signature->signature, sizeof(signature->signature));
+    signature->magic = TRUSTLIB_DOC_MAGIC;
+    signature->issuer = issuer;
+    memcpy(signature->fingerprint, key->id, sizeof(key->id));
+    memcpy(signature->digest, digest, sizeof(digest));
+    signature->signature_len = len > 0 ? len : 0;
+    UTEE_TRACE_END("trustlib_sign", 0);
+}
+
+// -----------------------------------------------------------------------
+int trustlib_verify_stream(uint64_t stream, const trustlib_doc_signature_t* signature) {
+    trustlib_preload();
+    
+    uint8_t issuer, digest[TRUSTLIB_DIGEST_SIZE];
+    if(trustlib_stream_finish(stream, &issuer, digest)) {
+        return 0;
+    }
+    // the client can still modify the signature, only a private copy is checked and used
+    trustlib_doc_signature_t copy;
+    memcpy(&copy, signature, sizeof(copy));
+    if(copy.magic != TRUSTLIB_DOC_MAGIC || copy.issuer != issuer || !copy.signature_len || copy.signature_len > TRUSTLIB_SIGNATURE_SIZE) {
+        return 0;
+    }
+    trustlib_keyring_reader reader;
+    const trustlib_key_t* key = trustlib_keyring_get(copy.fingerprint);
+    trustlib_bn_t M, C, origM;
+    if(!key || memcmp(copy.fingerprint, key->id, sizeof(key->id)) || emsa_encode(digest, key, &origM)) {
+        return 0;
+    }
+    UTEE_TRACE_BEGIN("trustlib_verify", 0);
+    trustlib_bn_from_bytes(&C, copy.signature, copy.signature_len);
+    int valid = trustlib_bn_cmp(&C, &key->n.m) < 0;
+    if(valid) {
+        trustlib_key_verify(key, &C, &M);
+        valid = !trustlib_bn_cmp(&M, &origM);
+    }
+    UTEE_TRACE_END("trustlib_verify", 0);
+    return valid;
+}
@@ -1,72 +1,319 @@
 #include <iostream>
+#include <string.h>
+#include <libgen.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/inotify.h>
 #include "utee.h"
+#include "utee_call.h"
 #include "trustlib.h"
+#include "trustlib_blind.h"
+#include "trustlib_keyring.h"
+
+/** Milliseconds without changes to the key files before the keys are reloaded */
+#define TRUSTLIB_RELOAD_DELAY 200
+/** Changes to key files that trigger a reload, including keys replaced by a rename */
+#define TRUSTLIB_RELOAD_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE)
+
+static int keys_watch = -1;
+
+/**
+ * Check whether an inotify event changes a key file
+ * 
+ * @param event The event
+ * @return 1 for key.params and keys in the key directory, 0 otherwise
+ */
+static int key_changed(const struct inotify_event* event) {
+    if(!event->len) {
+        return 0;
+    }
+    if(event->wd == keys_watch) {
+        size_t len = strlen(event->name), ext = strlen(TRUSTLIB_KEYS_EXT);
+        return len > ext && !strcmp(event->name + len - ext, TRUSTLIB_KEYS_EXT);
+    }
+    return !strcmp(event->name, "key.params");
+}
+
+/**
+ * Thread reloading the keys when the key files change
+ * 
+ * Changes are collected until the key files stay unchanged for 
+ * TRUSTLIB_RELOAD_DELAY ms, as keys are often written in several steps. 
+ * The reload runs on this thread, the enclave threads keep serving ECALLs.
+ * 
+ * @param arg The inotify file descriptor
+ */
+static void* key_watcher(void* arg) {
+    int fd = (int)(intptr_t)arg;
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    // time of the last change to a key file in ms, 0 if there is no change to reload
+    long changed = 0;
+    while(1) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long ms = now.tv_sec * 1000 + now.tv_nsec / 1000000;
+        // other files in the working directory change all the time, they do not delay the reload
+        long timeout = changed ? changed + TRUSTLIB_RELOAD_DELAY - ms : -1;
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        int ready = changed && timeout <= 0 ? 0 : poll(&pfd, 1, timeout);
+        if(ready < 0) {
+            continue;
+        }
+        if(!ready) {
+            changed = 0;
+            std::cout << "[*] Key files changed, reloading keys" << std::endl;
+            if(trustlib_reload_keys()) {
+                std::cout << "[!] Failed to reload keys" << std::endl;
+            }
+            continue;
+        }
+        ssize_t len = read(fd, buffer, sizeof(buffer));
+        if(len <= 0) {
+            break;
+        }
+        for(char* p = buffer; p < buffer + len; p += sizeof(struct inotify_event) + ((struct inotify_event*)p)->len) {
+            if(key_changed((struct inotify_event*)p)) {
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                changed = now.tv_sec * 1000 + now.tv_nsec / 1000000;
+            }
+        }
+    }
+    close(fd);
+    return NULL;
+}
+
+/**
+ * Start reloading the keys when key.params or the key directory changes
+ * 
+ * @return 0 on success, 1 if the key files cannot be watched
+ */
+static int watch_keys() {
+    int fd = inotify_init1(IN_CLOEXEC);
+    if(fd == -1) {
+        return 1;
+    }
+    const char* dir = getenv(TRUSTLIB_KEYS_ENV);
+    if(inotify_add_watch(fd, ".", TRUSTLIB_RELOAD_EVENTS) == -1) {
+        close(fd);
+        return 1;
+    }
+    // without a key directory, only key.params is watched
+    keys_watch = inotify_add_watch(fd, dir ? dir : TRUSTLIB_KEYS_DIR, TRUSTLIB_RELOAD_EVENTS);
+    // signals are handled by the enclave threads
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    pthread_t thread;
+    int failed = pthread_create(&thread, NULL, key_watcher, (void*)(intptr_t)fd);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if(failed) {
+        close(fd);
+        return 1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
 
 /**
  * The sign ECALL
  *
  * This function is called, when the sign ECALL is called. 
- * It takes the data of the ECALL and forwards it to the enclave function trustlib_sign()
- * All other 6 parameters of the ECALL are not needed and thus ignored.
+ * It forwards the message, which resides in the channel, to the enclave function trustlib_sign()
  * 
  * @param data A trustlib_signed_data_t message to sign
- * @return always 0
  */
-uint64_t ecall_sign(uint64_t p1, uint64_t p2, uint64_t p3, uint64_t p4, uint64_t p5, uint64_t p6, uint64_t len, void* data) {
-    UNUSED(p1);
-    UNUSED(p2);
-    UNUSED(p3);
-    UNUSED(p4);
-    UNUSED(p5);
-    UNUSED(p6);
-    UNUSED(len);
-    trustlib_sign((trustlib_signed_data_t*)data);
-    return 0;
+void ecall_sign(trustlib_signed_data_t& data) {
+    trustlib_sign(&data);
 }
 
 /**
  * The verify ECALL
  * 
  * This function is called, when the verify ECALL is called. 
- * It takes the data of the ECALL and forwards it to the enclave function trustlib_verify()
- * All other 6 parameters of the ECALL are not needed and thus ignored.
+ * It forwards the message, which resides in the channel, to the enclave function trustlib_verify()
  * 
  * @param data A trustlib_signed_data_t message to verify
  * @return 1 if the signature verification was successful, 0 otherwise
  */
-uint64_t ecall_verify(uint64_t p1, uint64_t p2, uint64_t p3, uint64_t p4, uint64_t p5, uint64_t p6, uint64_t len, void* data) {
-    UNUSED(p1);
-    UNUSED(p2);
-    UNUSED(p3);
-    UNUSED(p4);
-    UNUSED(p5);
-    UNUSED(p6);
-    UNUSED(len);
-    return trustlib_verify((trustlib_signed_data_t*)data);
+int ecall_verify(const trustlib_signed_data_t& data) {
+    return trustlib_verify((trustlib_signed_data_t*)&data);
+}
+
+/**
+ * The sign ECALL for the binary format
+ *
+ * Forwards the message, which resides in the channel, to trustlib_sign_wire()
+ * 
+ * @param data A trustlib_wire_t message to sign
+ */
+void ecall_sign_wire(trustlib_wire_t& data) {
+    trustlib_sign_wire(&data);
+}
+
+/**
+ * The verify ECALL for the binary format
+ *
+ * Forwards the message, which resides in the channel, to trustlib_verify_wire()
+ * 
+ * @param data A trustlib_wire_t message to verify
+ * @return 1 if the signature verification was successful, 0 otherwise
+ */
+int ecall_verify_wire(const trustlib_wire_t& data) {
+    return trustlib_verify_wire(&data);
+}
+
+/**
+ * The ECALL starting a document
+ *
+ * Forwards to trustlib_stream_begin()
+ * 
+ * @param issuer Issuer of the document
+ * @return Handle of the stream, 0 on error
+ */
+uint64_t ecall_stream_begin(trustlib_issuer_t issuer) {
+    return trustlib_stream_begin(issuer);
+}
+
+/**
+ * The ECALL hashing chunks of a document
+ *
+ * Forwards the chunks, which reside in the shared arena, to trustlib_stream_update()
+ * 
+ * @param stream Handle of the stream
+ * @param chunks Arena offset of the first chunk
+ * @return 0 on success, 1 otherwise
+ */
+int ecall_stream_update(uint64_t stream, uint64_t chunks) {
+    const trustlib_chunk_t* first = (const trustlib_chunk_t*)utee_arena_ptr(chunks);
+    if(chunks && !first) {
+        trustlib_stream_abort(stream);
+        return 1;
+    }
+    return trustlib_stream_update(stream, first);
+}
+
+/**
+ * The ECALL signing a document
+ *
+ * Forwards the signature, which resides in the channel, to trustlib_sign_stream()
+ * 
+ * @param stream Handle of the stream
+ * @param signature Receives the signature
+ */
+void ecall_sign_stream(uint64_t stream, trustlib_doc_signature_t& signature) {
+    trustlib_sign_stream(stream, &signature);
+}
+
+/**
+ * The ECALL verifying a document
+ *
+ * Forwards the signature, which resides in the channel, to trustlib_verify_stream()
+ * 
+ * @param stream Handle of the stream
+ * @param signature Signature of the document
+ * @return 1 if the signature verification was successful, 0 otherwise
+ */
+int ecall_verify_stream(uint64_t stream, const trustlib_doc_signature_t& signature) {
+    return trustlib_verify_stream(stream, &signature);
 }
 
+/**
+ * The ECALL discarding a document
+ *
+ * Forwards to trustlib_stream_abort()
+ * 
+ * @param stream Handle of the stream
+ */
+void ecall_stream_abort(uint64_t stream) {
+    trustlib_stream_abort(stream);
+}
+
+static_assert(std::is_same<decltype(ecall_sign), trustlib_ecall_sign_t>::value, "Sign ECALL does not match the client stub");
+static_assert(std::is_same<decltype(ecall_verify), trustlib_ecall_verify_t>::value, "Verify ECALL does not match the client stub");
+static_assert(std::is_same<decltype(ecall_sign_wire), trustlib_ecall_sign_wire_t>::value, "Sign ECALL does not match the client stub");
+static_assert(std::is_same<decltype(ecall_verify_wire), trustlib_ecall_verify_wire_t>::value, "Verify ECALL does not match the client stub");
+static_assert(std::is_same<decltype(ecall_stream_begin), trustlib_ecall_stream_begin_t>::value, "Stream ECALL does not match the client stub");
+static_assert(std::is_same<decltype(ecall_stream_update), trustlib_ecall_stream_update_t>::value, "Stream ECALL does not match the client stub");
+static_assert(std::is_same<decltype(ecall_sign_stream), trustlib_ecall_sign_stream_t>::value, "Sign ECALL does not match the client stub");
+static_assert(std::is_same<decltype(ecall_verify_stream), trustlib_ecall_verify_stream_t>::value, "Verify ECALL does not match the client stub");
+static_assert(std::is_same<decltype(ecall_stream_abort), trustlib_ecall_stream_abort_t>::value, "Stream ECALL does not match the client stub");
+
 /**
  * Host application for the trustlib enclave
  * 
  * The function initializes the enclave with the file name of this binary as name, 
- * registers the two ECALLs for signing and verifying, and starts the enclave. 
+ * registers the ECALLs for signing (bulk lane) and verifying (high-priority
+ * lane), for both message formats and for documents, and starts the enclave. 
+ * When started with --daemon, the enclave detaches, loads the key upfront, 
+ * and stays resident for all subsequent clients.
+ * When started with --zygote, the enclave becomes a resident fork server 
+ * that loads the key once and forks ready-to-use instances on request.
+ * When started with --restart, the enclave detaches and takes over a running
+ * instance including its loaded key, e.g., to upgrade the enclave while 
+ * clients stay connected.
+ * Changes to key.params or the key directory are picked up without a 
+ * restart, the keys are reloaded while the enclave keeps serving ECALLs.
  * 
  */
 int main(int argc, char* argv[]) {
-    UNUSED(argc);
-    std::cout << "[*] Starting enclave" << std::endl;
-    if(utee_enclave_init(argv[0])) {
+    int zygote = (argc > 1 && !strcmp(argv[1], UTEE_ZYGOTE_ARG));
+    int restart = (argc > 1 && !strcmp(argv[1], UTEE_RESTART_ARG));
+    int daemon = zygote || restart || (argc > 1 && !strcmp(argv[1], UTEE_DAEMON_ARG));
+    std::cout << "[*] Starting enclave" << (zygote ? " as fork server" : (restart ? " taking over a running instance" : (daemon ? " as daemon" : ""))) << std::endl;
+    if(daemon && utee_enclave_daemon()) {
+        std::cout << "[!] Failed to start daemon" << std::endl;
+        return -5;
+    }
+    if(zygote) {
+        // every instance forked by the fork server inherits the loaded key
+        trustlib_preload();
+        if(utee_enclave_zygote(basename(argv[0]))) {
+            std::cout << "[!] Failed to start fork server" << std::endl;
+            return -6;
+        }
+    }
+    if(restart ? utee_enclave_restart(basename(argv[0])) : utee_enclave_init(basename(argv[0]))) {
         std::cout << "[!] Failed to initialize enclave" << std::endl;
         return -1;
     }
-    if(utee_register_ecall(ecall_sign) == -1) {
+    utee_register_handoff(trustlib_save_key, trustlib_restore_key);
+    // blinding pairs are refreshed while no ECALLs are pending
+    utee_register_idle(trustlib_blind_idle);
+    if(utee::register_ecall<ecall_sign>(UTEE_LANE_BULK) == -1) {
         std::cout << "[!] Failed to register sign ECALL" << std::endl;
         return -2;
     }
-    if(utee_register_ecall(ecall_verify) == -1) {
+    if(utee::register_ecall<ecall_verify>(UTEE_LANE_HIGH) == -1) {
         std::cout << "[!] Failed to register verify ECALL" << std::endl;
         return -3;
     }
+    if(utee::register_ecall<ecall_sign_wire>(UTEE_LANE_BULK) == -1) {
+        std::cout << "[!] Failed to register sign ECALL" << std::endl;
+        return -2;
+    }
+    if(utee::register_ecall<ecall_verify_wire>(UTEE_LANE_HIGH) == -1) {
+        std::cout << "[!] Failed to register verify ECALL" << std::endl;
+        return -3;
+    }
+    // hashing a document is bulk work, starting and discarding it is not
+    if(utee::register_ecall<ecall_stream_begin>(UTEE_LANE_HIGH) == -1 || utee::register_ecall<ecall_stream_update>(UTEE_LANE_BULK) == -1
+        || utee::register_ecall<ecall_sign_stream>(UTEE_LANE_BULK) == -1 || utee::register_ecall<ecall_verify_stream>(UTEE_LANE_HIGH) == -1
+        || utee::register_ecall<ecall_stream_abort>(UTEE_LANE_HIGH) == -1) {
+        std::cout << "[!] Failed to register document ECALLs" << std::endl;
+        return -3;
+    }
+    // signing must not occupy all enclave threads, so verification keeps its latency
+    utee_lane_config(UTEE_LANE_BULK, 1, UTEE_WORKERS / 2);
+    if(daemon && !restart) {
+        trustlib_preload();
+    }
+    // every instance of the fork server watches the key files itself
+    if(watch_keys()) {
+        std::cout << "[!] Failed to watch the key files, keys are not reloaded" << std::endl;
+    }
     if(utee_enclave_start()) {
         std::cout << "[!] Failed to start enclave" << std::endl;
         return -4;
@@ -1,6 +1,7 @@
 #ifndef _TRUSTLIB_H_
 #define _TRUSTLIB_H_
 #include "utee.h"
+#include "utee_arena.h"
 #include <stdlib.h>
 #include <memory.h>
 
@@ -38,12 +39,171 @@ typedef struct {
     char signature[257];
 } trustlib_signed_data_t;
 
+/** Magic value at the start of a signed message in the binary format, "TLW2" */
+#define TRUSTLIB_WIRE_MAGIC 0x32574c54u
+/** Version of the binary format of signed messages */
+#define TRUSTLIB_WIRE_VERSION 3
+/** Size of the fingerprint identifying the public key */
+#define TRUSTLIB_FINGERPRINT_SIZE 8
+/** Maximum size of a binary signature, i.e., of the modulus n (4096 bits) */
+#define TRUSTLIB_SIGNATURE_SIZE 512
+/** Maximum size of the modulus n in bits for trustlib_signed_data_t, whose signature has 256 hex digits */
+#define TRUSTLIB_LEGACY_BITS 1024
+/** Maximum length of a message, the message of trustlib_sign_data_t is zero-terminated */
+#define TRUSTLIB_MESSAGE_SIZE (sizeof(((trustlib_sign_data_t*)0)->message) - 1)
+
+/**
+ * Signed message in the compact binary format (version 3)
+ * 
+ * Instead of the hex-encoded public key and signature of trustlib_signed_data_t,
+ * the message carries a fingerprint of the key and the signature as 
+ * little-endian binary number, followed by the message without padding. 
+ * All fields are little endian. Only the first trustlib_wire_size() bytes
+ * are used, e.g., when stored in a file. The signature covers the same 
+ * trustlib_sign_data_t as in trustlib_signed_data_t, so both formats can 
+ * be converted into each other (see trustlib_wire.h), as long as the key
+ * has at most TRUSTLIB_LEGACY_BITS bits. Version 3 widened signature_len
+ * for keys of up to 4096 bits.
+ */
+typedef struct __attribute__((packed)) {
+    /** TRUSTLIB_WIRE_MAGIC */
+    uint32_t magic;
+    /** TRUSTLIB_WIRE_VERSION */
+    uint8_t version;
+    /** Message issuer, a trustlib_issuer_t */
+    uint8_t issuer;
+    /** Length of the message, at most TRUSTLIB_MESSAGE_SIZE */
+    uint8_t message_len;
+    /** Length of the signature, 0 if the message is not signed */
+    uint16_t signature_len;
+    /** Fingerprint of the public key used to sign the message */
+    uint8_t fingerprint[TRUSTLIB_FINGERPRINT_SIZE];
+    /** The signature, followed by the message */
+    uint8_t payload[TRUSTLIB_SIGNATURE_SIZE + TRUSTLIB_MESSAGE_SIZE];
+} trustlib_wire_t;
+
+/** Magic value at the start of a document signature, "TLD2" (signatures of up to 4096 bits) */
+#define TRUSTLIB_DOC_MAGIC 0x32444c54u
+/** Size of the digest of a document (SHA-256) */
+#define TRUSTLIB_DIGEST_SIZE 32
+/** Maximum number of documents that are hashed at the same time */
+#define TRUSTLIB_MAX_STREAMS 64
+/** Seconds after which an unfinished document can be discarded for a new one */
+#define TRUSTLIB_STREAM_IDLE 60
+/** Environment variable that makes trustlib_sign() use the constant-time exponentiation of the keyring instead of do_sign, read by the enclave */
+#define TRUSTLIB_CONSTTIME_ENV "TRUSTLIB_CONSTTIME"
+
+/**
+ * Detached signature of a document of arbitrary length
+ * 
+ * The document is hashed with SHA-256, prefixed with the issuer byte, and 
+ * the digest is signed with the EMSA-PKCS1-v1_5 encoding of RFC 8017.
+ */
+typedef struct __attribute__((packed)) {
+    /** TRUSTLIB_DOC_MAGIC */
+    uint32_t magic;
+    /** Document issuer, a trustlib_issuer_t */
+    uint8_t issuer;
+    /** Length of the signature, 0 if the document is not signed */
+    uint16_t signature_len;
+    /** Fingerprint of the public key used to sign the document */
+    uint8_t fingerprint[TRUSTLIB_FINGERPRINT_SIZE];
+    /** The signed digest, for information only, verification hashes the document again */
+    uint8_t digest[TRUSTLIB_DIGEST_SIZE];
+    /** The signature as little-endian binary number */
+    uint8_t signature[TRUSTLIB_SIGNATURE_SIZE];
+} trustlib_doc_signature_t;
+
+/**
+ * Piece of a document in the shared arena
+ * 
+ * A document is passed to the enclave as a list of chunks in the arena, 
+ * so that the enclave hashes it where the client placed it. 
+ */
+typedef struct trustlib_chunk {
+    /** Next chunk of the document, NULL for the last one */
+    utee::offset_ptr<struct trustlib_chunk> next;
+    /** Number of bytes in data */
+    uint64_t len;
+    /** The data of the chunk */
+    uint8_t data[];
+} trustlib_chunk_t;
+
+/** Maximum number of bytes in one chunk, i.e., in one arena object */
+#define TRUSTLIB_CHUNK_SIZE (UTEE_ARENA_SLAB - sizeof(trustlib_chunk_t))
+
+/** Signature of the sign ECALL, signs the message in place */
+typedef void trustlib_ecall_sign_t(trustlib_signed_data_t& data);
+/** Signature of the verify ECALL, returns 1 if the signature is valid */
+typedef int trustlib_ecall_verify_t(const trustlib_signed_data_t& data);
+/** Signature of the sign ECALL for the binary format, signs the message in place */
+typedef void trustlib_ecall_sign_wire_t(trustlib_wire_t& data);
+/** Signature of the verify ECALL for the binary format, returns 1 if the signature is valid */
+typedef int trustlib_ecall_verify_wire_t(const trustlib_wire_t& data);
+/** Signature of the ECALL starting a document, returns the stream of the document */
+typedef uint64_t trustlib_ecall_stream_begin_t(trustlib_issuer_t issuer);
+/** Signature of the ECALL hashing chunks of a document, takes the arena offset of the first chunk */
+typedef int trustlib_ecall_stream_update_t(uint64_t stream, uint64_t chunks);
+/** Signature of the ECALL signing a document */
+typedef void trustlib_ecall_sign_stream_t(uint64_t stream, trustlib_doc_signature_t& signature);
+/** Signature of the ECALL verifying a document, returns 1 if the signature is valid */
+typedef int trustlib_ecall_verify_stream_t(uint64_t stream, const trustlib_doc_signature_t& signature);
+/** Signature of the ECALL discarding a document */
+typedef void trustlib_ecall_stream_abort_t(uint64_t stream);
+
+/**
+ * Enclave function to load the key
+ * 
+ * Loads the key used by trustlib_sign() and trustlib_verify(). The key is 
+ * otherwise loaded lazily on the first call. Enclaves that stay resident 
+ * call this function before accepting clients. 
+ */
+extern void trustlib_preload();
+
+/**
+ * Enclave function to reload the keys
+ *
+ * Reads key.params and the key directory again and builds a new keyring
+ * while the ECALLs keep using the current keys. The new keys are then
+ * swapped in atomically: ECALLs that already started finish with the
+ * previous keys, later ones use the new keys, and no ECALL waits for the
+ * reload. The previous keys are freed once no ECALL uses them anymore. If
+ * key.params is invalid, the current keys stay.
+ *
+ * @return 0 if the keys were reloaded, 1 if the current keys stay
+ */
+extern int trustlib_reload_keys();
+
+/**
+ * Enclave function to save the key for a hot restart
+ * 
+ * Serializes the loaded key, so that an enclave taking over does not have 
+ * to load it again. Registered with utee_register_handoff().
+ * 
+ * @param buffer Buffer for the key
+ * @param size Size of the buffer
+ * @return Length of the saved key, 0 if the buffer is too small
+ */
+extern size_t trustlib_save_key(void* buffer, size_t size);
+
+/**
+ * Enclave function to restore the key saved by trustlib_save_key()
+ * 
+ * @param state The saved key
+ * @param len Length of the saved key
+ */
+extern void trustlib_restore_key(const void* state, size_t len);
+
 /**
  * Enclave function to sign a message
  * 
  * If the message issuer is TRUSTLIB_UNTRUSTED, this function signs the message. 
  * The signature and public key for the signature are stored in hex-encoded in 
- * the provided data structure. 
+ * the provided data structure. If TRUSTLIB_CONSTTIME_ENV is set for the 
+ * enclave, the signature is computed with the blinded, constant-time 
+ * exponentiation of the keyring (see trustlib_mont_exp_consttime()).
+ * Keys of more than TRUSTLIB_LEGACY_BITS bits do not fit into the message,
+ * they only sign in the binary formats.
  * 
  * @param data Message to sign
  */
@@ -60,4 +220,75 @@ extern void trustlib_sign(trustlib_signed_data_t* data);
  */
 extern int trustlib_verify(trustlib_signed_data_t* data);
 
+/**
+ * Enclave function to sign a message in the binary format
+ * 
+ * Same as trustlib_sign(), but stores the binary signature and the 
+ * fingerprint of the key. The message has to be the only payload, i.e., 
+ * signature_len is 0. The fingerprint of the request selects the key of 
+ * the keyring (see trustlib_keyring.h), all zero selects the key from 
+ * key.params. If the message cannot be signed, signature_len stays 0.
+ * 
+ * @param data Message to sign
+ */
+extern void trustlib_sign_wire(trustlib_wire_t* data);
+
+/**
+ * Enclave function to verify a signed message in the binary format
+ * 
+ * @param data Message for which the signature should be verified
+ * @return 1 if the signature is valid and was made with a key of the keyring, 0 otherwise
+ */
+extern int trustlib_verify_wire(const trustlib_wire_t* data);
+
+/**
+ * Enclave function to start hashing a document
+ * 
+ * Documents of arbitrary length are hashed in pieces with 
+ * trustlib_stream_update(), and signed with trustlib_sign_stream() or 
+ * verified with trustlib_verify_stream(), which end the stream. 
+ * 
+ * @param issuer Issuer of the document
+ * @return Handle of the stream, 0 if too many documents are hashed
+ */
+extern uint64_t trustlib_stream_begin(trustlib_issuer_t issuer);
+
+/**
+ * Enclave function to hash the next pieces of a document
+ * 
+ * @param stream Handle of the stream
+ * @param chunks First of a list of chunks in the shared arena
+ * @return 0 on success, 1 if the stream or a chunk is invalid
+ */
+extern int trustlib_stream_update(uint64_t stream, const trustlib_chunk_t* chunks);
+
+/**
+ * Enclave function to sign a document and end its stream
+ * 
+ * Only documents with TRUSTLIB_UNTRUSTED as issuer are signed. The 
+ * fingerprint of the signature selects the key of the keyring, all zero 
+ * for the key from key.params. If the document cannot be signed, 
+ * signature_len is 0.
+ * 
+ * @param stream Handle of the stream
+ * @param signature Receives the signature
+ */
+extern void trustlib_sign_stream(uint64_t stream, trustlib_doc_signature_t* signature);
+
+/**
+ * Enclave function to verify the signature of a document and end its stream
+ * 
+ * @param stream Handle of the stream
+ * @param signature Signature of the document
+ * @return 1 if the signature is valid for the issuer of the stream, 0 otherwise
+ */
+extern int trustlib_verify_stream(uint64_t stream, const trustlib_doc_signature_t* signature);
+
+/**
+ * Enclave function to discard a document
+ * 
+ * @param stream Handle of the stream
+ */
+extern void trustlib_stream_abort(uint64_t stream);
+
 #endif
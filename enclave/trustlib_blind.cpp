@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/random.h>
+
+#include "trustlib_blind.h"
+
+/** The pair has to be computed */
+#define TRUSTLIB_BLIND_EMPTY 0
+/** The pair was not used yet */
+#define TRUSTLIB_BLIND_FRESH 1
+/** The pair was used and has to be squared */
+#define TRUSTLIB_BLIND_USED 2
+/** The pair is being computed, squared, or copied */
+#define TRUSTLIB_BLIND_BUSY 3
+
+/** A blinding pair */
+typedef struct {
+    int state;
+    /** Key of the pair, pairs of a key that was replaced are computed again */
+    uint8_t id[TRUSTLIB_FINGERPRINT_SIZE];
+    /** r^e mod n */
+    trustlib_bn_t vf;
+    /** r^-1 mod n */
+    trustlib_bn_t vi;
+} trustlib_blind_pair_t;
+
+/** Blinding pairs of the key at the same position in the keyring */
+typedef struct {
+    /** 1 if the key signed, only pairs of those keys are computed in the background */
+    int active;
+    uint8_t id[TRUSTLIB_FINGERPRINT_SIZE];
+    trustlib_blind_pair_t pair[TRUSTLIB_BLIND_PAIRS];
+} trustlib_blind_key_t;
+
+static trustlib_blind_key_t blind[TRUSTLIB_MAX_KEYS];
+
+// -----------------------------------------------------------------------
+static int trustlib_blind_compute(const trustlib_key_t* key, trustlib_blind_pair_t* pair) {
+    uint8_t random[TRUSTLIB_SIGNATURE_SIZE];
+    size_t len = (trustlib_bn_bits(&key->n.m) + 7) / 8;
+    if(getrandom(random, len, 0) != (ssize_t)len) {
+        fprintf(stderr, "[trustlib] Could not get randomness for blinding\n");
+        return 1;
+    }
+    trustlib_bn_t r, exp, one, check;
+    trustlib_bn_from_bytes(&r, random, len);
+    trustlib_bn_mod(&r, &r, &key->n.m);
+    // r^-1 = r^(e * d - 2), as e * d - 1 is a multiple of the order of r
+    trustlib_bn_set(&one, 1);
+    trustlib_bn_mul(&exp, &key->e, &key->d);
+    trustlib_bn_sub(&exp, &exp, &one);
+    trustlib_bn_sub(&exp, &exp, &one);
+    trustlib_mont_exp(&key->n, &pair->vf, &r, &key->e);
+    trustlib_mont_exp_consttime(&key->n, &pair->vi, &r, &exp, trustlib_bn_bits(&key->e) + trustlib_bn_bits(&key->n.m));
+    // fails for an r that is not coprime to n (and for keys that are not valid at all)
+    trustlib_mont_mulmod(&key->n, &check, &r, &pair->vi);
+    if(trustlib_bn_cmp(&check, &one)) {
+        return 1;
+    }
+    memcpy(pair->id, key->id, TRUSTLIB_FINGERPRINT_SIZE);
+    return 0;
+}
+
+// -----------------------------------------------------------------------
+static int trustlib_blind_refresh(const trustlib_key_t* key, trustlib_blind_pair_t* pair, int state) {
+    if(state == TRUSTLIB_BLIND_EMPTY || memcmp(pair->id, key->id, TRUSTLIB_FINGERPRINT_SIZE)) {
+        return trustlib_blind_compute(key, pair);
+    }
+    if(state == TRUSTLIB_BLIND_USED) {
+        trustlib_mont_mulmod(&key->n, &pair->vf, &pair->vf, &pair->vf);
+        trustlib_mont_mulmod(&key->n, &pair->vi, &pair->vi, &pair->vi);
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------
+static int trustlib_blind_take(const trustlib_key_t* key, trustlib_bn_t* vf, trustlib_bn_t* vi) {
+    trustlib_blind_key_t* entry = NULL;
+    size_t index = key - trustlib_keyring_get(NULL);
+    if(index < TRUSTLIB_MAX_KEYS) {
+        entry = &blind[index];
+        if(!entry->active || memcmp(entry->id, key->id, TRUSTLIB_FINGERPRINT_SIZE)) {
+            memcpy(entry->id, key->id, TRUSTLIB_FINGERPRINT_SIZE);
+            __atomic_store_n(&(entry->active), 1, __ATOMIC_RELEASE);
+        }
+    }
+    // a fresh pair if there is one, otherwise one that is only squared, computing one is the last resort
+    static const int order[] = { TRUSTLIB_BLIND_FRESH, TRUSTLIB_BLIND_USED, TRUSTLIB_BLIND_EMPTY };
+    for(size_t o = 0; entry && o < sizeof(order) / sizeof(order[0]); o++) {
+        int wanted = order[o];
+        for(int i = 0; i < TRUSTLIB_BLIND_PAIRS; i++) {
+            trustlib_blind_pair_t* pair = &(entry->pair[i]);
+            if(!__sync_bool_compare_and_swap(&(pair->state), wanted, TRUSTLIB_BLIND_BUSY)) {
+                continue;
+            }
+            if(trustlib_blind_refresh(key, pair, wanted)) {
+                __atomic_store_n(&(pair->state), TRUSTLIB_BLIND_EMPTY, __ATOMIC_RELEASE);
+                return 1;
+            }
+            *vf = pair->vf;
+            *vi = pair->vi;
+            __atomic_store_n(&(pair->state), TRUSTLIB_BLIND_USED, __ATOMIC_RELEASE);
+            return 0;
+        }
+    }
+    // all pairs are in use
+    trustlib_blind_pair_t pair;
+    if(trustlib_blind_compute(key, &pair)) {
+        return 1;
+    }
+    *vf = pair.vf;
+    *vi = pair.vi;
+    return 0;
+}
+
+// -----------------------------------------------------------------------
+void trustlib_blind_sign(const trustlib_key_t* key, const trustlib_bn_t* message, trustlib_bn_t* signature) {
+    trustlib_bn_t vf, vi, blinded;
+    if(trustlib_blind_take(key, &vf, &vi)) {
+        // without randomness the key still signs, only unblinded
+        trustlib_key_sign(key, message, signature);
+        return;
+    }
+    trustlib_mont_mulmod(&key->n, &blinded, message, &vf);
+    trustlib_key_sign(key, &blinded, signature);
+    trustlib_mont_mulmod(&key->n, signature, signature, &vi);
+}
+
+// -----------------------------------------------------------------------
+int trustlib_blind_idle() {
+    // a reload frees the keyring only after the pair is refreshed
+    trustlib_keyring_reader reader;
+    int keys = trustlib_keyring_size();
+    for(int k = 0; k < keys && k < TRUSTLIB_MAX_KEYS; k++) {
+        trustlib_blind_key_t* entry = &blind[k];
+        if(!__atomic_load_n(&(entry->active), __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+        const trustlib_key_t* key = trustlib_keyring_get(entry->id);
+        if(!key) {
+            continue;
+        }
+        for(int i = 0; i < TRUSTLIB_BLIND_PAIRS; i++) {
+            trustlib_blind_pair_t* pair = &(entry->pair[i]);
+            int state = pair->state;
+            if((state != TRUSTLIB_BLIND_USED && state != TRUSTLIB_BLIND_EMPTY) || !__sync_bool_compare_and_swap(&(pair->state), state, TRUSTLIB_BLIND_BUSY)) {
+                continue;
+            }
+            // a failed computation is retried on the next idle round
+            int failed = trustlib_blind_refresh(key, pair, state);
+            __atomic_store_n(&(pair->state), failed ? TRUSTLIB_BLIND_EMPTY : TRUSTLIB_BLIND_FRESH, __ATOMIC_RELEASE);
+            return !failed;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,45 @@
+#ifndef _TRUSTLIB_BLIND_H_
+#define _TRUSTLIB_BLIND_H_
+#include <stdint.h>
+#include "trustlib_keyring.h"
+
+/** Number of blinding pairs per key, i.e., concurrent signatures that find a fresh pair */
+#define TRUSTLIB_BLIND_PAIRS 4
+
+/**
+ * @defgroup BLIND Blinding of signatures
+ *
+ * A message is multiplied with r^e before it is signed, and the signature
+ * with r^-1 afterwards, so the exponentiation with the private key never
+ * sees the message itself. Computing a pair (r^e, r^-1) from a random r
+ * takes two exponentiations, so pairs are only computed once per key and
+ * then refreshed by squaring both values, as (r^2)^e = (r^e)^2. A used
+ * pair is refreshed by the enclave threads while there are no ECALLs (see
+ * utee_register_idle()), signing only squares a pair itself if none of the
+ * pairs of the key is fresh.
+ *
+ * @{
+ */
+
+/**
+ * Sign with the private key, blinded
+ *
+ * Same result as trustlib_key_sign(). The first signature of a key computes
+ * a pair, the other pairs of the key are computed in the background.
+ *
+ * @param key The key
+ * @param message Number to sign, has to be smaller than n
+ * @param signature Receives message^d mod n
+ */
+void trustlib_blind_sign(const trustlib_key_t* key, const trustlib_bn_t* message, trustlib_bn_t* signature);
+
+/**
+ * Refresh one used blinding pair, or compute a missing one
+ *
+ * @return 1 if a pair was refreshed or computed, 0 if all pairs are fresh
+ */
+int trustlib_blind_idle();
+
+/** @} */
+
+#endif
@@ -0,0 +1,353 @@
+// the enclave is built without optimization (which keeps the code layout of
+// do_sign stable), the arithmetic of the keyring is not part of the attack
+#pragma GCC optimize("O2")
+
+#include <string.h>
+#include "trustlib_bn.h"
+
+typedef unsigned __int128 trustlib_dlimb_t;
+
+#ifdef TRUSTLIB_BN_TRACE
+#define TRUSTLIB_TRACE(op, address) trustlib_bn_trace(op, address)
+#else
+#define TRUSTLIB_TRACE(op, address)
+#endif
+
+// -----------------------------------------------------------------------
+void trustlib_bn_set(trustlib_bn_t* r, uint64_t v) {
+    memset(r, 0, sizeof(trustlib_bn_t));
+    r->limb[0] = v;
+}
+
+// -----------------------------------------------------------------------
+int trustlib_bn_cmp(const trustlib_bn_t* a, const trustlib_bn_t* b) {
+    for(int i = TRUSTLIB_BN_LIMBS - 1; i >= 0; i--) {
+        if(a->limb[i] != b->limb[i]) {
+            return a->limb[i] > b->limb[i] ? 1 : -1;
+        }
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------
+int trustlib_bn_bits(const trustlib_bn_t* a) {
+    for(int i = TRUSTLIB_BN_LIMBS - 1; i >= 0; i--) {
+        if(a->limb[i]) {
+            return 64 * i + 64 - __builtin_clzll(a->limb[i]);
+        }
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------
+int trustlib_bn_bit(const trustlib_bn_t* a, int bit) {
+    return (a->limb[bit / 64] >> (bit % 64)) & 1;
+}
+
+// -----------------------------------------------------------------------
+uint64_t trustlib_bn_add(trustlib_bn_t* r, const trustlib_bn_t* a, const trustlib_bn_t* b) {
+    uint64_t carry = 0;
+    for(int i = 0; i < TRUSTLIB_BN_LIMBS; i++) {
+        trustlib_dlimb_t t = (trustlib_dlimb_t)a->limb[i] + b->limb[i] + carry;
+        r->limb[i] = (uint64_t)t;
+        carry = t >> 64;
+    }
+    return carry;
+}
+
+// -----------------------------------------------------------------------
+uint64_t trustlib_bn_sub(trustlib_bn_t* r, const trustlib_bn_t* a, const trustlib_bn_t* b) {
+    uint64_t borrow = 0;
+    for(int i = 0; i < TRUSTLIB_BN_LIMBS; i++) {
+        trustlib_dlimb_t t = (trustlib_dlimb_t)a->limb[i] - b->limb[i] - borrow;
+        r->limb[i] = (uint64_t)t;
+        borrow = (uint64_t)(t >> 64) & 1;
+    }
+    return borrow;
+}
+
+// -----------------------------------------------------------------------
+static void trustlib_bn_csub(trustlib_bn_t* r, const trustlib_bn_t* a, const trustlib_bn_t* m) {
+    // r = a - m if a >= m, else a, without a branch on the values
+    trustlib_bn_t diff;
+    uint64_t keep = trustlib_bn_sub(&diff, a, m) - 1;
+    for(int i = 0; i < TRUSTLIB_BN_LIMBS; i++) {
+        r->limb[i] = (diff.limb[i] & keep) | (a->limb[i] & ~keep);
+    }
+}
+
+// -----------------------------------------------------------------------
+void trustlib_bn_mul(trustlib_bn_t* r, const trustlib_bn_t* a, const trustlib_bn_t* b) {
+    trustlib_bn_t t;
+    memset(&t, 0, sizeof(t));
+    for(int i = 0; i < TRUSTLIB_BN_LIMBS; i++) {
+        if(!a->limb[i]) continue;
+        uint64_t carry = 0;
+        for(int j = 0; i + j < TRUSTLIB_BN_LIMBS; j++) {
+            trustlib_dlimb_t p = (trustlib_dlimb_t)a->limb[i] * b->limb[j] + t.limb[i + j] + carry;
+            t.limb[i + j] = (uint64_t)p;
+            carry = p >> 64;
+        }
+    }
+    *r = t;
+}
+
+// -----------------------------------------------------------------------
+static void trustlib_bn_shl1(trustlib_bn_t* r, int bit) {
+    for(int i = TRUSTLIB_BN_LIMBS - 1; i > 0; i--) {
+        r->limb[i] = (r->limb[i] << 1) | (r->limb[i - 1] >> 63);
+    }
+    r->limb[0] = (r->limb[0] << 1) | bit;
+}
+
+// -----------------------------------------------------------------------
+void trustlib_bn_mod(trustlib_bn_t* r, const trustlib_bn_t* a, const trustlib_bn_t* m) {
+    // the remainder stays below 2m, which fits as m has at most TRUSTLIB_BN_BITS - 1 bits
+    trustlib_bn_t t;
+    trustlib_bn_set(&t, 0);
+    for(int bit = trustlib_bn_bits(a) - 1; bit >= 0; bit--) {
+        trustlib_bn_shl1(&t, trustlib_bn_bit(a, bit));
+        if(trustlib_bn_cmp(&t, m) >= 0) {
+            trustlib_bn_sub(&t, &t, m);
+        }
+    }
+    *r = t;
+}
+
+// -----------------------------------------------------------------------
+uint64_t trustlib_bn_div_word(trustlib_bn_t* r, const trustlib_bn_t* a, uint64_t d) {
+    trustlib_dlimb_t rem = 0;
+    for(int i = TRUSTLIB_BN_LIMBS - 1; i >= 0; i--) {
+        trustlib_dlimb_t t = (rem << 64) | a->limb[i];
+        r->limb[i] = (uint64_t)(t / d);
+        rem = t % d;
+    }
+    return (uint64_t)rem;
+}
+
+// -----------------------------------------------------------------------
+int trustlib_bn_from_dec(trustlib_bn_t* r, const char* dec) {
+    trustlib_bn_set(r, 0);
+    if(!*dec) return 1;
+    for(; *dec; dec++) {
+        if(*dec < '0' || *dec > '9') return 1;
+        uint64_t carry = *dec - '0';
+        for(int i = 0; i < TRUSTLIB_BN_LIMBS; i++) {
+            trustlib_dlimb_t t = (trustlib_dlimb_t)r->limb[i] * 10 + carry;
+            r->limb[i] = (uint64_t)t;
+            carry = t >> 64;
+        }
+        if(carry) return 1;
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------
+int trustlib_bn_to_dec(const trustlib_bn_t* a, char* dec, size_t size) {
+    // 19 digits per division, written from the end
+    char buffer[TRUSTLIB_BN_BITS / 3 + 2];
+    char* digit = buffer + sizeof(buffer) - 1;
+    *digit = 0;
+    trustlib_bn_t q = *a;
+    do {
+        uint64_t chunk = trustlib_bn_div_word(&q, &q, 10000000000000000000ull);
+        int last = trustlib_bn_bits(&q) == 0;
+        for(int i = 0; i < 19 && (!last || chunk || i == 0); i++) {
+            *--digit = '0' + chunk % 10;
+            chunk /= 10;
+        }
+    } while(trustlib_bn_bits(&q));
+    size_t len = buffer + sizeof(buffer) - 1 - digit;
+    if(len + 1 > size) return 1;
+    memcpy(dec, digit, len + 1);
+    return 0;
+}
+
+// -----------------------------------------------------------------------
+int trustlib_bn_to_hex(const trustlib_bn_t* a, char* hex, size_t size) {
+    static const char digits[] = "0123456789abcdef";
+    int len = (trustlib_bn_bits(a) + 3) / 4;
+    if((size_t)len + 1 > size) return 1;
+    for(int i = 0; i < len; i++) {
+        int nibble = len - 1 - i;
+        hex[i] = digits[(a->limb[nibble / 16] >> (4 * (nibble % 16))) & 0xf];
+    }
+    hex[len] = 0;
+    return 0;
+}
+
+// -----------------------------------------------------------------------
+void trustlib_bn_from_bytes(trustlib_bn_t* r, const uint8_t* data, size_t len) {
+    trustlib_bn_set(r, 0);
+    for(size_t i = 0; i < len && i < sizeof(r->limb); i++) {
+        r->limb[i / 8] |= (uint64_t)data[i] << (8 * (i % 8));
+    }
+}
+
+// -----------------------------------------------------------------------
+int trustlib_bn_to_bytes(const trustlib_bn_t* a, uint8_t* data, size_t size) {
+    size_t len = (trustlib_bn_bits(a) + 7) / 8;
+    if(len > size) return -1;
+    for(size_t i = 0; i < len; i++) {
+        data[i] = a->limb[i / 8] >> (8 * (i % 8));
+    }
+    return len;
+}
+
+// -----------------------------------------------------------------------
+int trustlib_mont_init(trustlib_mont_t* ctx, const trustlib_bn_t* m) {
+    int bits = trustlib_bn_bits(m);
+    if(!(m->limb[0] & 1) || bits < 2 || bits > TRUSTLIB_BN_BITS - 1) {
+        return 1;
+    }
+    ctx->m = *m;
+    ctx->len = (bits + 63) / 64;
+    // Newton iteration, every step doubles the number of correct bits of m^-1 mod 2^64
+    uint64_t inv = 1;
+    for(int i = 0; i < 6; i++) {
+        inv *= 2 - m->limb[0] * inv;
+    }
+    ctx->minv = -inv;
+    // R^2 mod m by doubling 1 2 * 64 * len times
+    trustlib_bn_set(&ctx->rr, 1);
+    for(int i = 0; i < 2 * 64 * ctx->len; i++) {
+        trustlib_bn_shl1(&ctx->rr, 0);
+        if(trustlib_bn_cmp(&ctx->rr, m) >= 0) {
+            trustlib_bn_sub(&ctx->rr, &ctx->rr, m);
+        }
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------
+void trustlib_mont_mul(const trustlib_mont_t* ctx, trustlib_bn_t* r, const trustlib_bn_t* a, const trustlib_bn_t* b) {
+    // CIOS: interleaves the multiplication with the reduction, one limb of b per round
+    const int len = ctx->len;
+    const uint64_t* m = ctx->m.limb;
+    uint64_t t[TRUSTLIB_BN_LIMBS + 2];
+    // only the limbs of the modulus are used, small moduli do not pay for the width of the numbers
+    memset(t, 0, (len + 2) * sizeof(uint64_t));
+    TRUSTLIB_TRACE('a', a);
+    TRUSTLIB_TRACE('b', b);
+    TRUSTLIB_TRACE('r', r);
+    for(int i = 0; i < len; i++) {
+        uint64_t carry = 0;
+        for(int j = 0; j < len; j++) {
+            trustlib_dlimb_t p = (trustlib_dlimb_t)a->limb[j] * b->limb[i] + t[j] + carry;
+            t[j] = (uint64_t)p;
+            carry = p >> 64;
+        }
+        trustlib_dlimb_t s = (trustlib_dlimb_t)t[len] + carry;
+        t[len] = (uint64_t)s;
+        t[len + 1] = s >> 64;
+
+        uint64_t q = t[0] * ctx->minv;
+        trustlib_dlimb_t p = (trustlib_dlimb_t)q * m[0] + t[0];
+        carry = p >> 64;
+        for(int j = 1; j < len; j++) {
+            p = (trustlib_dlimb_t)q * m[j] + t[j] + carry;
+            t[j - 1] = (uint64_t)p;
+            carry = p >> 64;
+        }
+        s = (trustlib_dlimb_t)t[len] + carry;
+        t[len - 1] = (uint64_t)s;
+        t[len] = t[len + 1] + (uint64_t)(s >> 64);
+    }
+    // the result is below 2m, m is subtracted if the subtraction does not borrow,
+    // selected with a mask, so the timing does not depend on the result
+    const int top = len < TRUSTLIB_BN_LIMBS ? len + 1 : len;
+    uint64_t diff[TRUSTLIB_BN_LIMBS], borrow = 0;
+    for(int j = 0; j < top; j++) {
+        trustlib_dlimb_t d = (trustlib_dlimb_t)t[j] - m[j] - borrow;
+        diff[j] = (uint64_t)d;
+        borrow = (uint64_t)(d >> 64) & 1;
+    }
+    uint64_t keep = borrow - 1;
+    for(int j = 0; j < len; j++) {
+        r->limb[j] = (diff[j] & keep) | (t[j] & ~keep);
+    }
+    memset(r->limb + len, 0, (TRUSTLIB_BN_LIMBS - len) * sizeof(uint64_t));
+}
+
+// -----------------------------------------------------------------------
+void trustlib_mont_mulmod(const trustlib_mont_t* ctx, trustlib_bn_t* r, const trustlib_bn_t* a, const trustlib_bn_t* b) {
+    // (a * b * R^-1) * R^2 * R^-1 = a * b
+    trustlib_mont_mul(ctx, r, a, b);
+    trustlib_mont_mul(ctx, r, r, &ctx->rr);
+}
+
+// -----------------------------------------------------------------------
+void trustlib_mont_reduce(const trustlib_mont_t* ctx, trustlib_bn_t* r, const trustlib_bn_t* a) {
+    // Horner over chunks of len limbs: acc = acc * R + chunk mod m
+    trustlib_bn_t one, acc, chunk;
+    trustlib_bn_set(&one, 1);
+    trustlib_bn_set(&acc, 0);
+    const int len = ctx->len;
+    int chunks = ((trustlib_bn_bits(a) + 63) / 64 + len - 1) / len;
+    for(int c = chunks - 1; c >= 0; c--) {
+        trustlib_mont_mul(ctx, &acc, &acc, &ctx->rr);
+        trustlib_bn_set(&chunk, 0);
+        for(int i = 0; i < len && c * len + i < TRUSTLIB_BN_LIMBS; i++) {
+            chunk.limb[i] = a->limb[c * len + i];
+        }
+        // chunk < R, so chunk * R mod m and back is chunk mod m
+        trustlib_mont_mul(ctx, &chunk, &chunk, &ctx->rr);
+        trustlib_mont_mul(ctx, &chunk, &chunk, &one);
+        trustlib_bn_add(&acc, &acc, &chunk);
+        trustlib_bn_csub(&acc, &acc, &ctx->m);
+    }
+    *r = acc;
+}
+
+// -----------------------------------------------------------------------
+void trustlib_mont_exp(const trustlib_mont_t* ctx, trustlib_bn_t* r, const trustlib_bn_t* base, const trustlib_bn_t* exp) {
+    trustlib_bn_t one, x, acc;
+    trustlib_bn_set(&one, 1);
+    // into the Montgomery domain, acc = 1 * R
+    trustlib_mont_mul(ctx, &x, base, &ctx->rr);
+    trustlib_mont_mul(ctx, &acc, &one, &ctx->rr);
+    for(int bit = trustlib_bn_bits(exp) - 1; bit >= 0; bit--) {
+        trustlib_mont_mul(ctx, &acc, &acc, &acc);
+        if(trustlib_bn_bit(exp, bit)) {
+            trustlib_mont_mul(ctx, &acc, &acc, &x);
+        }
+    }
+    // and back
+    trustlib_mont_mul(ctx, r, &acc, &one);
+}
+
+// -----------------------------------------------------------------------
+void trustlib_mont_exp_consttime(const trustlib_mont_t* ctx, trustlib_bn_t* r, const trustlib_bn_t* base, const trustlib_bn_t* exp, int bits) {
+    const int len = ctx->len, size = 1 << TRUSTLIB_MONT_WINDOW;
+    // table[k] = base^k * R, in the Montgomery domain
+    trustlib_bn_t table[1 << TRUSTLIB_MONT_WINDOW], one, acc, x;
+    trustlib_bn_set(&one, 1);
+    trustlib_mont_mul(ctx, &table[0], &one, &ctx->rr);
+    trustlib_mont_mul(ctx, &table[1], base, &ctx->rr);
+    for(int k = 2; k < size; k++) {
+        trustlib_mont_mul(ctx, &table[k], &table[k - 1], &table[1]);
+    }
+    if(bits > TRUSTLIB_BN_BITS) {
+        bits = TRUSTLIB_BN_BITS;
+    }
+    acc = table[0];
+    // every window squares and multiplies, also if its bits are zero
+    for(int window = (bits + TRUSTLIB_MONT_WINDOW - 1) / TRUSTLIB_MONT_WINDOW - 1; window >= 0; window--) {
+        for(int i = 0; i < TRUSTLIB_MONT_WINDOW; i++) {
+            trustlib_mont_mul(ctx, &acc, &acc, &acc);
+        }
+        int bit = window * TRUSTLIB_MONT_WINDOW;
+        uint64_t w = (exp->limb[bit / 64] >> (bit % 64)) & (size - 1);
+        // the whole table is read, the entry is selected with a mask
+        trustlib_bn_set(&x, 0);
+        for(int k = 0; k < size; k++) {
+            TRUSTLIB_TRACE('t', &table[k]);
+            uint64_t mask = -((((uint64_t)k ^ w) - 1) >> 63);
+            for(int j = 0; j < len; j++) {
+                x.limb[j] |= table[k].limb[j] & mask;
+            }
+        }
+        trustlib_mont_mul(ctx, &acc, &acc, &x);
+    }
+    trustlib_mont_mul(ctx, r, &acc, &one);
+}
@@ -0,0 +1,96 @@
+#ifndef _TRUSTLIB_BN_H_
+#define _TRUSTLIB_BN_H_
+#include <stdint.h>
+#include <stddef.h>
+
+/** Number of 64-bit limbs of a number, i.e., moduli of 4096 bits and the product e * d of their exponents */
+#define TRUSTLIB_BN_LIMBS 66
+/** Maximum number of bits of a number */
+#define TRUSTLIB_BN_BITS (TRUSTLIB_BN_LIMBS * 64)
+/** Window size in bits of the constant-time exponentiation, divides 64 */
+#define TRUSTLIB_MONT_WINDOW 4
+
+/**
+ * @defgroup BN Fixed-width arithmetic for the key contexts
+ *
+ * Unsigned numbers of TRUSTLIB_BN_LIMBS 64-bit limbs (little endian), and
+ * Montgomery multiplication and exponentiation with precomputed constants.
+ * All results must fit into TRUSTLIB_BN_LIMBS limbs, moduli have to be odd
+ * and at most TRUSTLIB_BN_BITS - 1 bits.
+ *
+ * Montgomery multiplication does not branch on its operands. The
+ * constant-time exponentiation uses a fixed window and reads the whole
+ * table for every window, so it executes the same operations with the same
+ * memory accesses for every exponent. It is used for all private exponents.
+ *
+ * @{
+ */
+
+/** Unsigned number */
+typedef struct {
+    uint64_t limb[TRUSTLIB_BN_LIMBS];
+} trustlib_bn_t;
+
+/** Montgomery context of an odd modulus */
+typedef struct {
+    /** The modulus */
+    trustlib_bn_t m;
+    /** R^2 mod m with R = 2^(64 * len), converts into the Montgomery domain */
+    trustlib_bn_t rr;
+    /** -m^-1 mod 2^64 */
+    uint64_t minv;
+    /** Number of limbs of the modulus */
+    int len;
+} trustlib_mont_t;
+
+/** Set a number to a small value */
+void trustlib_bn_set(trustlib_bn_t* r, uint64_t v);
+/** Compare two numbers, returns -1, 0, or 1 */
+int trustlib_bn_cmp(const trustlib_bn_t* a, const trustlib_bn_t* b);
+/** Number of significant bits */
+int trustlib_bn_bits(const trustlib_bn_t* a);
+/** Value of one bit */
+int trustlib_bn_bit(const trustlib_bn_t* a, int bit);
+/** r = a + b, returns the carry */
+uint64_t trustlib_bn_add(trustlib_bn_t* r, const trustlib_bn_t* a, const trustlib_bn_t* b);
+/** r = a - b, returns the borrow */
+uint64_t trustlib_bn_sub(trustlib_bn_t* r, const trustlib_bn_t* a, const trustlib_bn_t* b);
+/** r = a * b, the product must fit */
+void trustlib_bn_mul(trustlib_bn_t* r, const trustlib_bn_t* a, const trustlib_bn_t* b);
+/** r = a mod m, bit-wise long division (for precomputation only) */
+void trustlib_bn_mod(trustlib_bn_t* r, const trustlib_bn_t* a, const trustlib_bn_t* m);
+/** r = a / d for a single-limb divisor d > 0, returns the remainder */
+uint64_t trustlib_bn_div_word(trustlib_bn_t* r, const trustlib_bn_t* a, uint64_t d);
+
+/** Parse a decimal number, returns 0 on success, 1 if it is invalid or too large */
+int trustlib_bn_from_dec(trustlib_bn_t* r, const char* dec);
+/** Decimal encoding, returns 0 on success, 1 if the buffer is too small */
+int trustlib_bn_to_dec(const trustlib_bn_t* a, char* dec, size_t size);
+/** Lower-case hex encoding without leading zeros, returns 0 on success, 1 if the buffer is too small */
+int trustlib_bn_to_hex(const trustlib_bn_t* a, char* hex, size_t size);
+/** Read a little-endian byte string */
+void trustlib_bn_from_bytes(trustlib_bn_t* r, const uint8_t* data, size_t len);
+/** Write a little-endian byte string without leading zeros, returns the length, -1 if the buffer is too small */
+int trustlib_bn_to_bytes(const trustlib_bn_t* a, uint8_t* data, size_t size);
+
+/** Precompute the Montgomery constants of an odd modulus, returns 0 on success */
+int trustlib_mont_init(trustlib_mont_t* ctx, const trustlib_bn_t* m);
+/** r = a * b * R^-1 mod m, for a, b < m */
+void trustlib_mont_mul(const trustlib_mont_t* ctx, trustlib_bn_t* r, const trustlib_bn_t* a, const trustlib_bn_t* b);
+/** r = a * b mod m, for a, b < m */
+void trustlib_mont_mulmod(const trustlib_mont_t* ctx, trustlib_bn_t* r, const trustlib_bn_t* a, const trustlib_bn_t* b);
+/** r = a mod m for any a, faster than trustlib_bn_mod() for a much larger than m */
+void trustlib_mont_reduce(const trustlib_mont_t* ctx, trustlib_bn_t* r, const trustlib_bn_t* a);
+/** r = base ^ exp mod m, for base < m, branches on the bits of exp, only for public exponents */
+void trustlib_mont_exp(const trustlib_mont_t* ctx, trustlib_bn_t* r, const trustlib_bn_t* base, const trustlib_bn_t* exp);
+/** r = base ^ exp mod m in constant time, for base < m and exp of at most bits bits (a public bound, e.g., the bits of m) */
+void trustlib_mont_exp_consttime(const trustlib_mont_t* ctx, trustlib_bn_t* r, const trustlib_bn_t* base, const trustlib_bn_t* exp, int bits);
+
+#ifdef TRUSTLIB_BN_TRACE
+/** Hook of the constant-time check (consttime_check.cpp), called with every operand of a multiplication and every table entry that is read */
+void trustlib_bn_trace(char op, const void* address);
+#endif
+
+/** @} */
+
+#endif
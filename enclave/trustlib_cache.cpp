@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "trustlib_cache.h"
+
+/** A cached result */
+typedef struct {
+    uint8_t digest[TRUSTLIB_SHA256_SIZE];
+    /** 1 if the entry holds a result */
+    uint8_t used;
+    /** 1 if the entry was hit since the hand passed it */
+    uint8_t referenced;
+    uint8_t len;
+    uint8_t value[TRUSTLIB_CACHE_VALUE];
+} trustlib_cache_entry_t;
+
+/** A set of entries */
+typedef struct {
+    /** Spinlock, held only while the set is searched */
+    int lock;
+    /** Next entry considered for replacement */
+    int hand;
+    trustlib_cache_entry_t way[TRUSTLIB_CACHE_WAYS];
+} trustlib_cache_set_t;
+
+static trustlib_cache_set_t* sets;
+/** Number of sets - 1, the number of sets is a power of two */
+static uint64_t set_mask;
+static pthread_once_t cache_created = PTHREAD_ONCE_INIT;
+/** Hits and misses per kind, counters in the statistics of the enclave */
+static uint64_t* hits[2];
+static uint64_t* misses[2];
+static uint64_t unpublished;
+
+// -----------------------------------------------------------------------
+static uint64_t* trustlib_cache_counter(const char* name) {
+    uint64_t* counter = utee_stats_counter(name);
+    return counter ? counter : &unpublished;
+}
+
+// -----------------------------------------------------------------------
+static void trustlib_cache_create() {
+    const char* env = getenv(TRUSTLIB_CACHE_SIZE_ENV);
+    long size = env ? atol(env) : TRUSTLIB_CACHE_SIZE;
+    hits[TRUSTLIB_CACHE_SIGN] = trustlib_cache_counter("cache sign hits");
+    misses[TRUSTLIB_CACHE_SIGN] = trustlib_cache_counter("cache sign misses");
+    hits[TRUSTLIB_CACHE_VERIFY] = trustlib_cache_counter("cache verify hits");
+    misses[TRUSTLIB_CACHE_VERIFY] = trustlib_cache_counter("cache verify misses");
+    if(size <= 0) {
+        return;
+    }
+    uint64_t count = 1;
+    while(count * 2 * TRUSTLIB_CACHE_WAYS <= (uint64_t)size) count *= 2;
+    sets = (trustlib_cache_set_t*)calloc(count, sizeof(trustlib_cache_set_t));
+    if(!sets) {
+        fprintf(stderr, "[trustlib] Could not allocate result cache\n");
+        return;
+    }
+    set_mask = count - 1;
+}
+
+// -----------------------------------------------------------------------
+static trustlib_cache_set_t* trustlib_cache_lock(const uint8_t* digest) {
+    pthread_once(&cache_created, trustlib_cache_create);
+    if(!sets) {
+        return NULL;
+    }
+    uint64_t index;
+    memcpy(&index, digest, sizeof(index));
+    trustlib_cache_set_t* set = &sets[index & set_mask];
+    while(__sync_lock_test_and_set(&(set->lock), 1)) {
+        while(set->lock) __builtin_ia32_pause();
+    }
+    return set;
+}
+
+// -----------------------------------------------------------------------
+static trustlib_cache_entry_t* trustlib_cache_find(trustlib_cache_set_t* set, const uint8_t* digest) {
+    for(int i = 0; i < TRUSTLIB_CACHE_WAYS; i++) {
+        if(set->way[i].used && !memcmp(set->way[i].digest, digest, TRUSTLIB_SHA256_SIZE)) {
+            return &(set->way[i]);
+        }
+    }
+    return NULL;
+}
+
+// -----------------------------------------------------------------------
+void trustlib_cache_digest(trustlib_cache_kind_t kind, const uint8_t* key_id, const void* data, size_t len, const void* signature, size_t signature_len, uint8_t* digest) {
+    trustlib_sha256_t sha;
+    uint8_t prefix = kind;
+    trustlib_sha256_init(&sha);
+    trustlib_sha256_update(&sha, &prefix, 1);
+    trustlib_sha256_update(&sha, key_id, TRUSTLIB_FINGERPRINT_SIZE);
+    trustlib_sha256_update(&sha, data, len);
+    if(signature) {
+        trustlib_sha256_update(&sha, signature, signature_len);
+    }
+    trustlib_sha256_final(&sha, digest);
+}
+
+// -----------------------------------------------------------------------
+int trustlib_cache_get(trustlib_cache_kind_t kind, const uint8_t* digest, void* value) {
+    trustlib_cache_set_t* set = trustlib_cache_lock(digest);
+    if(!set) {
+        return -1;
+    }
+    trustlib_cache_entry_t* entry = trustlib_cache_find(set, digest);
+    int len = -1;
+    if(entry) {
+        entry->referenced = 1;
+        len = entry->len;
+        memcpy(value, entry->value, len);
+    }
+    __sync_lock_release(&(set->lock));
+    __atomic_fetch_add(entry ? hits[kind] : misses[kind], 1, __ATOMIC_RELAXED);
+    return len;
+}
+
+// -----------------------------------------------------------------------
+void trustlib_cache_put(const uint8_t* digest, const void* value, size_t len) {
+    if(len > TRUSTLIB_CACHE_VALUE) {
+        return;
+    }
+    trustlib_cache_set_t* set = trustlib_cache_lock(digest);
+    if(!set) {
+        return;
+    }
+    trustlib_cache_entry_t* entry = trustlib_cache_find(set, digest);
+    // CLOCK: the hand skips entries that were hit, and clears their bit
+    while(!entry) {
+        trustlib_cache_entry_t* candidate = &(set->way[set->hand]);
+        set->hand = (set->hand + 1) % TRUSTLIB_CACHE_WAYS;
+        if(candidate->used && candidate->referenced) {
+            candidate->referenced = 0;
+        } else {
+            entry = candidate;
+        }
+    }
+    memcpy(entry->digest, digest, TRUSTLIB_SHA256_SIZE);
+    memcpy(entry->value, value, len);
+    entry->len = len;
+    entry->referenced = 0;
+    entry->used = 1;
+    __sync_lock_release(&(set->lock));
+}
@@ -0,0 +1,74 @@
+#ifndef _TRUSTLIB_CACHE_H_
+#define _TRUSTLIB_CACHE_H_
+#include <stdint.h>
+#include <stddef.h>
+#include "trustlib.h"
+#include "trustlib_sha256.h"
+
+/** Default number of cached results */
+#define TRUSTLIB_CACHE_SIZE 4096
+/** Environment variable overriding the number of cached results, 0 disables the cache, read by the enclave */
+#define TRUSTLIB_CACHE_SIZE_ENV "TRUSTLIB_CACHE_SIZE"
+/** Number of entries of a set, a result can only be stored in the set of its digest */
+#define TRUSTLIB_CACHE_WAYS 8
+/** Maximum size of a cached result, i.e., a binary signature */
+#define TRUSTLIB_CACHE_VALUE TRUSTLIB_SIGNATURE_SIZE
+
+/**
+ * @defgroup CACHE Cache of sign and verify results
+ *
+ * Signing is deterministic and verifying has no side effects, so their
+ * results are cached, keyed by a SHA-256 digest over the kind of the
+ * operation, the key id, the signed data, and the signature. The cache is
+ * set-associative: a digest selects one set of TRUSTLIB_CACHE_WAYS
+ * entries, which is locked only for the lookup, and entries of a set are
+ * replaced with the CLOCK algorithm (entries that were hit since the hand
+ * passed them get a second chance). Hits and misses are published as
+ * counters in the statistics of the enclave (see uteestat).
+ *
+ * @{
+ */
+
+/** Operation of a cached result */
+typedef enum {
+    /** The result is a binary signature */
+    TRUSTLIB_CACHE_SIGN,
+    /** The result is one byte, 1 if the signature is valid */
+    TRUSTLIB_CACHE_VERIFY
+} trustlib_cache_kind_t;
+
+/**
+ * Compute the digest identifying a result
+ *
+ * @param kind Operation
+ * @param key_id Id of the key, TRUSTLIB_FINGERPRINT_SIZE bytes
+ * @param data The signed data
+ * @param len Length of the signed data
+ * @param signature The signature, NULL for signing
+ * @param signature_len Length of the signature
+ * @param digest Receives TRUSTLIB_SHA256_SIZE bytes
+ */
+void trustlib_cache_digest(trustlib_cache_kind_t kind, const uint8_t* key_id, const void* data, size_t len, const void* signature, size_t signature_len, uint8_t* digest);
+
+/**
+ * Look up a result
+ *
+ * @param kind Operation, for the statistics
+ * @param digest Digest of the result
+ * @param value Receives the result, TRUSTLIB_CACHE_VALUE bytes
+ * @return Length of the result, -1 if it is not cached
+ */
+int trustlib_cache_get(trustlib_cache_kind_t kind, const uint8_t* digest, void* value);
+
+/**
+ * Store a result
+ *
+ * @param digest Digest of the result
+ * @param value The result
+ * @param len Length of the result, at most TRUSTLIB_CACHE_VALUE bytes
+ */
+void trustlib_cache_put(const uint8_t* digest, const void* value, size_t len);
+
+/** @} */
+
+#endif
@@ -2,11 +2,31 @@
 #define _TRUSTLIB_ENCLAVE_H_
 
 #include "trustlib.h"
+#include "trustlib_wire.h"
+#include "utee_call.h"
+#include <unistd.h>
 
 /** ECALL number to sign a message */
 #define TRUSTLIB_ECALL_SIGN   1
 /** ECALL number to verify a message */
 #define TRUSTLIB_ECALL_VERIFY 2
+/** ECALL number to sign a message in the binary format */
+#define TRUSTLIB_ECALL_SIGN_WIRE 3
+/** ECALL number to verify a message in the binary format */
+#define TRUSTLIB_ECALL_VERIFY_WIRE 4
+/** ECALL number to start a document */
+#define TRUSTLIB_ECALL_STREAM_BEGIN 5
+/** ECALL number to hash chunks of a document */
+#define TRUSTLIB_ECALL_STREAM_UPDATE 6
+/** ECALL number to sign a document */
+#define TRUSTLIB_ECALL_SIGN_STREAM 7
+/** ECALL number to verify a document */
+#define TRUSTLIB_ECALL_VERIFY_STREAM 8
+/** ECALL number to discard a document */
+#define TRUSTLIB_ECALL_STREAM_ABORT 9
+
+/** Number of chunks passed to the enclave in one ECALL by trustlib_stream_fd_enclave() */
+#define TRUSTLIB_STREAM_BATCH 64
 
 /**
  * Sign a message
@@ -21,13 +41,8 @@
  * @param data The message and issuer of the data to sign. 
  */
 void trustlib_sign_enclave(trustlib_signed_data_t* data) {
-    utee_msg_t* msg = (utee_msg_t*)calloc(sizeof(trustlib_signed_data_t) + sizeof(utee_msg_t), 1);
-    msg->call = TRUSTLIB_ECALL_SIGN;
-    msg->len = sizeof(trustlib_signed_data_t);
-    memcpy(msg->data, data, msg->len);
-    utee_ecall(msg);
-    memcpy(data, msg->data, msg->len);
-    free(msg);
+    utee::ecall_stub<trustlib_ecall_sign_t> sign(TRUSTLIB_ECALL_SIGN);
+    sign(*data);
 }
 
 /**
@@ -41,15 +56,152 @@ void trustlib_sign_enclave(trustlib_signed_data_t* data) {
  * @return 1 if the signature is correct, 0 otherwise
  */
 int trustlib_verify_enclave(trustlib_signed_data_t* data) {
-    utee_msg_t* msg = (utee_msg_t*)calloc(sizeof(trustlib_signed_data_t) + sizeof(utee_msg_t), 1);
-    msg->call = TRUSTLIB_ECALL_VERIFY;
-    msg->len = sizeof(trustlib_signed_data_t);
-    memcpy(msg->data, data, msg->len);
-    uint64_t result = utee_ecall(msg);
-    free(msg);
+    utee::ecall_stub<trustlib_ecall_verify_t> verify(TRUSTLIB_ECALL_VERIFY);
+    return verify(*data);
+}
+
+/**
+ * Sign a message in the binary format
+ * 
+ * Same as trustlib_sign_enclave(), for a message initialized with 
+ * trustlib_wire_init(). After the function returns, the fields 
+ * "fingerprint" and "signature_len" and the payload are populated.
+ * 
+ * @param data The message and issuer of the data to sign
+ * @return 0 if the message was signed, 1 otherwise
+ */
+int trustlib_sign_enclave_wire(trustlib_wire_t* data) {
+    utee::ecall_stub<trustlib_ecall_sign_wire_t> sign(TRUSTLIB_ECALL_SIGN_WIRE);
+    sign(*data);
+    return !data->signature_len;
+}
+
+/**
+ * Verify a signed message in the binary format
+ * 
+ * @param data The message for which the signature should be verified
+ * @return 1 if the signature is correct, 0 otherwise
+ */
+int trustlib_verify_enclave_wire(const trustlib_wire_t* data) {
+    utee::ecall_stub<trustlib_ecall_verify_wire_t> verify(TRUSTLIB_ECALL_VERIFY_WIRE);
+    return verify(*data);
+}
+
+/**
+ * Start a document
+ * 
+ * The corresponding enclave function for this call is trustlib_stream_begin()
+ * 
+ * @param issuer Issuer of the document
+ * @return Handle of the stream, 0 on error
+ */
+uint64_t trustlib_stream_begin_enclave(trustlib_issuer_t issuer) {
+    utee::ecall_stub<trustlib_ecall_stream_begin_t> begin(TRUSTLIB_ECALL_STREAM_BEGIN);
+    return begin(issuer);
+}
+
+/**
+ * Hash the next chunks of a document
+ * 
+ * The chunks have to be allocated in the arena with utee_arena_alloc() and 
+ * can be reused or freed after the function returns. 
+ * The corresponding enclave function for this call is trustlib_stream_update()
+ * 
+ * @param stream Handle of the stream
+ * @param chunks First of a list of chunks
+ * @return 0 on success, 1 otherwise, the stream is discarded on error
+ */
+int trustlib_stream_update_enclave(uint64_t stream, const trustlib_chunk_t* chunks) {
+    utee::ecall_stub<trustlib_ecall_stream_update_t> update(TRUSTLIB_ECALL_STREAM_UPDATE);
+    return update(stream, utee_arena_offset(chunks)) != 0;
+}
+
+/**
+ * Hash the content of a file as the next part of a document
+ * 
+ * The file is read directly into chunks in the arena, which are passed to 
+ * the enclave in batches of TRUSTLIB_STREAM_BATCH chunks. 
+ * 
+ * @param stream Handle of the stream
+ * @param fd File to read until its end
+ * @return 0 on success, 1 otherwise
+ */
+int trustlib_stream_fd_enclave(uint64_t stream, int fd) {
+    trustlib_chunk_t* chunks[TRUSTLIB_STREAM_BATCH];
+    int allocated = 0, eof = 0, result = 0;
+    while(!eof && !result) {
+        int used = 0;
+        for(; used < TRUSTLIB_STREAM_BATCH && !eof; used++) {
+            if(used == allocated) {
+                chunks[used] = (trustlib_chunk_t*)utee_arena_alloc(UTEE_ARENA_SLAB);
+                if(!chunks[used]) break;
+                allocated++;
+            }
+            trustlib_chunk_t* chunk = chunks[used];
+            chunk->next = NULL;
+            chunk->len = 0;
+            while(chunk->len < TRUSTLIB_CHUNK_SIZE) {
+                ssize_t len = read(fd, chunk->data + chunk->len, TRUSTLIB_CHUNK_SIZE - chunk->len);
+                if(len <= 0) {
+                    result = (len < 0);
+                    eof = 1;
+                    break;
+                }
+                chunk->len += len;
+            }
+            if(used) chunks[used - 1]->next = chunk;
+        }
+        // no chunk, i.e., the arena is exhausted
+        result = result || !used || trustlib_stream_update_enclave(stream, chunks[0]);
+    }
+    for(int i = 0; i < allocated; i++) {
+        utee_arena_free(chunks[i]);
+    }
     return result;
 }
 
+/**
+ * Sign a document and end its stream
+ * 
+ * The corresponding enclave function for this call is trustlib_sign_stream()
+ * Only the field "fingerprint" has to be specified, all zero for the default 
+ * key. After the function returns, the other fields are populated.
+ * 
+ * @param stream Handle of the stream
+ * @param signature Receives the signature
+ * @return 0 if the document was signed, 1 otherwise
+ */
+int trustlib_sign_stream_enclave(uint64_t stream, trustlib_doc_signature_t* signature) {
+    utee::ecall_stub<trustlib_ecall_sign_stream_t> sign(TRUSTLIB_ECALL_SIGN_STREAM);
+    signature->signature_len = 0;
+    sign(stream, *signature);
+    return !signature->signature_len;
+}
+
+/**
+ * Verify the signature of a document and end its stream
+ * 
+ * The corresponding enclave function for this call is trustlib_verify_stream()
+ * 
+ * @param stream Handle of the stream, started with the issuer of the signature
+ * @param signature Signature of the document
+ * @return 1 if the signature is correct, 0 otherwise
+ */
+int trustlib_verify_stream_enclave(uint64_t stream, const trustlib_doc_signature_t* signature) {
+    utee::ecall_stub<trustlib_ecall_verify_stream_t> verify(TRUSTLIB_ECALL_VERIFY_STREAM);
+    return verify(stream, *signature) == 1;
+}
+
+/**
+ * Discard a document
+ * 
+ * @param stream Handle of the stream
+ */
+void trustlib_stream_abort_enclave(uint64_t stream) {
+    utee::ecall_stub<trustlib_ecall_stream_abort_t> abort(TRUSTLIB_ECALL_STREAM_ABORT);
+    abort(stream);
+}
+
 /**
  * Load and initialize the enclave
  * 
@@ -0,0 +1,574 @@
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trustlib_keyring.h"
+#include "trustlib_wire.h"
+
+/** Number of slots of the hash index, a power of two with at most 50% load */
+#define TRUSTLIB_KEYRING_SLOTS (2 * TRUSTLIB_MAX_KEYS)
+
+/** Header of the key cache, followed by the hash index, the keys, and the default key file */
+typedef struct {
+    /** TRUSTLIB_KEY_CACHE_MAGIC */
+    uint64_t magic;
+    /** TRUSTLIB_KEY_CACHE_VERSION */
+    uint32_t version;
+    /** sizeof(trustlib_key_t), the cache is only valid for the same layout */
+    uint32_t key_size;
+    /** Number of keys */
+    uint32_t count;
+    /** Length of the default key file */
+    uint32_t text_len;
+    /** Checksum over everything following the header */
+    uint64_t checksum;
+} trustlib_key_cache_t;
+
+/** Exponentiation with one prime of a key, possibly on a helper thread */
+typedef struct trustlib_prime_exp {
+    const trustlib_mont_t* prime;
+    const trustlib_bn_t* exp;
+    const trustlib_bn_t* message;
+    trustlib_bn_t result;
+    /** Next queued exponentiation */
+    struct trustlib_prime_exp* next;
+    /** 0 while queued, 1 while a helper computes it, 2 when done */
+    int state;
+} trustlib_prime_exp_t;
+
+/** Helper threads computing queued exponentiations of multi-prime keys */
+typedef struct {
+    pthread_mutex_t lock;
+    /** Signaled when exponentiations are queued */
+    pthread_cond_t queued;
+    /** Signaled when a helper finished an exponentiation */
+    pthread_cond_t done;
+    trustlib_prime_exp_t* queue;
+    int helpers;
+} trustlib_prime_pool_t;
+
+/** A keyring, replaced as a whole when the keys are reloaded */
+struct trustlib_keyring {
+    const trustlib_key_t* keys;
+    /** Open-addressing hash index over the key ids, index of the key + 1, 0 for empty slots */
+    const uint16_t* index;
+    int count;
+    /** Memory of a keyring that is built, the keys and index point to it */
+    trustlib_key_t* key_store;
+    uint16_t* index_store;
+    /** Mapping of the key cache, the keys and index point into it */
+    void* map;
+    size_t map_size;
+};
+
+/** Position of a reader in the read-side section, padded to a cache line */
+typedef struct {
+    /** Epoch when the reader entered, 0 if it is outside */
+    alignas(64) uint64_t epoch;
+} trustlib_keyring_reader_t;
+
+/** The keyring that is built, not visible to readers yet */
+static trustlib_keyring_t* building;
+/** The published keyring */
+static trustlib_keyring_t* current;
+
+static trustlib_keyring_reader_t readers[TRUSTLIB_KEYRING_READERS];
+static int reader_count;
+/** Readers beyond TRUSTLIB_KEYRING_READERS, counted together */
+static int shared_readers;
+static uint64_t epoch = 1;
+static __thread int reader = -1;
+static __thread int reader_depth;
+/** Keyring seen by this thread in its read-side section */
+static __thread const trustlib_keyring_t* view;
+static trustlib_prime_pool_t pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, 0 };
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+
+// -----------------------------------------------------------------------
+static size_t trustlib_keyring_slot(const uint8_t* id) {
+    // the fingerprint already is a hash
+    uint64_t hash = 0;
+    memcpy(&hash, id, TRUSTLIB_FINGERPRINT_SIZE);
+    return hash & (TRUSTLIB_KEYRING_SLOTS - 1);
+}
+
+// -----------------------------------------------------------------------
+static const trustlib_keyring_t* trustlib_keyring_current() {
+    return view ? view : __atomic_load_n(&current, __ATOMIC_ACQUIRE);
+}
+
+// -----------------------------------------------------------------------
+static trustlib_keyring_t* trustlib_keyring_building() {
+    if(!building) {
+        building = (trustlib_keyring_t*)calloc(1, sizeof(trustlib_keyring_t));
+        if(!building) {
+            return NULL;
+        }
+    }
+    if(!building->map && !building->key_store) {
+        building->key_store = (trustlib_key_t*)calloc(TRUSTLIB_MAX_KEYS, sizeof(trustlib_key_t));
+        building->index_store = (uint16_t*)calloc(TRUSTLIB_KEYRING_SLOTS, sizeof(uint16_t));
+        building->keys = building->key_store;
+        building->index = building->index_store;
+    }
+    return building;
+}
+
+// -----------------------------------------------------------------------
+static int trustlib_keyring_crt(trustlib_key_t* key, const trustlib_bn_t* prime, int count) {
+    trustlib_bn_t product, one, p1, exp;
+    trustlib_bn_set(&product, 1);
+    trustlib_bn_set(&one, 1);
+    for(int i = 0; i < count; i++) {
+        if(trustlib_bn_bits(&product) + trustlib_bn_bits(&prime[i]) > TRUSTLIB_BN_BITS || trustlib_mont_init(&key->prime[i], &prime[i])) {
+            return 1;
+        }
+        trustlib_bn_sub(&p1, &prime[i], &one);
+        trustlib_bn_mod(&key->dprime[i], &key->d, &p1);
+        if(i) {
+            // product^-1 = product^(prime - 2) mod prime, as it is prime
+            trustlib_bn_sub(&exp, &p1, &one);
+            trustlib_mont_reduce(&key->prime[i], &key->coeff[i], &product);
+            trustlib_mont_exp_consttime(&key->prime[i], &key->coeff[i], &key->coeff[i], &exp, trustlib_bn_bits(&prime[i]));
+        }
+        trustlib_bn_mul(&product, &product, &prime[i]);
+    }
+    if(trustlib_bn_cmp(&product, &key->n.m)) {
+        return 1;
+    }
+    // numbers that are not the prime factors of n give wrong signatures
+    trustlib_bn_t two, signature, check;
+    trustlib_bn_set(&two, 2);
+    key->primes = count;
+    trustlib_key_sign(key, &two, &signature);
+    trustlib_key_verify(key, &signature, &check);
+    return trustlib_bn_cmp(&check, &two) != 0;
+}
+
+// -----------------------------------------------------------------------
+int trustlib_keyring_add(const char* params, const char* source) {
+    trustlib_keyring_t* ring = trustlib_keyring_building();
+    if(!ring || !ring->key_store || !ring->index_store || ring->count == TRUSTLIB_MAX_KEYS) {
+        fprintf(stderr, "[trustlib] Keyring is full, ignoring key %s\n", source);
+        return 1;
+    }
+    std::istringstream fields(params);
+    std::string s_n, s_e, s_d, s_prime;
+    fields >> s_n >> s_e >> s_d;
+
+    trustlib_key_t* key = &ring->key_store[ring->count];
+    memset(key, 0, sizeof(trustlib_key_t));
+    trustlib_bn_t n, prime[TRUSTLIB_MAX_PRIMES + 1];
+    if(trustlib_bn_from_dec(&n, s_n.c_str()) || trustlib_bn_from_dec(&key->e, s_e.c_str()) || trustlib_bn_from_dec(&key->d, s_d.c_str())
+        || trustlib_mont_init(&key->n, &n) || trustlib_bn_bits(&n) > 8 * TRUSTLIB_SIGNATURE_SIZE) {
+        fprintf(stderr, "[trustlib] Invalid key %s\n", source);
+        return 1;
+    }
+    int primes = 0, invalid = 0;
+    while(primes <= TRUSTLIB_MAX_PRIMES && fields >> s_prime) {
+        invalid |= trustlib_bn_from_dec(&prime[primes++], s_prime.c_str());
+    }
+    if(primes && (invalid || primes < 2 || primes > TRUSTLIB_MAX_PRIMES || trustlib_keyring_crt(key, prime, primes))) {
+        // the key is still usable, only slower
+        fprintf(stderr, "[trustlib] Invalid primes of key %s, signing without CRT\n", source);
+        key->primes = 0;
+    }
+    // keys above TRUSTLIB_LEGACY_BITS bits have no public key in the format of trustlib_signed_data_t
+    char n_hex[TRUSTLIB_BN_BITS / 4 + 1], e_hex[TRUSTLIB_BN_BITS / 4 + 1];
+    trustlib_bn_to_hex(&n, n_hex, sizeof(n_hex));
+    trustlib_bn_to_hex(&key->e, e_hex, sizeof(e_hex));
+    trustlib_fingerprint_hex(n_hex, sizeof(n_hex), e_hex, sizeof(e_hex), key->id);
+    if(trustlib_bn_bits(&n) <= TRUSTLIB_LEGACY_BITS && strlen(e_hex) < sizeof(key->param.e)) {
+        strcpy(key->param.n, n_hex);
+        strcpy(key->param.e, e_hex);
+    }
+
+    size_t slot = trustlib_keyring_slot(key->id);
+    while(ring->index[slot]) {
+        if(!memcmp(ring->keys[ring->index[slot] - 1].id, key->id, TRUSTLIB_FINGERPRINT_SIZE)) {
+            fprintf(stderr, "[trustlib] Duplicate key %s\n", source);
+            return 1;
+        }
+        slot = (slot + 1) & (TRUSTLIB_KEYRING_SLOTS - 1);
+    }
+    ring->index_store[slot] = ++ring->count;
+    return 0;
+}
+
+// -----------------------------------------------------------------------
+static uint64_t trustlib_keyring_checksum(const void* data, size_t len) {
+    // FNV-1a over 64-bit words, the cache consists of whole words up to the default key file
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for(size_t i = 0; i < len; i += sizeof(uint64_t)) {
+        uint64_t word = 0;
+        memcpy(&word, bytes + i, len - i < sizeof(word) ? len - i : sizeof(word));
+        hash = (hash ^ word) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// -----------------------------------------------------------------------
+static int trustlib_keyring_newer(const char* path, const struct stat* cache) {
+    struct stat info;
+    if(stat(path, &info)) {
+        return 0;
+    }
+    return info.st_mtim.tv_sec > cache->st_mtim.tv_sec || (info.st_mtim.tv_sec == cache->st_mtim.tv_sec && info.st_mtim.tv_nsec > cache->st_mtim.tv_nsec);
+}
+
+// -----------------------------------------------------------------------
+static int trustlib_keyring_outdated(const char* params, const char* dir, const struct stat* cache) {
+    // adding or removing a key changes the directory, editing one only the key
+    if(trustlib_keyring_newer(params, cache) || trustlib_keyring_newer(dir, cache)) {
+        return 1;
+    }
+    DIR* d = opendir(dir);
+    if(!d) {
+        return 0;
+    }
+    int outdated = 0;
+    struct dirent* entry;
+    while(!outdated && (entry = readdir(d))) {
+        std::string path = std::string(dir) + "/" + entry->d_name;
+        outdated = entry->d_name[0] != '.' && trustlib_keyring_newer(path.c_str(), cache);
+    }
+    closedir(d);
+    return outdated;
+}
+
+// -----------------------------------------------------------------------
+int trustlib_keyring_map(const char* cache, const char* params, const char* dir, const char** text, size_t* len) {
+    if(building) {
+        return 1;
+    }
+    int fd = open(cache, O_RDONLY);
+    if(fd == -1) {
+        return 1;
+    }
+    struct stat info;
+    if(fstat(fd, &info) || (size_t)info.st_size < sizeof(trustlib_key_cache_t) || trustlib_keyring_outdated(params, dir, &info)) {
+        close(fd);
+        return 1;
+    }
+    void* map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        return 1;
+    }
+    const trustlib_key_cache_t* header = (const trustlib_key_cache_t*)map;
+    const uint8_t* body = (const uint8_t*)(header + 1);
+    size_t keys_size = header->count * sizeof(trustlib_key_t);
+    size_t index_size = TRUSTLIB_KEYRING_SLOTS * sizeof(uint16_t);
+    size_t size = sizeof(trustlib_key_cache_t) + index_size + keys_size + header->text_len;
+    if(header->magic != TRUSTLIB_KEY_CACHE_MAGIC || header->version != TRUSTLIB_KEY_CACHE_VERSION || header->key_size != sizeof(trustlib_key_t)
+        || !header->count || header->count > TRUSTLIB_MAX_KEYS || size != (size_t)info.st_size
+        || header->checksum != trustlib_keyring_checksum(body, size - sizeof(trustlib_key_cache_t))) {
+        fprintf(stderr, "[trustlib] Invalid key cache %s\n", cache);
+        munmap(map, info.st_size);
+        return 1;
+    }
+    // the keyring is used in place and stays mapped
+    building = (trustlib_keyring_t*)calloc(1, sizeof(trustlib_keyring_t));
+    if(!building) {
+        munmap(map, info.st_size);
+        return 1;
+    }
+    building->map = map;
+    building->map_size = info.st_size;
+    building->index = (const uint16_t*)body;
+    building->keys = (const trustlib_key_t*)(body + index_size);
+    building->count = header->count;
+    *text = (const char*)(body + index_size + keys_size);
+    *len = header->text_len;
+    return 0;
+}
+
+// -----------------------------------------------------------------------
+int trustlib_keyring_save(const char* cache, const char* text, size_t len) {
+    if(!building || !building->count) {
+        return 1;
+    }
+    trustlib_key_cache_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = TRUSTLIB_KEY_CACHE_MAGIC;
+    header.version = TRUSTLIB_KEY_CACHE_VERSION;
+    header.key_size = sizeof(trustlib_key_t);
+    header.count = building->count;
+    header.text_len = len;
+    std::string body((const char*)building->index, TRUSTLIB_KEYRING_SLOTS * sizeof(uint16_t));
+    body.append((const char*)building->keys, building->count * sizeof(trustlib_key_t));
+    body.append(text, len);
+    header.checksum = trustlib_keyring_checksum(body.data(), body.size());
+
+    // written under a temporary name, so that no enclave maps a partial cache
+    std::string tmp = std::string(cache) + ".tmp." + std::to_string(getpid());
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if(fd == -1) {
+        fprintf(stderr, "[trustlib] Could not create key cache %s\n", cache);
+        return 1;
+    }
+    int failed = write(fd, &header, sizeof(header)) != (ssize_t)sizeof(header) || write(fd, body.data(), body.size()) != (ssize_t)body.size();
+    failed = close(fd) || failed || rename(tmp.c_str(), cache);
+    if(failed) {
+        fprintf(stderr, "[trustlib] Could not write key cache %s\n", cache);
+        unlink(tmp.c_str());
+    }
+    return failed;
+}
+
+// -----------------------------------------------------------------------
+int trustlib_keyring_load(const char* dir) {
+    DIR* d = opendir(dir);
+    if(!d) {
+        return 0;
+    }
+    int added = 0;
+    struct dirent* entry;
+    while((entry = readdir(d))) {
+        size_t len = strlen(entry->d_name), ext = strlen(TRUSTLIB_KEYS_EXT);
+        if(len <= ext || strcmp(entry->d_name + len - ext, TRUSTLIB_KEYS_EXT)) {
+            continue;
+        }
+        std::string path = std::string(dir) + "/" + entry->d_name;
+        std::ifstream params(path);
+        std::stringstream content;
+        content << params.rdbuf();
+        added += !trustlib_keyring_add(content.str().c_str(), path.c_str());
+    }
+    closedir(d);
+    return added;
+}
+
+// -----------------------------------------------------------------------
+const trustlib_key_t* trustlib_keyring_get(const uint8_t* id) {
+    static const uint8_t default_id[TRUSTLIB_FINGERPRINT_SIZE] = { 0 };
+    const trustlib_keyring_t* ring = trustlib_keyring_current();
+    if(!ring || !ring->count) {
+        return NULL;
+    }
+    if(!id || !memcmp(id, default_id, TRUSTLIB_FINGERPRINT_SIZE)) {
+        return &ring->keys[0];
+    }
+    for(size_t slot = trustlib_keyring_slot(id); ring->index[slot]; slot = (slot + 1) & (TRUSTLIB_KEYRING_SLOTS - 1)) {
+        const trustlib_key_t* key = &ring->keys[ring->index[slot] - 1];
+        if(!memcmp(key->id, id, TRUSTLIB_FINGERPRINT_SIZE)) {
+            return key;
+        }
+    }
+    return NULL;
+}
+
+// -----------------------------------------------------------------------
+int trustlib_keyring_size() {
+    const trustlib_keyring_t* ring = trustlib_keyring_current();
+    return ring ? ring->count : 0;
+}
+
+// -----------------------------------------------------------------------
+int trustlib_keyring_publish(trustlib_keyring_t** previous) {
+    *previous = NULL;
+    if(!building || !building->count) {
+        trustlib_keyring_discard();
+        return 1;
+    }
+    *previous = __atomic_exchange_n(&current, building, __ATOMIC_SEQ_CST);
+    building = NULL;
+    return 0;
+}
+
+// -----------------------------------------------------------------------
+void trustlib_keyring_discard() {
+    trustlib_keyring_free(building);
+    building = NULL;
+}
+
+// -----------------------------------------------------------------------
+void trustlib_keyring_free(trustlib_keyring_t* keyring) {
+    if(!keyring) {
+        return;
+    }
+    if(keyring->map) {
+        munmap(keyring->map, keyring->map_size);
+    }
+    free(keyring->key_store);
+    free(keyring->index_store);
+    free(keyring);
+}
+
+// -----------------------------------------------------------------------
+void trustlib_keyring_enter() {
+    if(reader_depth++) {
+        return;
+    }
+    if(reader == -1) {
+        reader = __atomic_fetch_add(&reader_count, 1, __ATOMIC_RELAXED);
+    }
+    // announce the epoch before the keyring is read, the writer waits for readers of older epochs
+    if(reader < TRUSTLIB_KEYRING_READERS) {
+        __atomic_store_n(&readers[reader].epoch, __atomic_load_n(&epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+    } else {
+        __atomic_fetch_add(&shared_readers, 1, __ATOMIC_SEQ_CST);
+    }
+    view = __atomic_load_n(&current, __ATOMIC_SEQ_CST);
+}
+
+// -----------------------------------------------------------------------
+void trustlib_keyring_exit() {
+    if(--reader_depth) {
+        return;
+    }
+    view = NULL;
+    if(reader < TRUSTLIB_KEYRING_READERS) {
+        __atomic_store_n(&readers[reader].epoch, 0, __ATOMIC_RELEASE);
+    } else {
+        __atomic_fetch_sub(&shared_readers, 1, __ATOMIC_RELEASE);
+    }
+}
+
+// -----------------------------------------------------------------------
+void trustlib_keyring_synchronize() {
+    // readers that entered after the new epoch see the published keyring
+    uint64_t now = __atomic_add_fetch(&epoch, 1, __ATOMIC_SEQ_CST);
+    int count = __atomic_load_n(&reader_count, __ATOMIC_SEQ_CST);
+    for(int i = 0; i < count && i < TRUSTLIB_KEYRING_READERS; i++) {
+        uint64_t seen;
+        while((seen = __atomic_load_n(&readers[i].epoch, __ATOMIC_SEQ_CST)) && seen < now) {
+            usleep(TRUSTLIB_KEYRING_GRACE);
+        }
+    }
+    while(__atomic_load_n(&shared_readers, __ATOMIC_SEQ_CST)) {
+        usleep(TRUSTLIB_KEYRING_GRACE);
+    }
+}
+
+// -----------------------------------------------------------------------
+static void trustlib_key_exp(trustlib_prime_exp_t* exp) {
+    trustlib_bn_t c;
+    trustlib_mont_reduce(exp->prime, &c, exp->message);
+    trustlib_mont_exp_consttime(exp->prime, &exp->result, &c, exp->exp, trustlib_bn_bits(&exp->prime->m));
+}
+
+// -----------------------------------------------------------------------
+static void* trustlib_prime_helper(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&pool.lock);
+    while(1) {
+        while(!pool.queue) {
+            pthread_cond_wait(&pool.queued, &pool.lock);
+        }
+        trustlib_prime_exp_t* exp = pool.queue;
+        pool.queue = exp->next;
+        exp->state = 1;
+        pthread_mutex_unlock(&pool.lock);
+        trustlib_key_exp(exp);
+        pthread_mutex_lock(&pool.lock);
+        exp->state = 2;
+        pthread_cond_broadcast(&pool.done);
+    }
+    return NULL;
+}
+
+// -----------------------------------------------------------------------
+static void trustlib_prime_pool_start() {
+    // the helpers live as long as the process, on a single CPU they would only add switches
+    if(sysconf(_SC_NPROCESSORS_ONLN) < 2) return;
+    // signals are handled by the enclave threads
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    for(int i = 0; i < TRUSTLIB_MAX_PRIMES - 1; i++) {
+        pthread_t thread;
+        if(pthread_create(&thread, NULL, trustlib_prime_helper, NULL)) break;
+        pthread_detach(thread);
+        pool.helpers++;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+// -----------------------------------------------------------------------
+void trustlib_key_sign(const trustlib_key_t* key, const trustlib_bn_t* message, trustlib_bn_t* signature) {
+    if(!key->primes) {
+        trustlib_mont_exp_consttime(&key->n, signature, message, &key->d, trustlib_bn_bits(&key->n.m));
+        return;
+    }
+    // m_i = c^d_i mod prime_i, the first one on this thread, the others are queued for the helpers
+    trustlib_prime_exp_t exp[TRUSTLIB_MAX_PRIMES];
+    for(int i = 0; i < key->primes; i++) {
+        exp[i].prime = &key->prime[i];
+        exp[i].exp = &key->dprime[i];
+        exp[i].message = message;
+        exp[i].next = NULL;
+        exp[i].state = 0;
+    }
+    // two primes are not worth the handover
+    int parallel = 0;
+    if(key->primes > 2) {
+        pthread_once(&pool_once, trustlib_prime_pool_start);
+        parallel = pool.helpers > 0;
+    }
+    if(parallel) {
+        pthread_mutex_lock(&pool.lock);
+        for(int i = key->primes - 1; i > 0; i--) {
+            exp[i].next = pool.queue;
+            pool.queue = &exp[i];
+        }
+        pthread_cond_broadcast(&pool.queued);
+        pthread_mutex_unlock(&pool.lock);
+    }
+    trustlib_key_exp(&exp[0]);
+    for(int i = 1; i < key->primes; i++) {
+        if(!parallel) {
+            trustlib_key_exp(&exp[i]);
+            continue;
+        }
+        // take back exponentiations no helper started, e.g., while the helpers serve other signatures
+        pthread_mutex_lock(&pool.lock);
+        int own = !exp[i].state;
+        if(own) {
+            trustlib_prime_exp_t** link = &pool.queue;
+            while(*link != &exp[i]) {
+                link = &(*link)->next;
+            }
+            *link = exp[i].next;
+        }
+        while(!own && exp[i].state != 2) {
+            pthread_cond_wait(&pool.done, &pool.lock);
+        }
+        pthread_mutex_unlock(&pool.lock);
+        if(own) trustlib_key_exp(&exp[i]);
+    }
+    // Garner: s = s + r * ((m_i - s) * coeff_i mod prime_i), with r the product of the previous primes
+    trustlib_bn_t s = exp[0].result, r = key->prime[0].m, h;
+    for(int i = 1; i < key->primes; i++) {
+        const trustlib_mont_t* prime = &key->prime[i];
+        trustlib_mont_reduce(prime, &h, &s);
+        // m_i - h mod prime_i, the prime is added back with a mask if the difference is negative
+        trustlib_bn_t masked = prime->m;
+        uint64_t borrow = trustlib_bn_sub(&h, &exp[i].result, &h);
+        for(int j = 0; j < TRUSTLIB_BN_LIMBS; j++) {
+            masked.limb[j] &= -borrow;
+        }
+        trustlib_bn_add(&h, &h, &masked);
+        trustlib_mont_mulmod(prime, &h, &h, &key->coeff[i]);
+        trustlib_bn_mul(&h, &h, &r);
+        trustlib_bn_add(&s, &s, &h);
+        trustlib_bn_mul(&r, &r, &prime->m);
+    }
+    *signature = s;
+}
+
+// -----------------------------------------------------------------------
+void trustlib_key_verify(const trustlib_key_t* key, const trustlib_bn_t* signature, trustlib_bn_t* message) {
+    trustlib_mont_exp(&key->n, message, signature, &key->e);
+}
@@ -0,0 +1,225 @@
+#ifndef _TRUSTLIB_KEYRING_H_
+#define _TRUSTLIB_KEYRING_H_
+#include <stdint.h>
+#include <stddef.h>
+#include "trustlib.h"
+#include "trustlib_bn.h"
+
+/** Maximum number of keys in the keyring */
+#define TRUSTLIB_MAX_KEYS 256
+/** Maximum number of prime factors of a key (RFC 8017 multi-prime RSA) */
+#define TRUSTLIB_MAX_PRIMES 4
+/** Environment variable with the directory of additional keys, read by the enclave */
+#define TRUSTLIB_KEYS_ENV "TRUSTLIB_KEYS"
+/** Default directory of additional keys */
+#define TRUSTLIB_KEYS_DIR "keys"
+/** File extension of keys in the key directory */
+#define TRUSTLIB_KEYS_EXT ".params"
+/** Binary cache of the keyring, rebuilt if key.params or the key directory is newer */
+#define TRUSTLIB_KEY_CACHE "key.cache"
+/** Magic value at the start of the key cache, "TLKCACHE" */
+#define TRUSTLIB_KEY_CACHE_MAGIC 0x45484341434b4c54ull
+/** Version of the key cache format, changes with the layout of trustlib_key_t */
+#define TRUSTLIB_KEY_CACHE_VERSION 2
+/** Threads that can be in a read-side section with their own epoch, more threads share one counter */
+#define TRUSTLIB_KEYRING_READERS 64
+/** Microseconds between checks for readers of a replaced keyring */
+#define TRUSTLIB_KEYRING_GRACE 100
+
+/**
+ * @defgroup KEYRING Keys of the enclave
+ *
+ * The keyring holds the key from key.params (the default key) and all keys
+ * from the key directory. Key files have the format of key.params, i.e.,
+ * decimal "n e d", optionally followed by the 2 to TRUSTLIB_MAX_PRIMES prime
+ * factors of n for CRT signing. Keys with more than two primes (multi-prime
+ * RSA) sign with one exponentiation per prime, which run in parallel on
+ * helper threads, and combine the results with Garner's algorithm. Every
+ * key has a context with everything derived from the key, so signing and
+ * verifying only selects the context. A key is identified by the
+ * fingerprint of its public key (see trustlib_fingerprint()) and found
+ * through a flat open-addressing hash index.
+ *
+ * A keyring is built with trustlib_keyring_add(), trustlib_keyring_load(),
+ * or trustlib_keyring_map() without being visible, and is read-only once
+ * trustlib_keyring_publish() made it the current keyring. As precomputing
+ * the contexts takes time, the keyring is saved to a cache file in its
+ * in-memory layout. The cache is mapped read-only and used as is, instead
+ * of parsing the key files again.
+ *
+ * Keys are reloaded by building a new keyring next to the current one and
+ * publishing it (read-copy-update). Readers enter a read-side section with
+ * trustlib_keyring_enter() (or a trustlib_keyring_reader), which pins the
+ * keyring they see until they exit. Publishing does not wait for readers,
+ * trustlib_keyring_synchronize() waits until all readers that may still
+ * see the previous keyring have left, then it can be freed. Only one
+ * thread builds and publishes keyrings at a time.
+ *
+ * @{
+ */
+
+/** Precomputed context of a key */
+typedef struct {
+    /** Key id, the fingerprint of the public key */
+    uint8_t id[TRUSTLIB_FINGERPRINT_SIZE];
+    /** Montgomery context of the modulus n */
+    trustlib_mont_t n;
+    /** Public exponent */
+    trustlib_bn_t e;
+    /** Private exponent */
+    trustlib_bn_t d;
+    /** Number of known prime factors of n for CRT signing, 0 if they are not known */
+    int primes;
+    /** Montgomery contexts of the primes */
+    trustlib_mont_t prime[TRUSTLIB_MAX_PRIMES];
+    /** d mod (prime - 1) */
+    trustlib_bn_t dprime[TRUSTLIB_MAX_PRIMES];
+    /** (prime[0] * ... * prime[i - 1])^-1 mod prime[i], the first one is unused */
+    trustlib_bn_t coeff[TRUSTLIB_MAX_PRIMES];
+    /** Hex-encoded public key as stored in trustlib_signed_data_t, empty above TRUSTLIB_LEGACY_BITS bits */
+    trustlib_sign_param_t param;
+} trustlib_key_t;
+
+/** A keyring, opaque outside of the keyring */
+typedef struct trustlib_keyring trustlib_keyring_t;
+
+/**
+ * Add a key to the keyring that is built
+ *
+ * The first key added is the default key.
+ *
+ * @param params Key in the format of key.params
+ * @param source Name of the key for messages, e.g., the file name
+ * @return 0 on success, 1 if the key is invalid, a duplicate, or the keyring is full
+ */
+int trustlib_keyring_add(const char* params, const char* source);
+
+/**
+ * Add all keys of a directory to the keyring that is built
+ *
+ * @param dir Directory containing key files ending with TRUSTLIB_KEYS_EXT
+ * @return Number of keys added, 0 if the directory does not exist
+ */
+int trustlib_keyring_load(const char* dir);
+
+/**
+ * Map the keyring from the key cache
+ *
+ * The cache is only used if it is complete, its checksum is correct, and
+ * neither the key file nor the key directory (or a key in it) is newer.
+ * No keyring may be built yet, the mapped keyring becomes the one that is built.
+ *
+ * @param cache Path of the cache, e.g., TRUSTLIB_KEY_CACHE
+ * @param params Path of the default key, e.g., key.params
+ * @param dir Directory of additional keys
+ * @param text Receives the content of the default key file, as passed to trustlib_keyring_save()
+ * @param len Receives the length of the content
+ * @return 0 if the keyring was mapped, 1 if the cache is missing, outdated, or invalid
+ */
+int trustlib_keyring_map(const char* cache, const char* params, const char* dir, const char** text, size_t* len);
+
+/**
+ * Save the keyring that is built to the key cache
+ *
+ * The cache contains private keys and is only readable by the owner.
+ *
+ * @param cache Path of the cache, e.g., TRUSTLIB_KEY_CACHE
+ * @param text Content of the default key file, stored with the keyring
+ * @param len Length of the content
+ * @return 0 on success, 1 if the cache could not be written
+ */
+int trustlib_keyring_save(const char* cache, const char* text, size_t len);
+
+/**
+ * Find a key by its id
+ *
+ * Returns keys of the keyring seen in the read-side section, or of the
+ * current keyring outside of it. Keys found outside of a read-side section
+ * may be freed by a reload.
+ *
+ * @param id Key id of TRUSTLIB_FINGERPRINT_SIZE bytes, all zero or NULL for the default key
+ * @return The key, NULL if the key is not in the keyring
+ */
+const trustlib_key_t* trustlib_keyring_get(const uint8_t* id);
+
+/**
+ * Number of keys in the keyring
+ */
+int trustlib_keyring_size();
+
+/**
+ * Make the keyring that is built the current keyring
+ *
+ * Readers entering a read-side section afterwards see the new keyring.
+ *
+ * @param previous Receives the replaced keyring, NULL if there was none, free it after trustlib_keyring_synchronize()
+ * @return 0 on success, 1 if the built keyring is empty, it is discarded and the current keyring stays
+ */
+int trustlib_keyring_publish(trustlib_keyring_t** previous);
+
+/**
+ * Discard the keyring that is built, e.g., if its default key is invalid
+ */
+void trustlib_keyring_discard();
+
+/**
+ * Wait until no reader sees a keyring that was replaced before the call
+ */
+void trustlib_keyring_synchronize();
+
+/**
+ * Free a replaced keyring, nothing happens for NULL
+ */
+void trustlib_keyring_free(trustlib_keyring_t* keyring);
+
+/**
+ * Enter a read-side section, sections can be nested
+ *
+ * Keys of the keyring seen in the section stay valid until the section is
+ * left. The section does not block, keys that are reloaded in the meantime
+ * are only seen in the next section.
+ */
+void trustlib_keyring_enter();
+
+/**
+ * Leave a read-side section
+ */
+void trustlib_keyring_exit();
+
+/** Read-side section for the lifetime of the object */
+struct trustlib_keyring_reader {
+    trustlib_keyring_reader() {
+        trustlib_keyring_enter();
+    }
+    ~trustlib_keyring_reader() {
+        trustlib_keyring_exit();
+    }
+    trustlib_keyring_reader(const trustlib_keyring_reader&) = delete;
+    trustlib_keyring_reader& operator=(const trustlib_keyring_reader&) = delete;
+};
+
+/**
+ * Sign with the private key, uses the CRT if the primes are known
+ *
+ * The exponentiations of a key with more than two primes are shared with
+ * helper threads, started on first use if there is more than one CPU.
+ * Exponentiations no helper started are computed by the caller.
+ *
+ * @param key The key
+ * @param message Number to sign, has to be smaller than n
+ * @param signature Receives message^d mod n
+ */
+void trustlib_key_sign(const trustlib_key_t* key, const trustlib_bn_t* message, trustlib_bn_t* signature);
+
+/**
+ * Apply the public key
+ *
+ * @param key The key
+ * @param signature The signature, has to be smaller than n
+ * @param message Receives signature^e mod n
+ */
+void trustlib_key_verify(const trustlib_key_t* key, const trustlib_bn_t* signature, trustlib_bn_t* message);
+
+/** @} */
+
+#endif
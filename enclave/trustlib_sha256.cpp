@@ -0,0 +1,166 @@
+// the enclave is built without optimization (which keeps the code layout of
+// do_sign stable), but documents have to be hashed at memory bandwidth
+#pragma GCC optimize("O2")
+
+#include <string.h>
+#include <cpuid.h>
+#include <immintrin.h>
+#include "trustlib_sha256.h"
+
+/** Compression function, hashes whole blocks into the state */
+typedef void trustlib_sha256_blocks_t(uint32_t* h, const uint8_t* data, size_t blocks);
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+// -----------------------------------------------------------------------
+static inline uint32_t ror(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+// -----------------------------------------------------------------------
+static void trustlib_sha256_portable(uint32_t* h, const uint8_t* data, size_t blocks) {
+    for(; blocks; blocks--, data += TRUSTLIB_SHA256_BLOCK) {
+        uint32_t w[64];
+        for(int i = 0; i < 16; i++) {
+            w[i] = (uint32_t)data[4 * i] << 24 | (uint32_t)data[4 * i + 1] << 16 | (uint32_t)data[4 * i + 2] << 8 | data[4 * i + 3];
+        }
+        for(int i = 16; i < 64; i++) {
+            uint32_t s0 = ror(w[i - 15], 7) ^ ror(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = ror(w[i - 2], 17) ^ ror(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], k = h[7];
+        for(int i = 0; i < 64; i++) {
+            uint32_t t1 = k + (ror(e, 6) ^ ror(e, 11) ^ ror(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+            uint32_t t2 = (ror(a, 2) ^ ror(a, 13) ^ ror(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            k = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+        h[5] += f;
+        h[6] += g;
+        h[7] += k;
+    }
+}
+
+// -----------------------------------------------------------------------
+__attribute__((target("sha,sse4.1")))
+static void trustlib_sha256_shani(uint32_t* h, const uint8_t* data, size_t blocks) {
+    const __m128i swap = _mm_set_epi64x(0x0c0d0e0f08090a0bull, 0x0405060700010203ull);
+    // the instructions work on the state as ABEF and CDGH
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&h[0]), 0xb1);
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&h[4]), 0x1b);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+    for(; blocks; blocks--, data += TRUSTLIB_SHA256_BLOCK) {
+        __m128i abef = state0, cdgh = state1;
+        __m128i msg[4];
+        for(int i = 0; i < 4; i++) {
+            msg[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16 * i)), swap);
+        }
+        // 4 rounds per iteration, the schedule computes the message words 16 rounds ahead
+        for(int i = 0; i < 16; i++) {
+            __m128i wk = _mm_add_epi32(msg[i & 3], _mm_loadu_si128((const __m128i*)&K[4 * i]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, wk);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(wk, 0x0e));
+            if(i < 12) {
+                __m128i w = _mm_sha256msg1_epu32(msg[i & 3], msg[(i + 1) & 3]);
+                w = _mm_add_epi32(w, _mm_alignr_epi8(msg[(i + 3) & 3], msg[(i + 2) & 3], 4));
+                msg[i & 3] = _mm_sha256msg2_epu32(w, msg[(i + 3) & 3]);
+            }
+        }
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1b);
+    state1 = _mm_shuffle_epi32(state1, 0xb1);
+    _mm_storeu_si128((__m128i*)&h[0], _mm_blend_epi16(tmp, state1, 0xf0));
+    _mm_storeu_si128((__m128i*)&h[4], _mm_alignr_epi8(state1, tmp, 8));
+}
+
+// -----------------------------------------------------------------------
+static trustlib_sha256_blocks_t* trustlib_sha256_select() {
+    unsigned int eax, ebx, ecx, edx;
+    if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSE4_1) || !(ecx & bit_SSSE3)) {
+        return trustlib_sha256_portable;
+    }
+    if(!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) || !(ebx & bit_SHA)) {
+        return trustlib_sha256_portable;
+    }
+    return trustlib_sha256_shani;
+}
+
+/** Compression function of this CPU, selected once */
+static trustlib_sha256_blocks_t* const trustlib_sha256_blocks = trustlib_sha256_select();
+
+// -----------------------------------------------------------------------
+void trustlib_sha256_init(trustlib_sha256_t* ctx) {
+    static const uint32_t iv[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+    memcpy(ctx->h, iv, sizeof(iv));
+    ctx->len = 0;
+}
+
+// -----------------------------------------------------------------------
+void trustlib_sha256_update(trustlib_sha256_t* ctx, const void* data, size_t len) {
+    const uint8_t* in = (const uint8_t*)data;
+    size_t used = ctx->len % TRUSTLIB_SHA256_BLOCK;
+    ctx->len += len;
+    if(used) {
+        size_t fill = TRUSTLIB_SHA256_BLOCK - used;
+        if(len < fill) {
+            memcpy(ctx->block + used, in, len);
+            return;
+        }
+        memcpy(ctx->block + used, in, fill);
+        trustlib_sha256_blocks(ctx->h, ctx->block, 1);
+        in += fill;
+        len -= fill;
+    }
+    // whole blocks directly from the input
+    trustlib_sha256_blocks(ctx->h, in, len / TRUSTLIB_SHA256_BLOCK);
+    memcpy(ctx->block, in + len - len % TRUSTLIB_SHA256_BLOCK, len % TRUSTLIB_SHA256_BLOCK);
+}
+
+// -----------------------------------------------------------------------
+void trustlib_sha256_final(trustlib_sha256_t* ctx, uint8_t* digest) {
+    uint64_t bits = ctx->len * 8;
+    uint8_t pad[TRUSTLIB_SHA256_BLOCK + 8] = { 0x80 };
+    size_t used = ctx->len % TRUSTLIB_SHA256_BLOCK;
+    size_t padding = (used < 56 ? 56 : 120) - used;
+    for(int i = 0; i < 8; i++) {
+        pad[padding + i] = bits >> (56 - 8 * i);
+    }
+    trustlib_sha256_update(ctx, pad, padding + 8);
+    for(int i = 0; i < 8; i++) {
+        digest[4 * i] = ctx->h[i] >> 24;
+        digest[4 * i + 1] = ctx->h[i] >> 16;
+        digest[4 * i + 2] = ctx->h[i] >> 8;
+        digest[4 * i + 3] = ctx->h[i];
+    }
+}
+
+// -----------------------------------------------------------------------
+const char* trustlib_sha256_impl() {
+    return trustlib_sha256_blocks == trustlib_sha256_shani ? "sha-ni" : "portable";
+}
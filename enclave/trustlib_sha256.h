@@ -0,0 +1,61 @@
+#ifndef _TRUSTLIB_SHA256_H_
+#define _TRUSTLIB_SHA256_H_
+#include <stdint.h>
+#include <stddef.h>
+
+/** Size of a SHA-256 digest in bytes */
+#define TRUSTLIB_SHA256_SIZE 32
+/** Size of a SHA-256 block in bytes */
+#define TRUSTLIB_SHA256_BLOCK 64
+
+/**
+ * @defgroup SHA256 Streaming SHA-256
+ *
+ * Hashes data of arbitrary length that arrives in pieces. Whole blocks are
+ * hashed directly from the input, only a partial block at the end of a
+ * piece is buffered. The compression function uses the SHA extensions
+ * (SHA-NI) if the CPU supports them, a portable implementation otherwise.
+ *
+ * @{
+ */
+
+/** State of a SHA-256 computation */
+typedef struct {
+    /** Intermediate hash value */
+    uint32_t h[8];
+    /** Buffered partial block */
+    uint8_t block[TRUSTLIB_SHA256_BLOCK];
+    /** Number of bytes hashed so far */
+    uint64_t len;
+} trustlib_sha256_t;
+
+/** Start a new computation */
+void trustlib_sha256_init(trustlib_sha256_t* ctx);
+
+/**
+ * Hash the next piece of the data
+ *
+ * @param ctx The computation
+ * @param data The piece
+ * @param len Length of the piece
+ */
+void trustlib_sha256_update(trustlib_sha256_t* ctx, const void* data, size_t len);
+
+/**
+ * Finish the computation
+ *
+ * @param ctx The computation, has to be initialized again for further use
+ * @param digest Receives TRUSTLIB_SHA256_SIZE bytes
+ */
+void trustlib_sha256_final(trustlib_sha256_t* ctx, uint8_t* digest);
+
+/**
+ * Name of the compression function in use
+ *
+ * @return "sha-ni" or "portable"
+ */
+const char* trustlib_sha256_impl();
+
+/** @} */
+
+#endif
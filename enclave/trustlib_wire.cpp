@@ -0,0 +1,6 @@
+#include "trustlib_wire.h"
+
+// -----------------------------------------------------------------------
+int trustlib_wire_validate(const trustlib_wire_t* data, size_t len) {
+    return trustlib_wire_check(data, len);
+}
@@ -0,0 +1,168 @@
+#ifndef _TRUSTLIB_WIRE_H_
+#define _TRUSTLIB_WIRE_H_
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "trustlib.h"
+
+/**
+ * @defgroup WIRE Conversion between trustlib_signed_data_t and the binary format
+ *
+ * @{
+ */
+
+/**
+ * Size of a message in the binary format
+ *
+ * @param data Message in the binary format
+ * @return Number of bytes used by the message
+ */
+static inline size_t trustlib_wire_size(const trustlib_wire_t* data) {
+    return offsetof(trustlib_wire_t, payload) + data->signature_len + data->message_len;
+}
+
+/**
+ * Check a message in the binary format
+ *
+ * @param data Message in the binary format
+ * @param len Number of valid bytes of the message, e.g., read from a file
+ * @return 0 if the header is valid and the message is complete, 1 otherwise
+ */
+static inline int trustlib_wire_check(const trustlib_wire_t* data, size_t len) {
+    if(len < offsetof(trustlib_wire_t, payload) || data->magic != TRUSTLIB_WIRE_MAGIC || data->version != TRUSTLIB_WIRE_VERSION) {
+        return 1;
+    }
+    if(data->message_len > TRUSTLIB_MESSAGE_SIZE || data->signature_len > TRUSTLIB_SIGNATURE_SIZE) {
+        return 1;
+    }
+    return len < trustlib_wire_size(data);
+}
+
+/**
+ * Check a message in the binary format, the same as trustlib_wire_check()
+ *
+ * Defined in trustlib_wire.cpp for the enclave. The inline helpers would
+ * be placed ahead of do_sign in enclave.cpp and move it away from the
+ * address used by the attack (see framework.cpp).
+ *
+ * @param data Message in the binary format
+ * @param len Number of valid bytes of the message
+ * @return 0 if the header is valid and the message is complete, 1 otherwise
+ */
+int trustlib_wire_validate(const trustlib_wire_t* data, size_t len);
+
+/**
+ * Initialize an unsigned message in the binary format
+ *
+ * @param data Message in the binary format
+ * @param issuer Issuer of the message
+ * @param message The message, truncated to TRUSTLIB_MESSAGE_SIZE bytes
+ */
+static inline void trustlib_wire_init(trustlib_wire_t* data, trustlib_issuer_t issuer, const char* message) {
+    memset(data, 0, sizeof(trustlib_wire_t));
+    data->magic = TRUSTLIB_WIRE_MAGIC;
+    data->version = TRUSTLIB_WIRE_VERSION;
+    data->issuer = issuer;
+    data->message_len = strnlen(message, TRUSTLIB_MESSAGE_SIZE);
+    memcpy(data->payload, message, data->message_len);
+}
+
+/**
+ * Fingerprint of a public key given as hex strings
+ *
+ * 64-bit FNV-1a hash over the hex-encoded n and e, stored little endian.
+ * Also for keys that are too large for trustlib_sign_param_t.
+ *
+ * @param n Hex-encoded n, ends with a zero byte or after n_size digits
+ * @param n_size Maximum number of digits of n
+ * @param e Hex-encoded e, ends with a zero byte or after e_size digits
+ * @param e_size Maximum number of digits of e
+ * @param fingerprint Receives TRUSTLIB_FINGERPRINT_SIZE bytes
+ */
+static inline void trustlib_fingerprint_hex(const char* n, size_t n_size, const char* e, size_t e_size, uint8_t* fingerprint) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for(size_t i = 0; i < n_size && n[i]; i++) {
+        hash = (hash ^ (uint8_t)n[i]) * 0x100000001b3ull;
+    }
+    // separates n and e
+    hash *= 0x100000001b3ull;
+    for(size_t i = 0; i < e_size && e[i]; i++) {
+        hash = (hash ^ (uint8_t)e[i]) * 0x100000001b3ull;
+    }
+    for(int i = 0; i < TRUSTLIB_FINGERPRINT_SIZE; i++) {
+        fingerprint[i] = hash >> (8 * i);
+    }
+}
+
+/**
+ * Fingerprint of a public key
+ *
+ * @param key Public key as stored in trustlib_signed_data_t
+ * @param fingerprint Receives TRUSTLIB_FINGERPRINT_SIZE bytes
+ */
+static inline void trustlib_fingerprint(const trustlib_sign_param_t* key, uint8_t* fingerprint) {
+    trustlib_fingerprint_hex(key->n, sizeof(key->n), key->e, sizeof(key->e), fingerprint);
+}
+
+/**
+ * Convert a signed message to the binary format
+ *
+ * @param in Signed message with hex-encoded key and signature
+ * @param out Receives the message in the binary format
+ * @return 0 on success, 1 if the signature is not a valid hex number or too large
+ */
+static inline int trustlib_to_wire(const trustlib_signed_data_t* in, trustlib_wire_t* out) {
+    trustlib_wire_init(out, in->data.issuer, in->data.message);
+    trustlib_fingerprint(&(in->param), out->fingerprint);
+    // the signature is parsed from its least-significant digit
+    size_t digits = strnlen(in->signature, sizeof(in->signature));
+    uint8_t signature[TRUSTLIB_SIGNATURE_SIZE] = { 0 };
+    int len = 0;
+    for(size_t i = 0; i < digits; i++) {
+        char c = in->signature[digits - 1 - i];
+        int v = (c >= '0' && c <= '9') ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+        if(v < 0 || i / 2 >= TRUSTLIB_SIGNATURE_SIZE) return 1;
+        signature[i / 2] |= v << (4 * (i % 2));
+        if(v) len = i / 2 + 1;
+    }
+    out->signature_len = len;
+    memmove(out->payload + len, out->payload, out->message_len);
+    memcpy(out->payload, signature, len);
+    return 0;
+}
+
+/**
+ * Convert a message in the binary format to a signed message
+ *
+ * The binary format only carries the fingerprint of the key, so the key
+ * has to be provided to fill in the public key of the signed message.
+ *
+ * @param in Message in the binary format, checked with trustlib_wire_check()
+ * @param key Public key of the signature, NULL to leave the key empty
+ * @param out Receives the signed message with hex-encoded key and signature
+ * @return 0 on success, 1 if the signature is too large for the signed message (only the message is converted)
+ */
+static inline int trustlib_from_wire(const trustlib_wire_t* in, const trustlib_sign_param_t* key, trustlib_signed_data_t* out) {
+    static const char hex[] = "0123456789abcdef";
+    memset(out, 0, sizeof(trustlib_signed_data_t));
+    out->data.issuer = (trustlib_issuer_t)in->issuer;
+    memcpy(out->data.message, in->payload + in->signature_len, in->message_len);
+    if(key) {
+        out->param = *key;
+    }
+    // signatures of keys above TRUSTLIB_LEGACY_BITS bits are left empty
+    if(2 * in->signature_len >= sizeof(out->signature)) {
+        return 1;
+    }
+    // most-significant digit first, without leading zeros
+    int pos = 0;
+    for(int i = 2 * in->signature_len - 1; i >= 0; i--) {
+        int v = (in->payload[i / 2] >> (4 * (i % 2))) & 0xf;
+        if(v || pos) out->signature[pos++] = hex[v];
+    }
+    return 0;
+}
+
+/** @} */
+
+#endif
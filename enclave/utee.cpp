@@ -10,323 +10,2301 @@
 #include <ucontext.h>
 #include <sys/prctl.h>
 #include <assert.h>
-#include <dirent.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <limits.h>
+#include <stddef.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 #include "utee.h"
+#include "utee_stats.h"
+#include "utee_trace.h"
+#include "utee_arena.h"
 
+/** Maximum number of threads started by UTEE in one process */
+#define UTEE_MAX_THREADS 256
+/** Memory policy preferring a NUMA node, see set_mempolicy(2) */
+#define UTEE_MPOL_PREFERRED 1
+
+/** Magic value of an initialized arena */
+#define UTEE_ARENA_MAGIC 0x7574656561726e31ull
+/** Maximum number of slabs, the slab table has to fit into the first slab */
+#define UTEE_ARENA_MAX_SLABS 16384
+/** Number of bits of an offset in the head of a free list, the rest is a tag against ABA */
+#define UTEE_ARENA_OFFSET_BITS 40
+#define UTEE_ARENA_OFFSET_MASK ((1ull << UTEE_ARENA_OFFSET_BITS) - 1)
+
+/** Magic value of an initialized broker */
+#define UTEE_BROKER_MAGIC 0x7574656562726b33ull
+/** Magic value of a broker that is being initialized */
+#define UTEE_BROKER_INIT 0x7574656562726b00ull
+
+/** Entry of one enclave instance in the broker */
+typedef struct {
+    /** PID of the process owning the instance id, 0 if the instance id is free */
+    volatile pid_t owner;
+    /** PID of the enclave, 0 as long as the enclave does not accept clients */
+    volatile pid_t enclave;
+    /** 1 if the enclave runs as daemon */
+    volatile int daemon;
+    /** PID of the client owning the channel set, 0 if the channel set is free */
+    volatile pid_t client[UTEE_MAX_CLIENTS];
+    /** 1 if the client owning the channel set has a signal handler */
+    volatile int signals[UTEE_MAX_CLIENTS];
+    /** PID of the enclave taking over the instance in a hot restart, 0 if there is none */
+    volatile pid_t successor;
+    /** Posted by the successor to request the instance */
+    sem_t takeover;
+    /** Posted by the enclave once it drained and the successor owns the instance */
+    sem_t handover;
+} utee_instance_t;
+
+/** Broker handing out the channel namespaces of all instances of an enclave */
+typedef struct {
+    /** UTEE_BROKER_MAGIC once the broker is initialized */
+    volatile uint64_t magic;
+    /** PID of the fork server of the enclave, 0 if there is none */
+    volatile pid_t zygote;
+    /** Requests to the fork server to start a new instance */
+    sem_t spawn;
+    /** Instances of the enclave, indexed by instance id */
+    utee_instance_t instance[UTEE_MAX_INSTANCES];
+} utee_broker_t;
+
+/** Magic value of an initialized channel segment */
+#define UTEE_CHANNEL_MAGIC 0x757465656368616eull
+/** Version of the channel layout */
+#define UTEE_CHANNEL_VERSION 6
+
+/** Magic value of an initialized scheduler segment */
+#define UTEE_SCHED_MAGIC 0x7574656573636864ull
+/** Number of entries of a lane, enough for all slots of all clients plus stale entries of dead clients */
+#define UTEE_LANE_CAPACITY (2 * UTEE_MAX_CLIENTS * UTEE_ECALL_SLOTS)
+
+/** States of a slot in an ECALL/OCALL ring */
+enum {
+    /** The slot can be claimed by a call */
+    UTEE_SLOT_FREE,
+    /** The slot is claimed, the caller writes the request */
+    UTEE_SLOT_CLAIMED,
+    /** The request is complete and waits for a handler */
+    UTEE_SLOT_PENDING,
+    /** A handler executes the request */
+    UTEE_SLOT_RUNNING,
+    /** The result is available */
+    UTEE_SLOT_DONE,
+    /** The caller gave up waiting, the handler still runs and the result is dropped */
+    UTEE_SLOT_CANCELLED,
+    /** Cancelled and released by the caller, the handler frees the slot when it returns */
+    UTEE_SLOT_ABANDONED
+};
+
+/** Flags of a call */
+enum {
+    /** Nobody waits for the result, the handler releases the slot */
+    UTEE_CALL_ASYNC = 1,
+    /** Part of a batch, completion is signaled once for the whole batch */
+    UTEE_CALL_BATCH = 2
+};
+
+/** Header of a channel segment */
+typedef struct {
+    /** UTEE_CHANNEL_MAGIC once the channel is initialized */
+    uint64_t magic;
+    /** UTEE_CHANNEL_VERSION of the enclave that created the channel */
+    uint32_t version;
+    /** Size of one slot in bytes */
+    uint32_t slot_size;
+    /** Number of slots in the ECALL ring */
+    uint32_t ecall_slots;
+    /** Number of slots in the OCALL ring */
+    uint32_t ocall_slots;
+} __attribute__((aligned(UTEE_CACHE_LINE))) utee_channel_hdr_t;
+
+/** Ring of ECALL/OCALL slots, shared by all threads of the calling side */
+typedef struct {
+    /** Doorbell of the OCALL handlers, posted once per pending OCALL (ECALLs are queued in the lanes) */
+    sem_t pending __attribute__((aligned(UTEE_CACHE_LINE)));
+    /** Number of free slots */
+    sem_t free __attribute__((aligned(UTEE_CACHE_LINE)));
+} utee_ring_t;
+
+/**
+ * Slot of a channel (layout v2)
+ *
+ * Fields written by the caller and fields written by the callee are on
+ * separate cache lines, so the side waiting for a call or its result does
+ * not false-share with the side writing the request or the data.
+ */
+typedef struct {
+    /** Doorbell, posted by the caller */
+    sem_t calls __attribute__((aligned(UTEE_CACHE_LINE)));
+    /** State of the slot in a ring */
+    volatile uint32_t state __attribute__((aligned(UTEE_CACHE_LINE)));
+    /** Flags of the call, written by the caller */
+    uint32_t flags;
+    /** Slot of the batch leader, which is signaled when the batch is complete */
+    uint32_t batch;
+    /** Calls of the batch not yet completed, only used in the batch leader */
+    volatile uint32_t batch_left;
+    /** ECALL/OCALL ID to call, written by the caller */
+    uint64_t call __attribute__((aligned(UTEE_CACHE_LINE)));
+    /** Parameters, written by the caller */
+    uint64_t param[6];
+    /** Length of the data, written by the caller */
+    uint64_t len;
+    /** Time the call was submitted, written by the caller */
+    uint64_t submitted __attribute__((aligned(UTEE_CACHE_LINE)));
+    /** Time after which the caller does not wait for the result anymore, 0 for no deadline */
+    uint64_t deadline;
+    /** Completion, posted by the callee */
+    sem_t results __attribute__((aligned(UTEE_CACHE_LINE)));
+    /** Return value, written by the callee */
+    uint64_t result __attribute__((aligned(UTEE_CACHE_LINE)));
+    /** Additional data of the call */
+    char data[UTEE_MAX_DATA_SIZE] __attribute__((aligned(UTEE_CACHE_LINE)));
+} utee_slot_t;
+
+/** Channel set of one client: signal slot, ECALL ring, and OCALL ring */
+typedef struct {
+    utee_channel_hdr_t* hdr;
+    utee_slot_t* signal;
+    utee_ring_t* ecall_ring;
+    utee_slot_t* ecall;
+    utee_ring_t* ocall_ring;
+    utee_slot_t* ocall;
+    size_t size;
+} utee_channel_t;
+
+/** Entry of a lane, references a pending ECALL slot of a client */
+typedef struct {
+    /** Sequence number of the entry, synchronizes producers and consumers */
+    volatile uint64_t seq;
+    /** Channel set of the ECALL */
+    uint32_t client;
+    /** Slot of the ECALL in the ECALL ring */
+    uint32_t slot;
+} utee_lane_entry_t;
+
+/** Bounded multi-producer queue of pending ECALLs of one priority */
+typedef struct {
+    /** Position of the next enqueue, advanced by the clients */
+    volatile uint64_t head __attribute__((aligned(UTEE_CACHE_LINE)));
+    /** Position of the next dequeue, advanced by the enclave */
+    volatile uint64_t tail __attribute__((aligned(UTEE_CACHE_LINE)));
+    utee_lane_entry_t entry[UTEE_LANE_CAPACITY] __attribute__((aligned(UTEE_CACHE_LINE)));
+} utee_lane_t;
+
+/** Scheduler segment of an instance, shared by the enclave and all its clients */
+typedef struct {
+    /** UTEE_SCHED_MAGIC once the scheduler is initialized */
+    volatile uint64_t magic;
+    /** Doorbell of the enclave threads, posted once per queued ECALL */
+    sem_t doorbell __attribute__((aligned(UTEE_CACHE_LINE)));
+    /** Default lane of every ECALL, written by the enclave */
+    volatile uint8_t ecall_lane[UTEE_MAX_ECALLS] __attribute__((aligned(UTEE_CACHE_LINE)));
+    /** Queues of pending ECALLs, lane 0 has the highest priority */
+    utee_lane_t lane[UTEE_LANES];
+} utee_sched_t;
+
+/** Head of the free list of one object class */
+typedef struct {
+    /** Tag (upper bits) and offset (lower bits) of the first free object, offset 0 if empty */
+    volatile uint64_t head;
+} __attribute__((aligned(UTEE_CACHE_LINE))) utee_arena_list_t;
+
+/** Header of the shared arena of an enclave instance, located in slab 0 */
+typedef struct {
+    volatile uint64_t magic;
+    /** Size of the arena in bytes */
+    uint64_t size;
+    /** Number of slabs, including the header slab */
+    uint64_t slabs;
+    /** Next slab that was never used */
+    volatile uint64_t next_slab __attribute__((aligned(UTEE_CACHE_LINE)));
+    /** Free objects of each class, linked by their first 8 bytes */
+    utee_arena_list_t free[UTEE_ARENA_CLASSES];
+    /** Object class + 1 of every slab, 0 if the slab is unused */
+    volatile uint8_t slab_class[UTEE_ARENA_MAX_SLABS];
+} utee_arena_t;
+
+static_assert(sizeof(utee_arena_t) <= UTEE_ARENA_SLAB, "Arena header does not fit into a slab");
+static_assert((UTEE_ARENA_MIN_OBJECT << (UTEE_ARENA_CLASSES - 1)) == UTEE_ARENA_SLAB, "Largest arena class must be a slab");
 
 static utee_call_t ecall[UTEE_MAX_ECALLS], ocall[UTEE_MAX_OCALLS];
 static unsigned int utee_ecalls = 1, utee_ocalls = 1;
 
-static utee_msg_t* msg_ecall;
-static utee_msg_t* msg_ocall;
-static utee_msg_t* msg_signal;
+static utee_broker_t* broker;
+static utee_instance_t* instance;
+static utee_stats_t* stats;
+static utee_sched_t* sched;
+static utee_arena_t* arena;
+/** Size of the mapped arena, kept privately as every client can write the arena header */
+static uint64_t arena_size;
+static int instance_id = -1;
+static utee_channel_t channel[UTEE_MAX_CLIENTS];
+
+/** Channel set of this application (client side) */
+static utee_channel_t* self;
+static int client_id = -1;
+/** Channel set served by the current enclave thread (enclave side) */
+static __thread utee_channel_t* worker;
+/** Slot of the ECALL executed by the current enclave thread (enclave side) */
+static __thread utee_slot_t* worker_slot;
+/** Timeout of the ECALLs of this thread in ms, 0 for none, -1 for the default of the application */
+static __thread int ecall_timeout = -1;
+static int ecall_default_timeout;
+/** Signals that are raised synchronously by the code of an ECALL */
+static const int sync_signals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGTRAP, SIGABRT };
+/** Signals that stop the enclave */
+static const int term_signals[] = { SIGHUP, SIGINT, SIGQUIT, SIGTERM };
 
 static char enclave_name[UTEE_MAX_ENCLAVE_NAME];
-static char sandbox_ecall_key[UTEE_MAX_ENCLAVE_NAME + 8], 
-            sandbox_ocall_key[UTEE_MAX_ENCLAVE_NAME + 8], 
-            sandbox_signal_key[UTEE_MAX_ENCLAVE_NAME + 8];
 
 static int has_signal_handler;
+static int daemon_mode;
+static sem_t enclave_stop;
+static volatile sig_atomic_t zygote_stop;
 
 static pid_t utee_enclave_pid;
 
+/** Hot restart: state handed over between enclaves, and whether this enclave takes over or handed over */
+static utee_handoff_save_t handoff_save;
+static utee_handoff_restore_t handoff_restore;
+static utee_idle_t idle_work;
+static int restarting;
+static volatile int handed_over;
+/** Set once the instance is handed over, no further ECALLs are dispatched (protected by dispatch_lock) */
+static int draining;
+
+/** Scheduling of the lanes (enclave side), protected by dispatch_lock */
+static pthread_mutex_t dispatch_lock = PTHREAD_MUTEX_INITIALIZER;
+static int lane_policy = UTEE_SCHED_STRICT;
+static int lane_weight[UTEE_LANES] = { 4, 2, 1 };
+static int lane_max_running[UTEE_LANES];
+/** ECALLs running per lane, changed atomically as workers decrement it without the lock */
+static int lane_running[UTEE_LANES];
+static int lane_credit[UTEE_LANES];
+
+/** Placement of the threads started by UTEE, protected by affinity_lock */
+static pthread_mutex_t affinity_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t affinity_defaults = PTHREAD_ONCE_INIT;
+/** CPUs of the enclave threads and of the client helper threads, empty if not pinned */
+static cpu_set_t enclave_cpus, client_cpus;
+static pthread_t utee_thread[UTEE_MAX_THREADS];
+static int utee_thread_enclave[UTEE_MAX_THREADS];
+static int utee_threads;
+static pthread_t enclave_main;
+static int has_enclave_main;
+/** NUMA node of the shared memory created by the enclave, -1 for the default policy */
+static int numa_node = -1;
+
 // ---------------------------------------------------------------------------
-static pid_t utee_proc_find(const char* name) {
-    DIR* dir;
-    struct dirent* ent;
-    char buf[512];
+static void utee_broker_key(char* key, size_t len, const char* name) {
+    snprintf(key, len, "%s_broker", name);
+}
 
-    long  pid;
-    char pname[100] = {0,};
-    char state;
-    FILE *fp=NULL; 
+// ---------------------------------------------------------------------------
+static void utee_channel_key(char* key, size_t len, const char* name, int inst, int id) {
+    snprintf(key, len, "%s.%d.%d", name, inst, id);
+}
 
-    if(!(dir = opendir("/proc"))) {
-        fprintf(stderr, "[utee] Can't open /proc");
-        return -1;
-    }
+// ---------------------------------------------------------------------------
+static void utee_stats_key(char* key, size_t len, const char* name, int inst) {
+    snprintf(key, len, "%s.%d_stats", name, inst);
+}
 
-    while((ent = readdir(dir)) != NULL) {
-        long lpid = atol(ent->d_name);
-        if(lpid < 0) {
-            continue;
-        }
-        snprintf(buf, sizeof(buf), "/proc/%ld/stat", lpid);
-        fp = fopen(buf, "r");
+// ---------------------------------------------------------------------------
+static void utee_sched_key(char* key, size_t len, const char* name, int inst) {
+    snprintf(key, len, "%s.%d_sched", name, inst);
+}
 
-        if(fp) {
-            if((fscanf(fp, "%ld (%[^)]) %c", &pid, pname, &state)) != 3) {
-                printf("fscanf failed \n");
-                fclose(fp);
-                closedir(dir);
-                return -1; 
-            }
-            if(!strcmp(pname, name)) {
-                fclose(fp);
-                closedir(dir);
-                return (pid_t)lpid;
-            }
-            fclose(fp);
+// ---------------------------------------------------------------------------
+static void utee_arena_key(char* key, size_t len, const char* name, int inst) {
+    snprintf(key, len, "%s.%d_arena", name, inst);
+}
+
+// ---------------------------------------------------------------------------
+static int utee_cpu_list(const char* list, cpu_set_t* set) {
+    // list of CPUs and CPU ranges, e.g., "0-3,8"
+    CPU_ZERO(set);
+    while(*list) {
+        char* end;
+        long first = strtol(list, &end, 10), last = first;
+        if(end == list || first < 0) return 1;
+        if(*end == '-') {
+            list = end + 1;
+            last = strtol(list, &end, 10);
+            if(end == list || last < first) return 1;
+        }
+        for(long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, set);
         }
+        if(*end && *end != ',') return 1;
+        list = *end ? end + 1 : end;
     }
+    return CPU_COUNT(set) == 0;
+}
 
-    closedir(dir);
+// ---------------------------------------------------------------------------
+static int utee_cpu_nth(const cpu_set_t* set, int n) {
+    n %= CPU_COUNT(set);
+    for(int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if(CPU_ISSET(cpu, set) && n-- == 0) return cpu;
+    }
     return -1;
 }
 
 // ---------------------------------------------------------------------------
-int utee_enclave_init(const char* name) {
-    assert(name && "Enclave name must be provided");
-    strncpy(enclave_name, name, sizeof(enclave_name) - 1);
-    snprintf(sandbox_ecall_key, sizeof(sandbox_ecall_key) - 1, "%s_ecall", name);
-    snprintf(sandbox_ocall_key, sizeof(sandbox_ocall_key) - 1, "%s_ocall", name);
-    snprintf(sandbox_signal_key, sizeof(sandbox_signal_key) - 1, "%s_signal", name);
-
-    int s_e = shm_open(sandbox_ecall_key, O_CREAT | O_RDWR, 0644);
-    int s_o = shm_open(sandbox_ocall_key, O_CREAT | O_RDWR, 0644);
-    int s_f = shm_open(sandbox_signal_key, O_CREAT | O_RDWR, 0644);
-    
-    if(s_e == -1 || s_o == -1 || s_f == -1) {
-        fprintf(stderr, "[utee] Could not init enclave: failed to open shared memory\n");
-        return 1;
+static int utee_cpu_node(int cpu) {
+    char path[64];
+    for(int node = 0; node < 64; node++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/node%d", cpu, node);
+        if(!access(path, F_OK)) return node;
     }
-    ftruncate(s_e, UTEE_MAX_MESSAGE_SIZE);
-    ftruncate(s_o, UTEE_MAX_MESSAGE_SIZE);
-    ftruncate(s_f, UTEE_MAX_MESSAGE_SIZE);
-    msg_ecall = (utee_msg_t*)mmap(NULL, UTEE_MAX_MESSAGE_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, s_e, 0);
-    msg_ocall = (utee_msg_t*)mmap(NULL, UTEE_MAX_MESSAGE_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, s_o, 0);
-    msg_signal = (utee_msg_t*)mmap(NULL, UTEE_MAX_MESSAGE_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, s_f, 0);
+    return -1;
+}
 
-    if(!msg_ecall || !msg_ocall || !msg_signal) {
-        fprintf(stderr, "[utee] Could not init enclave: failed to map shared memory\n");
-        return 1;
+// ---------------------------------------------------------------------------
+static void utee_pin(pthread_t thread, int index, int enclave, int spread) {
+    // called with affinity_lock held
+    const cpu_set_t* cpus = enclave ? &enclave_cpus : &client_cpus;
+    cpu_set_t set;
+    if(!CPU_COUNT(cpus)) {
+        // not pinned (anymore), allow all CPUs
+        CPU_ZERO(&set);
+        for(long cpu = 0; cpu < sysconf(_SC_NPROCESSORS_CONF) && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, &set);
+        }
+    } else if(spread) {
+        // every enclave worker gets a CPU of its own, as long as there are enough CPUs
+        CPU_ZERO(&set);
+        CPU_SET(utee_cpu_nth(cpus, index), &set);
+    } else {
+        set = *cpus;
     }
+    pthread_setaffinity_np(thread, sizeof(set), &set);
+}
 
-    msg_ecall->call = -1;
-    msg_ocall->call = -1;
-    msg_signal->call = -1;
+// ---------------------------------------------------------------------------
+static int utee_affinity_apply(const char* cpus, int enclave) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(cpus && *cpus && utee_cpu_list(cpus, &set)) {
+        fprintf(stderr, "[utee] Invalid CPU list '%s'\n", cpus);
+        return 1;
+    }
+    pthread_mutex_lock(&affinity_lock);
+    if(enclave) {
+        enclave_cpus = set;
+    } else {
+        client_cpus = set;
+    }
+    // move the threads that are already running
+    int index = 0;
+    for(int i = 0; i < utee_threads; i++) {
+        if(utee_thread_enclave[i] == enclave) {
+            utee_pin(utee_thread[i], index++, enclave, enclave);
+        }
+    }
+    if(enclave && has_enclave_main) {
+        utee_pin(enclave_main, 0, 1, 0);
+    }
+    pthread_mutex_unlock(&affinity_lock);
+    return 0;
+}
 
-    sem_init(&(msg_ecall->calls), 1, 0);
-    sem_init(&(msg_ecall->results), 1, 0);
-    sem_init(&(msg_ocall->calls), 1, 0);
-    sem_init(&(msg_ocall->results), 1, 0);
-    sem_init(&(msg_signal->calls), 1, 0);
-    sem_init(&(msg_signal->results), 1, 0);
+// ---------------------------------------------------------------------------
+static void utee_affinity_env() {
+    const char* cpus = getenv(UTEE_ENCLAVE_CPUS_ENV);
+    if(cpus && !CPU_COUNT(&enclave_cpus)) utee_affinity_apply(cpus, 1);
+    cpus = getenv(UTEE_CLIENT_CPUS_ENV);
+    if(cpus && !CPU_COUNT(&client_cpus)) utee_affinity_apply(cpus, 0);
+}
 
+// ---------------------------------------------------------------------------
+static int utee_thread_start(void* (*fn)(void*), void* arg, int enclave) {
+    pthread_once(&affinity_defaults, utee_affinity_env);
+    pthread_t p;
+    if(pthread_create(&p, NULL, fn, arg)) {
+        return 1;
+    }
+    pthread_detach(p);
+    pthread_mutex_lock(&affinity_lock);
+    if(utee_threads < UTEE_MAX_THREADS) {
+        int index = 0;
+        for(int i = 0; i < utee_threads; i++) {
+            if(utee_thread_enclave[i] == enclave) index++;
+        }
+        utee_thread[utee_threads] = p;
+        utee_thread_enclave[utee_threads++] = enclave;
+        // threads inherit the placement of the process unless UTEE pins them
+        if(CPU_COUNT(enclave ? &enclave_cpus : &client_cpus)) {
+            utee_pin(p, index, enclave, enclave);
+        }
+    }
+    pthread_mutex_unlock(&affinity_lock);
     return 0;
 }
 
 // ---------------------------------------------------------------------------
-void utee_cleanup() {
-    msg_ecall->call = 0;
-    sem_post(&(msg_ecall->calls));
-    sem_wait(&(msg_ecall->results));
-    shm_unlink(sandbox_ecall_key);
-    shm_unlink(sandbox_ocall_key);
-    shm_unlink(sandbox_signal_key);
+static void utee_numa_bind(void* mem, size_t size) {
+    // has to be called before the pages are touched for the first time
+    if(numa_node < 0 || numa_node >= 64) {
+        return;
+    }
+    unsigned long mask = 1ul << numa_node;
+    syscall(SYS_mbind, mem, size, UTEE_MPOL_PREFERRED, &mask, 64, 0);
 }
 
 // ---------------------------------------------------------------------------
-static void utee_signal(int signum, siginfo_t* info, void* context) {
-    UNUSED(signum);
-    UNUSED(context);
-    assert(info && "Could not get signal info");
-    msg_signal->call = signum;
-    msg_signal->param[0] = ((size_t)(info->si_addr)) & ~0xfff;
-    sem_post(&(msg_signal->calls));
-    sem_wait(&(msg_signal->results));
-    if(msg_signal->result != 0) exit(msg_signal->result);
+static void* utee_shm_map(const char* key, size_t size, int create) {
+    int fd = shm_open(key, create ? (O_CREAT | O_RDWR) : O_RDWR, 0644);
+    if(fd == -1) {
+        return NULL;
+    }
+    struct stat st;
+    if(create ? ftruncate(fd, size) : (fstat(fd, &st) || (size_t)st.st_size < size)) {
+        close(fd);
+        return NULL;
+    }
+    void* mem = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mem == MAP_FAILED) {
+        return NULL;
+    }
+    if(create) {
+        utee_numa_bind(mem, size);
+    }
+    return mem;
 }
 
 // ---------------------------------------------------------------------------
-int utee_enclave_start() {
-    if(!msg_ecall || !msg_ocall || !msg_signal) {
-        fprintf(stderr, "[utee] Could not map shared memory, did you initialize the enclave?\n");
-        return 1;
+static int utee_peer_alive(pid_t pid) {
+    return pid > 0 && (kill(pid, 0) == 0 || errno != ESRCH);
+}
+
+// ---------------------------------------------------------------------------
+static int utee_timedwait(sem_t* sem, int ms) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (ms % 1000) * 1000000l;
+    if(ts.tv_nsec >= 1000000000l) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000l;
     }
-    
-    // setup signal handler
-    struct sigaction sa;
-    sigfillset(&sa.sa_mask);
-    sa.sa_sigaction = utee_signal;
-    sa.sa_flags = SA_RESTART | SA_SIGINFO;
-    for(int sig = 1; sig < 32; sig++) {
-        if(sig != SIGHUP) sigaction(sig, &sa, 0);
+    while(sem_timedwait(sem, &ts)) {
+        if(errno != EINTR) return 1;
     }
-    
-    // handle ecalls
-    while(1) {
-        sem_wait(&(msg_ecall->calls));
-        if(msg_ecall->call < utee_ecalls) {
-            msg_ecall->result = ecall[msg_ecall->call](msg_ecall->param[0], msg_ecall->param[1], msg_ecall->param[2], msg_ecall->param[3], msg_ecall->param[4], msg_ecall->param[5], msg_ecall->len, msg_ecall->data);
-        }
-        sem_post(&(msg_ecall->results));
-        if(msg_ecall->call == 0) {
-            break;
-        }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+static int utee_wait_peer(sem_t* sem, volatile pid_t* peer) {
+    // wait for the semaphore as long as the other side is alive
+    while(utee_timedwait(sem, UTEE_LIVENESS_INTERVAL)) {
+        if(!utee_peer_alive(*peer)) return 1;
     }
     return 0;
 }
 
+// ---------------------------------------------------------------------------
+static void utee_ring_reset(utee_ring_t* ring, utee_slot_t* slot, int slots) {
+    sem_init(&(ring->pending), 1, 0);
+    sem_init(&(ring->free), 1, slots);
+    for(int i = 0; i < slots; i++) {
+        slot[i].call = -1;
+        slot[i].state = UTEE_SLOT_FREE;
+        sem_init(&(slot[i].results), 1, 0);
+    }
+}
 
 // ---------------------------------------------------------------------------
-int utee_enclave_connect(const char* name) {
-    char ecall_key[UTEE_MAX_ENCLAVE_NAME + 8], ocall_key[UTEE_MAX_ENCLAVE_NAME + 8], signal_key[UTEE_MAX_ENCLAVE_NAME + 8];
-    snprintf(ecall_key, sizeof(ecall_key) - 1, "%s_ecall", name);
-    snprintf(ocall_key, sizeof(ocall_key) - 1, "%s_ocall", name);
-    snprintf(signal_key, sizeof(signal_key) - 1, "%s_signal", name);
-    
-    int s_e = shm_open(ecall_key, O_RDWR, 0644);
-    if(s_e == -1) {
+static void utee_channel_reset(utee_channel_t* chan) {
+    chan->signal->call = -1;
+    sem_init(&(chan->signal->calls), 1, 0);
+    sem_init(&(chan->signal->results), 1, 0);
+
+    utee_ring_reset(chan->ecall_ring, chan->ecall, UTEE_ECALL_SLOTS);
+    utee_ring_reset(chan->ocall_ring, chan->ocall, UTEE_OCALL_SLOTS);
+}
+
+// ---------------------------------------------------------------------------
+static size_t utee_channel_min_size() {
+    return sizeof(utee_channel_hdr_t) + (1 + UTEE_ECALL_SLOTS + UTEE_OCALL_SLOTS) * sizeof(utee_slot_t) + 2 * sizeof(utee_ring_t);
+}
+
+// ---------------------------------------------------------------------------
+static size_t utee_channel_size() {
+    size_t size = utee_channel_min_size();
+    size_t align = getenv(UTEE_HUGEPAGES_ENV) ? UTEE_HUGEPAGE_SIZE : (size_t)sysconf(_SC_PAGESIZE);
+    return (size + align - 1) & ~(align - 1);
+}
+
+// ---------------------------------------------------------------------------
+static int utee_channel_map(utee_channel_t* chan, const char* name, int inst, int id, int create) {
+    char key[UTEE_MAX_ENCLAVE_NAME + 32];
+    utee_channel_key(key, sizeof(key), name, inst, id);
+    int fd = shm_open(key, create ? (O_CREAT | O_RDWR) : O_RDWR, 0644);
+    if(fd == -1) {
         return 1;
     }
-    int s_o = shm_open(ocall_key, O_RDWR, 0644);
-    if(s_o == -1) {
+    struct stat st;
+    size_t size = create ? utee_channel_size() : 0;
+    if(create ? ftruncate(fd, size) : fstat(fd, &st)) {
+        close(fd);
         return 1;
     }
-    int s_f = shm_open(signal_key, O_RDWR, 0644);
-    if(s_f == -1) {
-        return 1;
-    }    
-    msg_ecall = (utee_msg_t*)mmap(NULL, UTEE_MAX_MESSAGE_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, s_e, 0);
-    msg_ocall = (utee_msg_t*)mmap(NULL, UTEE_MAX_MESSAGE_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, s_o, 0);
-    msg_signal = (utee_msg_t*)mmap(NULL, UTEE_MAX_MESSAGE_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, s_f, 0);
-    if(!msg_ecall || !msg_ocall || !msg_signal) {
-        fprintf(stderr, "[utee] Failed to connect to enclave: could not map shared memory\n");
+    if(!create) {
+        size = st.st_size;
+        if(size < utee_channel_min_size()) {
+            close(fd);
+            return 1;
+        }
+    }
+
+    // the enclave allocates the channel, the clients map the existing pages
+    char* mem = (char*)mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED | (create ? 0 : MAP_POPULATE), fd, 0);
+    close(fd);
+    if(mem == MAP_FAILED) {
         return 1;
     }
+    if(create) {
+        if(size % UTEE_HUGEPAGE_SIZE == 0) {
+            madvise(mem, size, MADV_HUGEPAGE);
+        }
+        utee_numa_bind(mem, size);
+        memset(mem, 0, size);
+    }
+    // keep the channel resident, best effort as it is limited by RLIMIT_MEMLOCK
+    mlock(mem, size);
 
-    sleep(1);
+    chan->hdr = (utee_channel_hdr_t*)mem;
+    if(!create && (chan->hdr->magic != UTEE_CHANNEL_MAGIC || chan->hdr->version != UTEE_CHANNEL_VERSION || chan->hdr->slot_size != sizeof(utee_slot_t) || chan->hdr->ecall_slots != UTEE_ECALL_SLOTS || chan->hdr->ocall_slots != UTEE_OCALL_SLOTS)) {
+        fprintf(stderr, "[utee] Channel '%s' has an incompatible layout\n", key);
+        munmap(mem, size);
+        return 1;
+    }
+    chan->signal = (utee_slot_t*)(mem + sizeof(utee_channel_hdr_t));
+    chan->ecall_ring = (utee_ring_t*)(chan->signal + 1);
+    chan->ecall = (utee_slot_t*)(chan->ecall_ring + 1);
+    chan->ocall_ring = (utee_ring_t*)(chan->ecall + UTEE_ECALL_SLOTS);
+    chan->ocall = (utee_slot_t*)(chan->ocall_ring + 1);
+    chan->size = size;
+    if(create) {
+        chan->hdr->version = UTEE_CHANNEL_VERSION;
+        chan->hdr->slot_size = sizeof(utee_slot_t);
+        chan->hdr->ecall_slots = UTEE_ECALL_SLOTS;
+        chan->hdr->ocall_slots = UTEE_OCALL_SLOTS;
+        chan->hdr->magic = UTEE_CHANNEL_MAGIC;
+    }
     return 0;
 }
 
-
 // ---------------------------------------------------------------------------
-int utee_enclave_load(const char* filename) {
-    assert(filename && "Filename of the enclave is required");
-    FILE* f = fopen(filename, "rb");
-    if(!f) {
-        fprintf(stderr, "[utee] Could not open enclave '%s'\n", filename);
-        return -1;
+static utee_broker_t* utee_broker_map(const char* name, int create) {
+    char key[UTEE_MAX_ENCLAVE_NAME + 32];
+    utee_broker_key(key, sizeof(key), name);
+    // the broker is created by the first instance and shared by all instances
+    utee_broker_t* b = (utee_broker_t*)utee_shm_map(key, sizeof(utee_broker_t), create);
+    if(!b) {
+        return NULL;
     }
-    fclose(f);
-    
-    utee_enclave_pid = utee_proc_find(filename);
-    // if enclave is not running, start it
-    if(utee_enclave_pid == -1) {
-        utee_enclave_pid = fork();
-        assert(utee_enclave_pid != 1 && "Fork failed");
-        if(utee_enclave_pid == 0) {
-            prctl(PR_SET_PDEATHSIG, SIGHUP);
-            char* argv[] = { (char*)filename, NULL };
-            execv(argv[0], argv);
-            fprintf(stderr, "[utee] Failed to start enclave\n");
-            return -1;
+    if(create && __sync_bool_compare_and_swap(&(b->magic), 0, UTEE_BROKER_INIT)) {
+        sem_init(&(b->spawn), 1, 0);
+        for(int i = 0; i < UTEE_MAX_INSTANCES; i++) {
+            sem_init(&(b->instance[i].takeover), 1, 0);
+            sem_init(&(b->instance[i].handover), 1, 0);
         }
+        __sync_synchronize();
+        b->magic = UTEE_BROKER_MAGIC;
+    }
+    for(int i = 0; b->magic == UTEE_BROKER_INIT && i < UTEE_MAX_CONNECTION_RETRY; i++) {
+        usleep(UTEE_CONNECTION_RETRY_DELAY);
+    }
+    if(b->magic != UTEE_BROKER_MAGIC) {
+        munmap((void*)b, sizeof(utee_broker_t));
+        return NULL;
+    }
+    return b;
+}
+
+// ---------------------------------------------------------------------------
+static utee_sched_t* utee_sched_map(const char* name, int inst, int create) {
+    char key[UTEE_MAX_ENCLAVE_NAME + 32];
+    utee_sched_key(key, sizeof(key), name, inst);
+    utee_sched_t* s = (utee_sched_t*)utee_shm_map(key, sizeof(utee_sched_t), create);
+    if(!s) {
+        return NULL;
     }
-    
-    int fail_ctr = 0;
-    while(fail_ctr < UTEE_MAX_CONNECTION_RETRY) {
-        int fail = utee_enclave_connect(filename);
-        if(!fail) {
-            if(utee_ocalls > 1) {
-                utee_start_ocall_handler();
+    if(create) {
+        memset((void*)s, 0, sizeof(utee_sched_t));
+        sem_init(&(s->doorbell), 1, 0);
+        for(int l = 0; l < UTEE_LANES; l++) {
+            for(int i = 0; i < UTEE_LANE_CAPACITY; i++) {
+                s->lane[l].entry[i].seq = i;
             }
-            return utee_enclave_pid;
         }
-        fail_ctr++;
-        sleep(1);
+        for(int i = 0; i < UTEE_MAX_ECALLS; i++) {
+            s->ecall_lane[i] = UTEE_LANE_NORMAL;
+        }
+        s->magic = UTEE_SCHED_MAGIC;
     }
-    fprintf(stderr, "[utee] Failed to connect to enclave\n");
-    
-    return -1;
+    if(s->magic != UTEE_SCHED_MAGIC) {
+        munmap((void*)s, sizeof(utee_sched_t));
+        return NULL;
+    }
+    return s;
 }
 
+// ---------------------------------------------------------------------------
+static utee_arena_t* utee_arena_map(const char* name, int inst, int create, uint64_t* mapped) {
+    char key[UTEE_MAX_ENCLAVE_NAME + 32];
+    utee_arena_key(key, sizeof(key), name, inst);
+    if(create) {
+        size_t size = UTEE_ARENA_SIZE;
+        const char* env = getenv(UTEE_ARENA_SIZE_ENV);
+        if(env && atol(env) > 0) {
+            size = (size_t)atol(env) << 20;
+        }
+        size = (size / UTEE_ARENA_SLAB) * UTEE_ARENA_SLAB;
+        if(size < 2 * UTEE_ARENA_SLAB) size = 2 * UTEE_ARENA_SLAB;
+        if(size > UTEE_ARENA_MAX_SLABS * UTEE_ARENA_SLAB) size = UTEE_ARENA_MAX_SLABS * UTEE_ARENA_SLAB;
+        // start with an empty arena, objects of a previous instance are gone
+        shm_unlink(key);
+        utee_arena_t* a = (utee_arena_t*)utee_shm_map(key, size, 1);
+        if(!a) {
+            return NULL;
+        }
+        a->size = size;
+        a->slabs = size / UTEE_ARENA_SLAB;
+        *mapped = size;
+        // slab 0 is the header, so offset 0 is never a valid object
+        a->next_slab = 1;
+        __sync_synchronize();
+        a->magic = UTEE_ARENA_MAGIC;
+        return a;
+    }
+    // the size is only known after mapping the header
+    utee_arena_t* a = (utee_arena_t*)utee_shm_map(key, sizeof(utee_arena_t), 0);
+    if(!a) {
+        return NULL;
+    }
+    size_t size = a->size;
+    int valid = (a->magic == UTEE_ARENA_MAGIC) && !(size % UTEE_ARENA_SLAB) && size >= 2 * UTEE_ARENA_SLAB && size <= UTEE_ARENA_MAX_SLABS * UTEE_ARENA_SLAB;
+    munmap((void*)a, sizeof(utee_arena_t));
+    // the size is read once, later changes to the header do not change the mapping
+    *mapped = size;
+    return valid ? (utee_arena_t*)utee_shm_map(key, size, 0) : NULL;
+}
 
 // ---------------------------------------------------------------------------
-int utee_register_ecall(utee_call_t call) {
-    if(utee_ecalls < UTEE_MAX_ECALLS) {
-        ecall[utee_ecalls++] = call;
-        return utee_ecalls - 1;
-    } else {
-        fprintf(stderr, "[utee] Could not register ECALL: maximum number of ECALLs reached\n");
-        return -1;
+static int utee_lane_push(utee_lane_t* lane, uint32_t client, uint32_t slot) {
+    // bounded MPMC queue, every entry carries the position it is valid for
+    uint64_t pos = lane->head;
+    while(1) {
+        utee_lane_entry_t* e = &(lane->entry[pos % UTEE_LANE_CAPACITY]);
+        int64_t diff = (int64_t)(__atomic_load_n(&(e->seq), __ATOMIC_ACQUIRE) - pos);
+        if(diff == 0) {
+            if(__sync_bool_compare_and_swap(&(lane->head), pos, pos + 1)) {
+                e->client = client;
+                e->slot = slot;
+                __atomic_store_n(&(e->seq), pos + 1, __ATOMIC_RELEASE);
+                return 0;
+            }
+        } else if(diff < 0) {
+            return 1;
+        }
+        pos = lane->head;
     }
 }
 
 // ---------------------------------------------------------------------------
-int utee_register_ocall(utee_call_t call) {
-    if(utee_ocalls < UTEE_MAX_OCALLS) {
-        ocall[utee_ocalls++] = call;
-        return utee_ocalls - 1;
-    } else {
-        fprintf(stderr, "[utee] Could not register OCALL: maximum number of OCALLs reached\n");
-        return -1;
+static int utee_lane_empty(utee_lane_t* lane) {
+    // only called by the enclave with dispatch_lock held, i.e., a single consumer
+    uint64_t pos = lane->tail;
+    return __atomic_load_n(&(lane->entry[pos % UTEE_LANE_CAPACITY].seq), __ATOMIC_ACQUIRE) != pos + 1;
+}
+
+// ---------------------------------------------------------------------------
+static void utee_lane_pop(utee_lane_t* lane, uint32_t* client, uint32_t* slot) {
+    uint64_t pos = lane->tail;
+    utee_lane_entry_t* e = &(lane->entry[pos % UTEE_LANE_CAPACITY]);
+    *client = e->client;
+    *slot = e->slot;
+    lane->tail = pos + 1;
+    __atomic_store_n(&(e->seq), pos + UTEE_LANE_CAPACITY, __ATOMIC_RELEASE);
+}
+
+// ---------------------------------------------------------------------------
+static int utee_instance_wanted() {
+    const char* id = getenv(UTEE_INSTANCE_ENV);
+    return id ? atoi(id) : -1;
+}
+
+// ---------------------------------------------------------------------------
+static int utee_instance_claim(int wanted) {
+    for(int i = 0; i < UTEE_MAX_INSTANCES; i++) {
+        if(wanted != -1 && i != wanted) continue;
+        utee_instance_t* inst = &(broker->instance[i]);
+        pid_t owner = inst->owner;
+        if(utee_peer_alive(owner)) continue;
+        if(__sync_bool_compare_and_swap(&(inst->owner), owner, getpid())) {
+            // the previous owner might have died without cleaning up
+            inst->enclave = 0;
+            memset((void*)inst->client, 0, sizeof(inst->client));
+            memset((void*)inst->signals, 0, sizeof(inst->signals));
+            return i;
+        }
     }
+    return -1;
 }
 
 // ---------------------------------------------------------------------------
-uint64_t utee_ecall(utee_msg_t* msg) {
-    assert(msg && "ECALL message must not be NULL");
-    memcpy(msg_ecall->data, msg->data, msg->len);
-    for(int i = 0; i < 6; i++) {
-        msg_ecall->param[0] = msg->param[0];
+static int utee_instance_load(utee_instance_t* inst) {
+    int load = 0;
+    for(int i = 0; i < UTEE_MAX_CLIENTS; i++) {
+        if(inst->client[i]) load++;
     }
-    msg_ecall->len = msg->len;
-    msg_ecall->call = msg->call;
-    sem_post(&(msg_ecall->calls));
-    sem_wait(&(msg_ecall->results));
-    memcpy(msg->data, msg_ecall->data, msg->len);
-    return msg_ecall->result;
+    return load;
 }
 
 // ---------------------------------------------------------------------------
-uint64_t utee_ocall(utee_msg_t* msg) {
-    assert(msg && "OCALL message must not be NULL");
-    memcpy(msg_ocall->data, msg->data, msg->len);
-    for(int i = 0; i < 6; i++) {
-        msg_ocall->param[0] = msg->param[0];
+int utee_enclave_daemon() {
+    pid_t pid = fork();
+    if(pid == -1) {
+        fprintf(stderr, "[utee] Could not start daemon: fork failed\n");
+        return 1;
     }
-    msg_ocall->len = msg->len;
-    msg_ocall->call = msg->call;
-    sem_post(&(msg_ocall->calls));
-    sem_wait(&(msg_ocall->results));
-    memcpy(msg->data, msg_ocall->data, msg->len);
-    return msg_ocall->result;
+    if(pid) {
+        _exit(0);
+    }
+    setsid();
+    prctl(PR_SET_PDEATHSIG, 0);
+    int null = open("/dev/null", O_RDWR);
+    if(null != -1) {
+        dup2(null, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        close(null);
+    }
+    daemon_mode = 1;
+    return 0;
 }
 
 // ---------------------------------------------------------------------------
-static void* utee_signal_handler(void* handler) {
-    while(1) {
-        sem_wait(&(msg_signal->calls));
-        msg_signal->result = ((utee_signal_handler_t)handler)(msg_signal->call, (void*)(msg_signal->param[0]));
-        sem_post(&(msg_signal->results));
-    }   
+static void utee_zygote_signal(int signum) {
+    UNUSED(signum);
+    zygote_stop = 1;
 }
 
 // ---------------------------------------------------------------------------
-void utee_register_signal_handler(utee_signal_handler_t handler) {
-    pthread_t p;
-    assert(!pthread_create(&p, NULL, utee_signal_handler, (void*)handler) && "Could not start signal handler");
-    has_signal_handler = 1;
+int utee_enclave_zygote(const char* name) {
+    assert(name && "Enclave name must be provided");
+    utee_broker_t* b = utee_broker_map(name, 1);
+    if(!b) {
+        fprintf(stderr, "[utee] Could not start fork server: failed to open shared memory\n");
+        return 1;
+    }
+    pid_t other = b->zygote;
+    if(utee_peer_alive(other) || !__sync_bool_compare_and_swap(&(b->zygote), other, getpid())) {
+        fprintf(stderr, "[utee] Could not start fork server: another fork server is running\n");
+        munmap((void*)b, sizeof(utee_broker_t));
+        return 1;
+    }
+
+    // instances are reaped automatically, they outlive the fork server
+    signal(SIGCHLD, SIG_IGN);
+    for(size_t i = 0; i < sizeof(term_signals) / sizeof(term_signals[0]); i++) {
+        signal(term_signals[i], utee_zygote_signal);
+    }
+    while(!zygote_stop) {
+        if(utee_timedwait(&(b->spawn), UTEE_LIVENESS_INTERVAL)) {
+            continue;
+        }
+        pid_t pid = fork();
+        if(pid == -1) {
+            fprintf(stderr, "[utee] Could not start instance: fork failed\n");
+            continue;
+        }
+        if(pid == 0) {
+            // the new instance continues with the state prepared by the fork server
+            signal(SIGCHLD, SIG_DFL);
+            for(size_t i = 0; i < sizeof(term_signals) / sizeof(term_signals[0]); i++) {
+                signal(term_signals[i], SIG_DFL);
+            }
+            munmap((void*)b, sizeof(utee_broker_t));
+            return 0;
+        }
+    }
+    __sync_bool_compare_and_swap(&(b->zygote), getpid(), 0);
+    exit(0);
 }
 
+// ---------------------------------------------------------------------------
+int utee_enclave_spawn(const char* name) {
+    utee_broker_t* b = utee_broker_map(name, 0);
+    if(!b) {
+        return 1;
+    }
+    int running = utee_peer_alive(b->zygote);
+    if(running) {
+        sem_post(&(b->spawn));
+    }
+    munmap((void*)b, sizeof(utee_broker_t));
+    return !running;
+}
 
 // ---------------------------------------------------------------------------
-static void* utee_ocall_handler(void* handler) {
-    UNUSED(handler);
-    while(1) {
-        sem_wait(&(msg_ocall->calls));
-        if(msg_ocall->call < utee_ocalls) {
-            msg_ocall->result = ocall[msg_ocall->call](msg_ocall->param[0], msg_ocall->param[1], msg_ocall->param[2], msg_ocall->param[3], msg_ocall->param[4], msg_ocall->param[5], msg_ocall->len, msg_ocall->data);
+int utee_enclave_init(const char* name) {
+    assert(name && "Enclave name must be provided");
+    strncpy(enclave_name, name, sizeof(enclave_name) - 1);
+
+    // the shared memory is placed on the NUMA node of the enclave threads
+    pthread_once(&affinity_defaults, utee_affinity_env);
+    const char* node = getenv(UTEE_NUMA_NODE_ENV);
+    if(node) {
+        numa_node = atoi(node);
+    } else if(CPU_COUNT(&enclave_cpus)) {
+        numa_node = utee_cpu_node(utee_cpu_nth(&enclave_cpus, 0));
+    }
+
+    broker = utee_broker_map(name, 1);
+    if(!broker) {
+        fprintf(stderr, "[utee] Could not init enclave: failed to open shared memory\n");
+        return 1;
+    }
+    instance_id = utee_instance_claim(utee_instance_wanted());
+    if(instance_id == -1) {
+        fprintf(stderr, "[utee] Could not init enclave: no free instance id\n");
+        return 1;
+    }
+    instance = &(broker->instance[instance_id]);
+
+    char key[UTEE_MAX_ENCLAVE_NAME + 32];
+    utee_stats_key(key, sizeof(key), name, instance_id);
+    stats = (utee_stats_t*)utee_shm_map(key, sizeof(utee_stats_t), 1);
+    if(!stats) {
+        fprintf(stderr, "[utee] Could not init enclave: failed to map statistics\n");
+        return 1;
+    }
+    memset((void*)stats, 0, sizeof(utee_stats_t));
+
+    sched = utee_sched_map(name, instance_id, 1);
+    if(!sched) {
+        fprintf(stderr, "[utee] Could not init enclave: failed to map scheduler\n");
+        return 1;
+    }
+    arena = utee_arena_map(name, instance_id, 1, &arena_size);
+    if(!arena) {
+        fprintf(stderr, "[utee] Could not init enclave: failed to map arena\n");
+        return 1;
+    }
+
+    for(int i = 0; i < UTEE_MAX_CLIENTS; i++) {
+        if(utee_channel_map(&channel[i], name, instance_id, i, 1)) {
+            fprintf(stderr, "[utee] Could not init enclave: failed to map shared memory\n");
+            return 1;
         }
-        sem_post(&(msg_ocall->results));
-    }   
+        utee_channel_reset(&channel[i]);
+    }
+    sem_init(&enclave_stop, 0, 0);
+
+    instance->daemon = daemon_mode;
+    return 0;
 }
 
 // ---------------------------------------------------------------------------
-void utee_start_ocall_handler() {
-    pthread_t p;
-    assert(!pthread_create(&p, NULL, utee_ocall_handler, NULL) && "Could not start OCALL handler");
+int utee_enclave_restart(const char* name) {
+    assert(name && "Enclave name must be provided");
+    strncpy(enclave_name, name, sizeof(enclave_name) - 1);
+    pthread_once(&affinity_defaults, utee_affinity_env);
+
+    broker = utee_broker_map(name, 0);
+    if(!broker) {
+        fprintf(stderr, "[utee] Could not restart enclave: enclave is not running\n");
+        return 1;
+    }
+    // take over the selected instance, or the first running one
+    int wanted = utee_instance_wanted();
+    for(int i = 0; i < UTEE_MAX_INSTANCES && instance_id == -1; i++) {
+        utee_instance_t* inst = &(broker->instance[i]);
+        pid_t successor = inst->successor;
+        if((wanted != -1 && i != wanted) || !utee_peer_alive(inst->enclave) || utee_peer_alive(successor)) continue;
+        if(__sync_bool_compare_and_swap(&(inst->successor), successor, getpid())) {
+            instance_id = i;
+        }
+    }
+    if(instance_id == -1) {
+        fprintf(stderr, "[utee] Could not restart enclave: no running instance to take over\n");
+        return 1;
+    }
+    instance = &(broker->instance[instance_id]);
+
+    // attach to the shared memory of the running enclave, the clients keep their mappings
+    char key[UTEE_MAX_ENCLAVE_NAME + 32];
+    utee_stats_key(key, sizeof(key), name, instance_id);
+    stats = (utee_stats_t*)utee_shm_map(key, sizeof(utee_stats_t), 0);
+    sched = utee_sched_map(name, instance_id, 0);
+    arena = utee_arena_map(name, instance_id, 0, &arena_size);
+    int mapped = stats && sched && arena;
+    for(int i = 0; i < UTEE_MAX_CLIENTS && mapped; i++) {
+        mapped = !utee_channel_map(&channel[i], name, instance_id, i, 0);
+    }
+    if(!mapped) {
+        fprintf(stderr, "[utee] Could not restart enclave: shared memory of the instance is missing or incompatible\n");
+        __sync_bool_compare_and_swap(&(instance->successor), getpid(), 0);
+        return 1;
+    }
+    sem_init(&enclave_stop, 0, 0);
+    restarting = 1;
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+void utee_cleanup() {
+    char key[UTEE_MAX_ENCLAVE_NAME + 32];
+    if(!instance || handed_over) {
+        // after a hot restart, the shared memory belongs to the successor
+        return;
+    }
+    instance->enclave = 0;
+    for(int i = 0; i < UTEE_MAX_CLIENTS; i++) {
+        utee_channel_key(key, sizeof(key), enclave_name, instance_id, i);
+        shm_unlink(key);
+    }
+    utee_stats_key(key, sizeof(key), enclave_name, instance_id);
+    shm_unlink(key);
+    utee_sched_key(key, sizeof(key), enclave_name, instance_id);
+    shm_unlink(key);
+    utee_arena_key(key, sizeof(key), enclave_name, instance_id);
+    shm_unlink(key);
+    // the broker stays, it is shared with the other instances
+    __sync_bool_compare_and_swap(&(instance->owner), getpid(), 0);
+}
+
+// ---------------------------------------------------------------------------
+static void utee_signal(int signum, siginfo_t* info, void* context) {
+    UNUSED(context);
+    assert(info && "Could not get signal info");
+    if(!worker) {
+        // signal not caused by a client request, e.g., a request to terminate
+        for(size_t i = 0; i < sizeof(sync_signals) / sizeof(sync_signals[0]); i++) {
+            if(signum == sync_signals[i]) _exit(128 + signum);
+        }
+        for(size_t i = 0; i < sizeof(term_signals) / sizeof(term_signals[0]); i++) {
+            if(signum == term_signals[i]) sem_post(&enclave_stop);
+        }
+        return;
+    }
+    int id = worker - channel;
+    if(!instance->signals[id]) {
+        _exit(128 + signum);
+    }
+    UTEE_TRACE_BEGIN("signal", signum);
+    worker->signal->call = signum;
+    worker->signal->param[0] = ((size_t)(info->si_addr)) & ~0xfff;
+    sem_post(&(worker->signal->calls));
+    if(utee_wait_peer(&(worker->signal->results), &(instance->client[id]))) {
+        _exit(128 + signum);
+    }
+    UTEE_TRACE_END("signal", signum);
+    if(worker->signal->result != 0) exit(worker->signal->result);
+}
+
+// ---------------------------------------------------------------------------
+static void utee_reclaim() {
+    // called with dispatch_lock held, so no ECALL of a dead client is started meanwhile
+    for(int id = 0; id < UTEE_MAX_CLIENTS; id++) {
+        pid_t owner = instance->client[id];
+        if(!owner || utee_peer_alive(owner)) continue;
+        int running = 0;
+        for(int i = 0; i < UTEE_ECALL_SLOTS; i++) {
+            uint32_t state = channel[id].ecall[i].state;
+            if(state == UTEE_SLOT_RUNNING || state == UTEE_SLOT_CANCELLED || state == UTEE_SLOT_ABANDONED) running = 1;
+        }
+        if(running) continue;
+        // the owner died without disconnecting, make the channel set available again
+        utee_channel_reset(&channel[id]);
+        instance->signals[id] = 0;
+        __sync_synchronize();
+        instance->client[id] = 0;
+    }
+}
+
+// ---------------------------------------------------------------------------
+static utee_slot_t* utee_dispatch_next(int* client, int* lane) {
+    // called with dispatch_lock held
+    if(draining) {
+        return NULL;
+    }
+    for(int round = 0; round < 2; round++) {
+        for(int l = 0; l < UTEE_LANES; l++) {
+            if(lane_max_running[l] && __atomic_load_n(&(lane_running[l]), __ATOMIC_RELAXED) >= lane_max_running[l]) continue;
+            if(lane_policy == UTEE_SCHED_WEIGHTED && lane_credit[l] <= 0) continue;
+            while(!utee_lane_empty(&(sched->lane[l]))) {
+                uint32_t id, i;
+                utee_lane_pop(&(sched->lane[l]), &id, &i);
+                if(id >= UTEE_MAX_CLIENTS || i >= UTEE_ECALL_SLOTS) continue;
+                utee_slot_t* slot = &(channel[id].ecall[i]);
+                // stale entries of reclaimed channel sets do not reference a pending slot anymore
+                if(!__sync_bool_compare_and_swap(&(slot->state), UTEE_SLOT_PENDING, UTEE_SLOT_RUNNING)) continue;
+                // workers finish outside of the lock, the counter is only changed atomically
+                __atomic_fetch_add(&(lane_running[l]), 1, __ATOMIC_RELAXED);
+                lane_credit[l]--;
+                *client = id;
+                *lane = l;
+                return slot;
+            }
+        }
+        if(lane_policy != UTEE_SCHED_WEIGHTED) break;
+        // all lanes with pending ECALLs used up their share, start a new round
+        for(int l = 0; l < UTEE_LANES; l++) {
+            lane_credit[l] = lane_weight[l];
+        }
+    }
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+static void* utee_enclave_worker(void* arg) {
+    UNUSED(arg);
+
+    // asynchronous signals are handled by the main thread
+    sigset_t mask;
+    sigfillset(&mask);
+    for(size_t i = 0; i < sizeof(sync_signals) / sizeof(sync_signals[0]); i++) {
+        sigdelset(&mask, sync_signals[i]);
+    }
+    pthread_sigmask(SIG_SETMASK, &mask, NULL);
+
+    // handle the ecalls of all clients
+    while(1) {
+        int id, lane;
+        pthread_mutex_lock(&dispatch_lock);
+        utee_slot_t* slot = utee_dispatch_next(&id, &lane);
+        pthread_mutex_unlock(&dispatch_lock);
+        if(!slot) {
+            if(draining) {
+                // the instance was handed over, the successor serves the lanes
+                break;
+            }
+            // background work only runs while there is no ECALL to serve
+            if(idle_work && idle_work()) {
+                continue;
+            }
+            utee_timedwait(&(sched->doorbell), UTEE_LIVENESS_INTERVAL);
+            continue;
+        }
+
+        worker = &channel[id];
+        worker_slot = slot;
+        // the slot is written by the client, the call and the length are checked once and only the copies are used
+        uint64_t call = slot->call, len = slot->len, submitted = slot->submitted;
+        int valid = call > 0 && call < utee_ecalls && len <= UTEE_MAX_DATA_SIZE;
+        uint64_t start = utee_stats_now();
+        // calls whose caller stopped waiting are not started at all
+        int expired = slot->deadline && start > slot->deadline;
+        UTEE_TRACE_BEGIN("dispatch", call);
+        if(expired || !valid) {
+            slot->result = -1;
+        } else {
+            slot->result = ecall[call](slot->param[0], slot->param[1], slot->param[2], slot->param[3], slot->param[4], slot->param[5], len, slot->data);
+        }
+        UTEE_TRACE_END("dispatch", call);
+        uint64_t end = utee_stats_now();
+        worker = NULL;
+        worker_slot = NULL;
+        int dropped = 0;
+        if(slot->flags & UTEE_CALL_BATCH) {
+            // only the last call of a batch wakes up the client
+            slot->state = UTEE_SLOT_DONE;
+            utee_slot_t* leader = &(channel[id].ecall[slot->batch % UTEE_ECALL_SLOTS]);
+            if(__sync_sub_and_fetch(&(leader->batch_left), 1) == 0) {
+                sem_post(&(leader->results));
+            }
+        } else if(__sync_bool_compare_and_swap(&(slot->state), UTEE_SLOT_RUNNING, UTEE_SLOT_DONE)) {
+            sem_post(&(slot->results));
+        } else {
+            // late reply to a cancelled call, the client releases the slot, or left it to us
+            dropped = 1;
+            if(!__sync_bool_compare_and_swap(&(slot->state), UTEE_SLOT_CANCELLED, UTEE_SLOT_DONE)) {
+                slot->state = UTEE_SLOT_FREE;
+                sem_post(&(channel[id].ecall_ring->free));
+            }
+        }
+        __atomic_fetch_sub(&(lane_running[lane]), 1, __ATOMIC_RELAXED);
+        if(expired || dropped) {
+            __atomic_fetch_add(&(stats->cancelled), 1, __ATOMIC_RELAXED);
+        }
+
+        if(valid) {
+            utee_ecall_stats_t* s = &(stats->ecall[call]);
+            utee_stats_record(&(s->queue), start - submitted);
+            utee_stats_record(&(s->exec), end - start);
+            utee_stats_record(&(s->total), end - submitted);
+            __atomic_fetch_add(&(s->calls), 1, __ATOMIC_RELAXED);
+        } else {
+            __atomic_fetch_add(&(stats->invalid), 1, __ATOMIC_RELAXED);
+        }
+    }
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+static void* utee_reclaim_thread(void* arg) {
+    UNUSED(arg);
+    sigset_t mask;
+    sigfillset(&mask);
+    pthread_sigmask(SIG_SETMASK, &mask, NULL);
+
+    // periodically, as busy workers never run out of ECALLs to look for dead clients
+    while(1) {
+        usleep(UTEE_LIVENESS_INTERVAL * 1000);
+        pthread_mutex_lock(&dispatch_lock);
+        int stop = draining;
+        if(!stop) {
+            utee_reclaim();
+        }
+        pthread_mutex_unlock(&dispatch_lock);
+        if(stop) break;
+    }
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+static int utee_same_binary(pid_t pid) {
+    // the broker is writable by every client, so a successor is only trusted if it runs the enclave binary
+    char self_path[PATH_MAX], peer_path[PATH_MAX], proc[32];
+    snprintf(proc, sizeof(proc), "/proc/%d/exe", pid);
+    ssize_t self_len = readlink("/proc/self/exe", self_path, sizeof(self_path) - 1);
+    ssize_t peer_len = readlink(proc, peer_path, sizeof(peer_path) - 1);
+    if(self_len <= 0 || peer_len <= 0) return 0;
+    self_path[self_len] = peer_path[peer_len] = 0;
+    // an upgrade replaces the binary of the enclave that is taken over
+    char* deleted = strstr(self_path, " (deleted)");
+    if(deleted) *deleted = 0;
+    deleted = strstr(peer_path, " (deleted)");
+    if(deleted) *deleted = 0;
+    return !strcmp(self_path, peer_path);
+}
+
+// ---------------------------------------------------------------------------
+static socklen_t utee_handoff_address(struct sockaddr_un* addr, pid_t successor) {
+    // abstract socket of the successor, it disappears with the successor
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    int len = snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1, "utee_handoff.%.64s.%d", enclave_name, successor);
+    return offsetof(struct sockaddr_un, sun_path) + 1 + len;
+}
+
+// ---------------------------------------------------------------------------
+static pid_t utee_socket_peer(int fd) {
+    struct ucred peer;
+    socklen_t len = sizeof(peer);
+    if(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &len)) return 0;
+    return peer.pid;
+}
+
+// ---------------------------------------------------------------------------
+static int utee_socket_transfer(int fd, void* buffer, size_t len, int out) {
+    for(size_t done = 0; done < len; ) {
+        // a peer that went away must not raise SIGPIPE, which would stop the enclave
+        ssize_t r = out ? send(fd, (char*)buffer + done, len - done, MSG_NOSIGNAL) : read(fd, (char*)buffer + done, len - done);
+        if(r <= 0) {
+            if(r == -1 && errno == EINTR) continue;
+            return 1;
+        }
+        done += r;
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+static void utee_handoff_send(pid_t successor) {
+    uint64_t len = 0;
+    void* buffer = handoff_save ? malloc(UTEE_HANDOFF_SIZE) : NULL;
+    if(buffer) {
+        len = handoff_save(buffer, UTEE_HANDOFF_SIZE);
+        if(len > UTEE_HANDOFF_SIZE) len = 0;
+    }
+    // the state goes directly to the successor, never through memory the clients can access
+    struct sockaddr_un addr;
+    socklen_t addr_len = utee_handoff_address(&addr, successor);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    char ack = 0;
+    // the successor checks this process before it acknowledges, so it has to stay until then
+    if(fd == -1 || connect(fd, (struct sockaddr*)&addr, addr_len) || utee_socket_peer(fd) != successor
+       || utee_socket_transfer(fd, &len, sizeof(len), 1) || utee_socket_transfer(fd, buffer, len, 1)
+       || utee_socket_transfer(fd, &ack, sizeof(ack), 0)) {
+        fprintf(stderr, "[utee] Could not hand over the state to the successor\n");
+    }
+    if(fd != -1) close(fd);
+    if(buffer) {
+        explicit_bzero(buffer, UTEE_HANDOFF_SIZE);
+        free(buffer);
+    }
+}
+
+// ---------------------------------------------------------------------------
+static void* utee_handoff_thread(void* arg) {
+    UNUSED(arg);
+    sigset_t mask;
+    sigfillset(&mask);
+    pthread_sigmask(SIG_SETMASK, &mask, NULL);
+
+    pid_t successor;
+    do {
+        while(sem_wait(&(instance->takeover)) && errno == EINTR);
+        successor = instance->successor;
+        if(utee_peer_alive(successor) && !utee_same_binary(successor)) {
+            // not an enclave, let a real successor take over later
+            __sync_bool_compare_and_swap(&(instance->successor), successor, 0);
+            successor = 0;
+        }
+    } while(!utee_peer_alive(successor));
+
+    // stop dispatching, and let the running ECALLs finish
+    pthread_mutex_lock(&dispatch_lock);
+    draining = 1;
+    pthread_mutex_unlock(&dispatch_lock);
+    for(int running = 1; running; ) {
+        running = 0;
+        for(int l = 0; l < UTEE_LANES; l++) {
+            running += __atomic_load_n(&(lane_running[l]), __ATOMIC_RELAXED);
+        }
+        if(running) usleep(1000);
+    }
+
+    utee_handoff_send(successor);
+
+    // pending ECALLs stay in the lanes, clients now wait for the successor
+    stats->enclave = successor;
+    instance->owner = successor;
+    instance->enclave = successor;
+    handed_over = 1;
+    __sync_synchronize();
+    sem_post(&(instance->handover));
+    sem_post(&enclave_stop);
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+static void utee_handoff_receive() {
+    // the state is received on a socket of the successor before the instance is handed over
+    volatile pid_t previous = instance->enclave;
+    struct sockaddr_un addr;
+    socklen_t addr_len = utee_handoff_address(&addr, getpid());
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd != -1 && (bind(fd, (struct sockaddr*)&addr, addr_len) || listen(fd, 1))) {
+        close(fd);
+        fd = -1;
+    }
+
+    // ask the running enclave to drain, and wait until it hands over the instance
+    sem_post(&(instance->takeover));
+    void* state = NULL;
+    uint64_t len = 0;
+    while(fd != -1 && utee_peer_alive(previous)) {
+        struct pollfd p = { fd, POLLIN, 0 };
+        if(poll(&p, 1, UTEE_LIVENESS_INTERVAL) != 1) continue;
+        int conn = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+        if(conn == -1) continue;
+        // only the enclave that is taken over may provide the state
+        pid_t peer = utee_socket_peer(conn);
+        if(peer != previous || !utee_same_binary(peer)) {
+            close(conn);
+            continue;
+        }
+        if(!utee_socket_transfer(conn, &len, sizeof(len), 0) && len <= UTEE_HANDOFF_SIZE) {
+            state = malloc(len ? len : 1);
+            if(state && utee_socket_transfer(conn, state, len, 0)) {
+                free(state);
+                state = NULL;
+            }
+        }
+        char ack = 1;
+        utee_socket_transfer(conn, &ack, sizeof(ack), 1);
+        close(conn);
+        break;
+    }
+    if(fd != -1) close(fd);
+    if(utee_wait_peer(&(instance->handover), &previous)) {
+        fprintf(stderr, "[utee] Enclave exited during restart, taking over without state\n");
+    } else if(state && len && handoff_restore) {
+        handoff_restore(state, len);
+    }
+    if(state) {
+        explicit_bzero(state, len);
+        free(state);
+    }
+    instance->owner = getpid();
+    instance->daemon = daemon_mode;
+    instance->successor = 0;
+}
+
+// ---------------------------------------------------------------------------
+int utee_enclave_start() {
+    if(!instance) {
+        fprintf(stderr, "[utee] Could not map shared memory, did you initialize the enclave?\n");
+        return 1;
+    }
+
+    // setup signal handler
+    struct sigaction sa;
+    sigfillset(&sa.sa_mask);
+    sa.sa_sigaction = utee_signal;
+    sa.sa_flags = SA_RESTART | SA_SIGINFO;
+    for(int sig = 1; sig < 32; sig++) {
+        sigaction(sig, &sa, 0);
+    }
+
+    // the main thread only handles signals, it may use all CPUs of the enclave
+    pthread_mutex_lock(&affinity_lock);
+    enclave_main = pthread_self();
+    has_enclave_main = 1;
+    if(CPU_COUNT(&enclave_cpus)) {
+        utee_pin(enclave_main, 0, 1, 0);
+    }
+    pthread_mutex_unlock(&affinity_lock);
+
+    // a restarted enclave continues with the lanes of its predecessor
+    if(restarting) {
+        utee_handoff_receive();
+    }
+
+    // pool of threads serving the lanes of all channel sets
+    const char* env = getenv(UTEE_WORKERS_ENV);
+    int workers = env ? atoi(env) : UTEE_WORKERS;
+    for(int i = 0; i < (workers > 0 ? workers : 1); i++) {
+        if(utee_thread_start(utee_enclave_worker, NULL, 1)) {
+            fprintf(stderr, "[utee] Could not start enclave thread\n");
+            return 1;
+        }
+    }
+
+    if(utee_thread_start(utee_handoff_thread, NULL, 1) || utee_thread_start(utee_reclaim_thread, NULL, 1)) {
+        fprintf(stderr, "[utee] Could not start enclave thread\n");
+        return 1;
+    }
+
+    stats->enclave = getpid();
+    stats->ecalls = utee_ecalls;
+    stats->magic = UTEE_STATS_MAGIC;
+
+    // accept clients
+    instance->enclave = getpid();
+    if(restarting) {
+        // doorbells consumed by the draining predecessor are not lost
+        for(int i = 0; i < (workers > 0 ? workers : 1); i++) {
+            sem_post(&(sched->doorbell));
+        }
+    }
+    while(sem_wait(&enclave_stop) && errno == EINTR);
+    if(!handed_over) {
+        instance->enclave = 0;
+    }
+    return 0;
+}
+
+
+// ---------------------------------------------------------------------------
+int utee_enclave_connect(const char* name) {
+    if(self) {
+        return 0;
+    }
+    utee_broker_t* b = utee_broker_map(name, 0);
+    if(!b) {
+        return 1;
+    }
+
+    // claim a free channel set, preferably at the least-loaded instance
+    int wanted = utee_instance_wanted(), tried[UTEE_MAX_INSTANCES] = {0};
+    int inst = -1, id = -1;
+    while(id == -1) {
+        inst = -1;
+        for(int i = 0; i < UTEE_MAX_INSTANCES; i++) {
+            if(tried[i] || (wanted != -1 && i != wanted)) continue;
+            if(!utee_peer_alive(b->instance[i].enclave)) continue;
+            if(inst == -1 || utee_instance_load(&(b->instance[i])) < utee_instance_load(&(b->instance[inst]))) {
+                inst = i;
+            }
+        }
+        if(inst == -1) {
+            break;
+        }
+        tried[inst] = 1;
+        for(int i = 0; i < UTEE_MAX_CLIENTS && id == -1; i++) {
+            if(__sync_bool_compare_and_swap(&(b->instance[inst].client[i]), 0, getpid())) {
+                id = i;
+            }
+        }
+    }
+    if(id == -1) {
+        munmap((void*)b, sizeof(utee_broker_t));
+        return 1;
+    }
+    utee_sched_t* s = utee_sched_map(name, inst, 0);
+    uint64_t size;
+    utee_arena_t* a = utee_arena_map(name, inst, 0, &size);
+    if(!s || !a || utee_channel_map(&channel[id], name, inst, id, 0)) {
+        fprintf(stderr, "[utee] Failed to connect to enclave: could not map shared memory\n");
+        if(s) munmap((void*)s, sizeof(utee_sched_t));
+        if(a) munmap((void*)a, size);
+        b->instance[inst].client[id] = 0;
+        munmap((void*)b, sizeof(utee_broker_t));
+        return 1;
+    }
+    b->instance[inst].signals[id] = has_signal_handler;
+    broker = b;
+    sched = s;
+    arena_size = size;
+    arena = a;
+    instance_id = inst;
+    instance = &(b->instance[inst]);
+    client_id = id;
+    self = &channel[id];
+    utee_enclave_pid = instance->enclave;
+    strncpy(enclave_name, name, sizeof(enclave_name) - 1);
+    const char* timeout = getenv(UTEE_ECALL_TIMEOUT_ENV);
+    ecall_default_timeout = timeout ? atoi(timeout) : 0;
+    atexit(utee_enclave_disconnect);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+void utee_enclave_disconnect() {
+    if(!self) {
+        return;
+    }
+    self = NULL;
+    __sync_bool_compare_and_swap(&(instance->client[client_id]), getpid(), 0);
+    client_id = -1;
+    if(arena) {
+        // objects of the arena are invalid after disconnecting
+        utee_arena_t* a = arena;
+        arena = NULL;
+        munmap((void*)a, arena_size);
+    }
+}
+
+
+// ---------------------------------------------------------------------------
+int utee_enclave_load(const char* filename) {
+    assert(filename && "Filename of the enclave is required");
+    FILE* f = fopen(filename, "rb");
+    if(!f) {
+        fprintf(stderr, "[utee] Could not open enclave '%s'\n", filename);
+        return -1;
+    }
+    fclose(f);
+
+    // if enclave is not running, start it, preferably by the fork server
+    if(utee_enclave_connect(filename) && utee_enclave_spawn(filename)) {
+        int zygote = getenv(UTEE_ZYGOTE_ENV) != NULL;
+        int daemon = zygote || getenv(UTEE_DAEMON_ENV) != NULL;
+        pid_t pid = fork();
+        assert(pid != -1 && "Fork failed");
+        if(pid == 0) {
+            if(!daemon) prctl(PR_SET_PDEATHSIG, SIGHUP);
+            char* argv[] = { (char*)filename, daemon ? (char*)(zygote ? UTEE_ZYGOTE_ARG : UTEE_DAEMON_ARG) : NULL, NULL };
+            execv(argv[0], argv);
+            fprintf(stderr, "[utee] Failed to start enclave\n");
+            _exit(1);
+        }
+        if(daemon) {
+            // the daemon detaches from this process
+            waitpid(pid, NULL, 0);
+        }
+        // the new fork server starts the first instance on request
+        for(int i = 0; zygote && utee_enclave_spawn(filename) && i < UTEE_MAX_CONNECTION_RETRY; i++) {
+            usleep(UTEE_CONNECTION_RETRY_DELAY);
+        }
+    }
+    if(!self) {
+        int fail_ctr = 0;
+        while(utee_enclave_connect(filename)) {
+            if(++fail_ctr >= UTEE_MAX_CONNECTION_RETRY) {
+                fprintf(stderr, "[utee] Failed to connect to enclave\n");
+                return -1;
+            }
+            usleep(UTEE_CONNECTION_RETRY_DELAY);
+        }
+    }
+
+    if(utee_ocalls > 1) {
+        utee_start_ocall_handler();
+    }
+    return utee_enclave_pid;
+}
+
+
+// ---------------------------------------------------------------------------
+int utee_register_ecall(utee_call_t call) {
+    if(utee_ecalls < UTEE_MAX_ECALLS) {
+        ecall[utee_ecalls++] = call;
+        return utee_ecalls - 1;
+    } else {
+        fprintf(stderr, "[utee] Could not register ECALL: maximum number of ECALLs reached\n");
+        return -1;
+    }
+}
+
+// ---------------------------------------------------------------------------
+int utee_register_ecall_lane(utee_call_t call, int lane) {
+    if(!sched || lane < 0 || lane >= UTEE_LANES) {
+        fprintf(stderr, "[utee] Could not register ECALL: invalid lane or enclave not initialized\n");
+        return -1;
+    }
+    int id = utee_register_ecall(call);
+    if(id != -1) {
+        sched->ecall_lane[id] = lane;
+    }
+    return id;
+}
+
+// ---------------------------------------------------------------------------
+void utee_lane_policy(int policy) {
+    pthread_mutex_lock(&dispatch_lock);
+    lane_policy = policy;
+    pthread_mutex_unlock(&dispatch_lock);
+}
+
+// ---------------------------------------------------------------------------
+int utee_lane_config(int lane, int weight, int max_running) {
+    if(lane < 0 || lane >= UTEE_LANES) {
+        return 1;
+    }
+    pthread_mutex_lock(&dispatch_lock);
+    lane_weight[lane] = weight > 0 ? weight : 1;
+    lane_max_running[lane] = max_running > 0 ? max_running : 0;
+    pthread_mutex_unlock(&dispatch_lock);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+void utee_register_handoff(utee_handoff_save_t save, utee_handoff_restore_t restore) {
+    handoff_save = save;
+    handoff_restore = restore;
+}
+
+// ---------------------------------------------------------------------------
+void utee_register_idle(utee_idle_t idle) {
+    idle_work = idle;
+}
+
+// ---------------------------------------------------------------------------
+int utee_register_ocall(utee_call_t call) {
+    if(utee_ocalls < UTEE_MAX_OCALLS) {
+        ocall[utee_ocalls++] = call;
+        return utee_ocalls - 1;
+    } else {
+        fprintf(stderr, "[utee] Could not register OCALL: maximum number of OCALLs reached\n");
+        return -1;
+    }
+}
+
+// ---------------------------------------------------------------------------
+static int utee_ecall_claim(int block) {
+    // claim a free slot of the ECALL ring
+    if(block ? utee_wait_peer(&(self->ecall_ring->free), &(instance->enclave)) : sem_trywait(&(self->ecall_ring->free))) {
+        return -1;
+    }
+    for(int i = 0; ; i = (i + 1) % UTEE_ECALL_SLOTS) {
+        if(__sync_bool_compare_and_swap(&(self->ecall[i].state), UTEE_SLOT_FREE, UTEE_SLOT_CLAIMED)) {
+            return i;
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+static void utee_ecall_submit(int id, uint64_t call, const uint64_t* param, uint64_t len, int lane, uint32_t flags, int leader, uint64_t deadline) {
+    // the data is already in the slot
+    utee_slot_t* slot = &(self->ecall[id]);
+    for(int i = 0; i < 6; i++) {
+        slot->param[i] = param ? param[i] : 0;
+    }
+    slot->len = len;
+    slot->call = call;
+    slot->flags = flags;
+    slot->batch = leader;
+    slot->submitted = utee_stats_now();
+    slot->deadline = deadline;
+    __sync_synchronize();
+    slot->state = UTEE_SLOT_PENDING;
+    while(utee_lane_push(&(sched->lane[lane]), client_id, id)) {
+        sched_yield();
+    }
+}
+
+// ---------------------------------------------------------------------------
+static uint64_t utee_ecall_until(int ms) {
+    // absolute deadline of a call with a timeout, 0 for none
+    if(ms < 0) ms = ecall_timeout >= 0 ? ecall_timeout : ecall_default_timeout;
+    return ms > 0 ? utee_stats_now() + ms * 1000000ull : 0;
+}
+
+// ---------------------------------------------------------------------------
+static int utee_ecall_wait(int id, uint64_t deadline) {
+    // 0 if the result is available, 1 if the enclave is gone, 2 if the deadline passed
+    utee_slot_t* slot = &(self->ecall[id]);
+    if(!deadline) {
+        return utee_wait_peer(&(slot->results), &(instance->enclave));
+    }
+    for(uint64_t now = utee_stats_now(); now < deadline; now = utee_stats_now()) {
+        uint64_t left = (deadline - now + 999999) / 1000000;
+        if(!utee_timedwait(&(slot->results), left < UTEE_LIVENESS_INTERVAL ? left : UTEE_LIVENESS_INTERVAL)) return 0;
+        if(!utee_peer_alive(instance->enclave)) return 1;
+    }
+    // take the call back if it has not started yet, otherwise the enclave drops the result
+    if(__sync_bool_compare_and_swap(&(slot->state), UTEE_SLOT_PENDING, UTEE_SLOT_CLAIMED)) return 2;
+    if(__sync_bool_compare_and_swap(&(slot->state), UTEE_SLOT_RUNNING, UTEE_SLOT_CANCELLED)) return 2;
+    // the result arrived just in time
+    return utee_wait_peer(&(slot->results), &(instance->enclave));
+}
+
+// ---------------------------------------------------------------------------
+static void utee_ecall_free(int id) {
+    utee_slot_t* slot = &(self->ecall[id]);
+    // a cancelled call still runs, the enclave frees the slot when it returns
+    if(__sync_bool_compare_and_swap(&(slot->state), UTEE_SLOT_CANCELLED, UTEE_SLOT_ABANDONED)) {
+        return;
+    }
+    slot->state = UTEE_SLOT_FREE;
+    sem_post(&(self->ecall_ring->free));
+}
+
+// ---------------------------------------------------------------------------
+static uint64_t utee_ecall_finish(int id, utee_msg_t* msg) {
+    utee_slot_t* slot = &(self->ecall[id]);
+    memcpy(msg->data, slot->data, msg->len);
+    uint64_t result = slot->result;
+    utee_ecall_free(id);
+    return result;
+}
+
+// ---------------------------------------------------------------------------
+static uint64_t utee_ecall_failed(int id, int error) {
+    if(error == 2) {
+        fprintf(stderr, "[utee] ECALL failed: deadline exceeded\n");
+        utee_ecall_free(id);
+        errno = ETIMEDOUT;
+    } else {
+        fprintf(stderr, "[utee] ECALL failed: enclave is not running anymore\n");
+    }
+    return -1;
+}
+
+// ---------------------------------------------------------------------------
+static int utee_ecall_check(uint64_t call, uint64_t len, int* lane) {
+    assert(self && "Not connected to an enclave");
+    if(len > UTEE_MAX_DATA_SIZE) {
+        fprintf(stderr, "[utee] ECALL failed: data exceeds %zu bytes\n", UTEE_MAX_DATA_SIZE);
+        return 1;
+    }
+    if(*lane == UTEE_LANE_DEFAULT) {
+        *lane = call < UTEE_MAX_ECALLS ? sched->ecall_lane[call] : UTEE_LANE_NORMAL;
+    }
+    if(*lane < 0 || *lane >= UTEE_LANES) {
+        fprintf(stderr, "[utee] ECALL failed: lane %d does not exist\n", *lane);
+        return 1;
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+uint64_t utee_ecall_deadline(utee_msg_t* msg, int lane, int timeout) {
+    assert(msg && "ECALL message must not be NULL");
+    if(utee_ecall_check(msg->call, msg->len, &lane)) {
+        return -1;
+    }
+    uint64_t deadline = utee_ecall_until(timeout);
+    int id = utee_ecall_claim(1);
+    if(id == -1) {
+        fprintf(stderr, "[utee] ECALL failed: enclave is not running anymore\n");
+        return -1;
+    }
+    UTEE_TRACE_BEGIN("ecall", msg->call);
+    memcpy(self->ecall[id].data, msg->data, msg->len);
+    utee_ecall_submit(id, msg->call, msg->param, msg->len, lane, 0, id, deadline);
+    sem_post(&(sched->doorbell));
+    int error = utee_ecall_wait(id, deadline);
+    UTEE_TRACE_END("ecall", msg->call);
+    if(error) {
+        return utee_ecall_failed(id, error);
+    }
+    return utee_ecall_finish(id, msg);
+}
+
+// ---------------------------------------------------------------------------
+uint64_t utee_ecall_lane(utee_msg_t* msg, int lane) {
+    return utee_ecall_deadline(msg, lane, -1);
+}
+
+// ---------------------------------------------------------------------------
+uint64_t utee_ecall(utee_msg_t* msg) {
+    return utee_ecall_deadline(msg, UTEE_LANE_DEFAULT, -1);
+}
+
+// ---------------------------------------------------------------------------
+void utee_ecall_timeout(int ms) {
+    ecall_timeout = ms;
+}
+
+// ---------------------------------------------------------------------------
+int utee_ecall_batch(utee_msg_t** msgs, int n) {
+    int lane[UTEE_ECALL_SLOTS], id[UTEE_ECALL_SLOTS];
+    for(int done = 0; done < n; ) {
+        // as many calls as there are free slots, at least one
+        int count = 0;
+        while(count < UTEE_ECALL_SLOTS && done + count < n) {
+            lane[count] = UTEE_LANE_DEFAULT;
+            assert(msgs[done + count] && "ECALL message must not be NULL");
+            if(utee_ecall_check(msgs[done + count]->call, msgs[done + count]->len, &lane[count])) {
+                for(int i = 0; i < count; i++) {
+                    self->ecall[id[i]].state = UTEE_SLOT_FREE;
+                    sem_post(&(self->ecall_ring->free));
+                }
+                return 1;
+            }
+            id[count] = utee_ecall_claim(count == 0);
+            if(id[count] == -1) {
+                if(count) break;
+                fprintf(stderr, "[utee] ECALL failed: enclave is not running anymore\n");
+                return 1;
+            }
+            count++;
+        }
+
+        UTEE_TRACE_BEGIN("ecall batch", count);
+        utee_slot_t* leader = &(self->ecall[id[0]]);
+        leader->batch_left = count;
+        for(int i = 0; i < count; i++) {
+            utee_msg_t* msg = msgs[done + i];
+            memcpy(self->ecall[id[i]].data, msg->data, msg->len);
+            utee_ecall_submit(id[i], msg->call, msg->param, msg->len, lane[i], UTEE_CALL_BATCH, id[0], 0);
+        }
+        // one doorbell and one wakeup for the whole batch
+        sem_post(&(sched->doorbell));
+        if(utee_wait_peer(&(leader->results), &(instance->enclave))) {
+            UTEE_TRACE_END("ecall batch", count);
+            fprintf(stderr, "[utee] ECALL failed: enclave is not running anymore\n");
+            return 1;
+        }
+        UTEE_TRACE_END("ecall batch", count);
+        for(int i = 0; i < count; i++) {
+            msgs[done + i]->result = utee_ecall_finish(id[i], msgs[done + i]);
+        }
+        done += count;
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+void* utee_ecall_reserve(int* slot) {
+    assert(slot && "Slot must not be NULL");
+    assert(self && "Not connected to an enclave");
+    *slot = utee_ecall_claim(1);
+    if(*slot == -1) {
+        fprintf(stderr, "[utee] ECALL failed: enclave is not running anymore\n");
+        return NULL;
+    }
+    return self->ecall[*slot].data;
+}
+
+// ---------------------------------------------------------------------------
+uint64_t utee_ecall_commit(int slot, uint64_t call, const uint64_t* param, uint64_t len, int lane) {
+    assert(slot >= 0 && slot < UTEE_ECALL_SLOTS && "Invalid ECALL slot");
+    if(utee_ecall_check(call, len, &lane)) {
+        return -1;
+    }
+    uint64_t deadline = utee_ecall_until(-1);
+    UTEE_TRACE_BEGIN("ecall", call);
+    utee_ecall_submit(slot, call, param, len, lane, 0, slot, deadline);
+    sem_post(&(sched->doorbell));
+    int error = utee_ecall_wait(slot, deadline);
+    UTEE_TRACE_END("ecall", call);
+    if(error == 2) {
+        // the slot is released by utee_ecall_release()
+        fprintf(stderr, "[utee] ECALL failed: deadline exceeded\n");
+        errno = ETIMEDOUT;
+        return -1;
+    } else if(error) {
+        fprintf(stderr, "[utee] ECALL failed: enclave is not running anymore\n");
+        return -1;
+    }
+    return self->ecall[slot].result;
+}
+
+// ---------------------------------------------------------------------------
+int utee_ecall_completed(int slot) {
+    assert(slot >= 0 && slot < UTEE_ECALL_SLOTS && "Invalid ECALL slot");
+    return self->ecall[slot].state == UTEE_SLOT_DONE;
+}
+
+// ---------------------------------------------------------------------------
+void utee_ecall_release(int slot) {
+    assert(slot >= 0 && slot < UTEE_ECALL_SLOTS && "Invalid ECALL slot");
+    utee_ecall_free(slot);
+}
+
+// ---------------------------------------------------------------------------
+int utee_ecall_cancelled() {
+    utee_slot_t* slot = worker_slot;
+    if(!slot) {
+        return 0;
+    }
+    uint32_t state = slot->state;
+    return state == UTEE_SLOT_CANCELLED || state == UTEE_SLOT_ABANDONED || (slot->deadline && utee_stats_now() > slot->deadline);
+}
+
+// ---------------------------------------------------------------------------
+uint64_t* utee_stats_counter(const char* name) {
+    static pthread_mutex_t counter_lock = PTHREAD_MUTEX_INITIALIZER;
+    if(!stats) {
+        return NULL;
+    }
+    pthread_mutex_lock(&counter_lock);
+    uint32_t i = 0;
+    while(i < stats->counters && strncmp(stats->counter[i].name, name, UTEE_STATS_COUNTER_NAME - 1)) i++;
+    if(i == stats->counters && i < UTEE_STATS_COUNTERS) {
+        strncpy(stats->counter[i].name, name, UTEE_STATS_COUNTER_NAME - 1);
+        // readers only see the counter once its name is complete
+        __atomic_store_n(&(stats->counters), i + 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&counter_lock);
+    return i < UTEE_STATS_COUNTERS ? &(stats->counter[i].value) : NULL;
+}
+
+// ---------------------------------------------------------------------------
+static utee_slot_t* utee_ocall_submit(utee_msg_t* msg, uint32_t flags) {
+    assert(msg && "OCALL message must not be NULL");
+    assert(worker && "OCALLs can only be called from an ECALL");
+    int id = worker - channel;
+    if(msg->len > UTEE_MAX_DATA_SIZE) {
+        return NULL;
+    }
+
+    // claim a free slot of the ring
+    while(utee_timedwait(&(worker->ocall_ring->free), UTEE_LIVENESS_INTERVAL)) {
+        if(!utee_peer_alive(instance->client[id])) return NULL;
+    }
+    utee_slot_t* slot = NULL;
+    for(int i = 0; !slot; i = (i + 1) % UTEE_OCALL_SLOTS) {
+        if(__sync_bool_compare_and_swap(&(worker->ocall[i].state), UTEE_SLOT_FREE, UTEE_SLOT_CLAIMED)) {
+            slot = &(worker->ocall[i]);
+        }
+    }
+
+    memcpy(slot->data, msg->data, msg->len);
+    for(int i = 0; i < 6; i++) {
+        slot->param[i] = msg->param[i];
+    }
+    slot->len = msg->len;
+    slot->call = msg->call;
+    slot->flags = flags;
+    slot->submitted = utee_stats_now();
+    __sync_synchronize();
+    slot->state = UTEE_SLOT_PENDING;
+    sem_post(&(worker->ocall_ring->pending));
+    return slot;
+}
+
+// ---------------------------------------------------------------------------
+static void utee_ocall_release(utee_channel_t* chan, utee_slot_t* slot) {
+    slot->state = UTEE_SLOT_FREE;
+    sem_post(&(chan->ocall_ring->free));
+}
+
+// ---------------------------------------------------------------------------
+uint64_t utee_ocall(utee_msg_t* msg) {
+    UTEE_TRACE_BEGIN("ocall", msg->call);
+    utee_slot_t* slot = utee_ocall_submit(msg, 0);
+    if(!slot) {
+        UTEE_TRACE_END("ocall", msg->call);
+        return -1;
+    }
+    if(utee_wait_peer(&(slot->results), &(instance->client[worker - channel]))) {
+        UTEE_TRACE_END("ocall", msg->call);
+        return -1;
+    }
+    UTEE_TRACE_END("ocall", msg->call);
+    memcpy(msg->data, slot->data, msg->len);
+    uint64_t result = slot->result;
+    utee_ocall_release(worker, slot);
+    return result;
+}
+
+// ---------------------------------------------------------------------------
+int utee_ocall_async(utee_msg_t* msg) {
+    UTEE_TRACE_INSTANT("ocall async", msg->call);
+    return utee_ocall_submit(msg, UTEE_CALL_ASYNC) ? 0 : 1;
+}
+
+// ---------------------------------------------------------------------------
+static void* utee_signal_handler(void* handler) {
+    while(1) {
+        if(!self) {
+            usleep(UTEE_CONNECTION_RETRY_DELAY);
+            continue;
+        }
+        if(utee_timedwait(&(self->signal->calls), UTEE_LIVENESS_INTERVAL)) {
+            continue;
+        }
+        UTEE_TRACE_BEGIN("signal handler", self->signal->call);
+        self->signal->result = ((utee_signal_handler_t)handler)(self->signal->call, (void*)(self->signal->param[0]));
+        UTEE_TRACE_END("signal handler", self->signal->call);
+        sem_post(&(self->signal->results));
+    }
+}
+
+// ---------------------------------------------------------------------------
+void utee_register_signal_handler(utee_signal_handler_t handler) {
+    assert(!utee_thread_start(utee_signal_handler, (void*)handler, 0) && "Could not start signal handler");
+    has_signal_handler = 1;
+    if(self) {
+        instance->signals[client_id] = 1;
+    }
+}
+
+
+// ---------------------------------------------------------------------------
+static void* utee_ocall_handler(void* handler) {
+    UNUSED(handler);
+    while(1) {
+        if(!self) {
+            usleep(UTEE_CONNECTION_RETRY_DELAY);
+            continue;
+        }
+        if(utee_timedwait(&(self->ocall_ring->pending), UTEE_LIVENESS_INTERVAL)) {
+            continue;
+        }
+        // take one pending OCALL, the doorbell guarantees that there is one
+        utee_slot_t* slot = NULL;
+        for(int i = 0; !slot; i = (i + 1) % UTEE_OCALL_SLOTS) {
+            if(__sync_bool_compare_and_swap(&(self->ocall[i].state), UTEE_SLOT_PENDING, UTEE_SLOT_RUNNING)) {
+                slot = &(self->ocall[i]);
+            }
+        }
+        UTEE_TRACE_BEGIN("ocall handler", slot->call);
+        if(slot->call < utee_ocalls) {
+            slot->result = ocall[slot->call](slot->param[0], slot->param[1], slot->param[2], slot->param[3], slot->param[4], slot->param[5], slot->len, slot->data);
+        }
+        UTEE_TRACE_END("ocall handler", slot->call);
+        if(slot->flags & UTEE_CALL_ASYNC) {
+            utee_ocall_release(self, slot);
+        } else {
+            slot->state = UTEE_SLOT_DONE;
+            sem_post(&(slot->results));
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+void utee_start_ocall_handler() {
+    const char* env = getenv(UTEE_OCALL_THREADS_ENV);
+    int threads = env ? atoi(env) : UTEE_OCALL_THREADS;
+    for(int i = 0; i < (threads > 0 ? threads : 1); i++) {
+        assert(!utee_thread_start(utee_ocall_handler, NULL, 0) && "Could not start OCALL handler");
+    }
+}
+
+// ---------------------------------------------------------------------------
+int utee_enclave_affinity(const char* cpus) {
+    return utee_affinity_apply(cpus, 1);
+}
+
+// ---------------------------------------------------------------------------
+int utee_client_affinity(const char* cpus) {
+    return utee_affinity_apply(cpus, 0);
+}
+
+
+// ---------------------------------------------------------------------------
+// Arena
+// ---------------------------------------------------------------------------
+
+/** Free objects cached by this thread, per class, valid for cache_arena only */
+static __thread utee_arena_t* cache_arena;
+static __thread uint64_t arena_cache[UTEE_ARENA_CLASSES][UTEE_ARENA_CACHE];
+static __thread int arena_cached[UTEE_ARENA_CLASSES];
+
+// ---------------------------------------------------------------------------
+static inline uint64_t* utee_arena_next(uint64_t offset) {
+    return (uint64_t*)((char*)arena + offset);
+}
+
+// ---------------------------------------------------------------------------
+static void utee_arena_push(int cls, uint64_t first, uint64_t last) {
+    // push a chain of objects from first to last to the free list of the class
+    volatile uint64_t* head = &(arena->free[cls].head);
+    uint64_t old, next;
+    do {
+        old = *head;
+        *utee_arena_next(last) = old & UTEE_ARENA_OFFSET_MASK;
+        next = (((old >> UTEE_ARENA_OFFSET_BITS) + 1) << UTEE_ARENA_OFFSET_BITS) | first;
+    } while(!__sync_bool_compare_and_swap(head, old, next));
+}
+
+// ---------------------------------------------------------------------------
+static uint64_t utee_arena_pop(int cls) {
+    volatile uint64_t* head = &(arena->free[cls].head);
+    uint64_t old, offset, next, object = UTEE_ARENA_MIN_OBJECT << cls;
+    do {
+        old = *head;
+        offset = old & UTEE_ARENA_OFFSET_MASK;
+        if(!offset) {
+            return 0;
+        }
+        // the free lists are in shared memory, an object outside of the arena is never used
+        if(offset < UTEE_ARENA_SLAB || offset > arena_size - object || offset % object) {
+            fprintf(stderr, "[utee] Corrupted arena free list\n");
+            return 0;
+        }
+        // the tag changes with every update, a stale next pointer fails the swap
+        next = (((old >> UTEE_ARENA_OFFSET_BITS) + 1) << UTEE_ARENA_OFFSET_BITS) | (*(volatile uint64_t*)utee_arena_next(offset) & UTEE_ARENA_OFFSET_MASK);
+    } while(!__sync_bool_compare_and_swap(head, old, next));
+    return offset;
+}
+
+// ---------------------------------------------------------------------------
+static void utee_arena_refill(int cls) {
+    // take half a cache from the free list first
+    while(arena_cached[cls] < UTEE_ARENA_CACHE / 2) {
+        uint64_t offset = utee_arena_pop(cls);
+        if(!offset) break;
+        arena_cache[cls][arena_cached[cls]++] = offset;
+    }
+    if(arena_cached[cls]) {
+        return;
+    }
+    // carve a new slab, keep some objects and publish the rest
+    uint64_t slab = __sync_fetch_and_add(&(arena->next_slab), 1);
+    if(slab >= arena_size / UTEE_ARENA_SLAB) {
+        return;
+    }
+    arena->slab_class[slab] = cls + 1;
+    uint64_t object = UTEE_ARENA_MIN_OBJECT << cls, base = slab * UTEE_ARENA_SLAB;
+    uint64_t count = UTEE_ARENA_SLAB / object, i;
+    for(i = 0; i < count && i < UTEE_ARENA_CACHE / 2; i++) {
+        arena_cache[cls][arena_cached[cls]++] = base + (count - 1 - i) * object;
+    }
+    if(i < count) {
+        uint64_t last = base + (count - 1 - i) * object;
+        for(uint64_t o = base; o < last; o += object) {
+            *utee_arena_next(o) = o + object;
+        }
+        utee_arena_push(cls, base, last);
+    }
+}
+
+// ---------------------------------------------------------------------------
+static inline void utee_arena_check_cache() {
+    if(cache_arena != arena) {
+        // mapped a new arena, e.g., after reconnecting
+        memset(arena_cached, 0, sizeof(arena_cached));
+        cache_arena = arena;
+    }
+}
+
+// ---------------------------------------------------------------------------
+void* utee_arena_alloc(size_t size) {
+    if(!arena || size > UTEE_ARENA_SLAB) {
+        return NULL;
+    }
+    int cls = 0;
+    while(((size_t)UTEE_ARENA_MIN_OBJECT << cls) < size) cls++;
+    utee_arena_check_cache();
+    if(!arena_cached[cls]) {
+        utee_arena_refill(cls);
+        if(!arena_cached[cls]) {
+            return NULL;
+        }
+    }
+    return (char*)arena + arena_cache[cls][--arena_cached[cls]];
+}
+
+// ---------------------------------------------------------------------------
+void utee_arena_free(void* ptr) {
+    if(!ptr) {
+        return;
+    }
+    uint64_t offset = utee_arena_offset(ptr);
+    uint64_t slab = offset / UTEE_ARENA_SLAB;
+    // the class is read once and checked, as every client can write it
+    int cls = (slab && slab < arena_size / UTEE_ARENA_SLAB) ? arena->slab_class[slab] - 1 : -1;
+    if(cls < 0 || cls >= UTEE_ARENA_CLASSES || offset % (UTEE_ARENA_MIN_OBJECT << cls)) {
+        fprintf(stderr, "[utee] Invalid arena object %p\n", ptr);
+        return;
+    }
+    utee_arena_check_cache();
+    if(arena_cached[cls] == UTEE_ARENA_CACHE) {
+        // return the older half of the cache to the arena
+        for(int i = 0; i < UTEE_ARENA_CACHE / 2 - 1; i++) {
+            *utee_arena_next(arena_cache[cls][i]) = arena_cache[cls][i + 1];
+        }
+        utee_arena_push(cls, arena_cache[cls][0], arena_cache[cls][UTEE_ARENA_CACHE / 2 - 1]);
+        memmove(arena_cache[cls], arena_cache[cls] + UTEE_ARENA_CACHE / 2, sizeof(arena_cache[cls]) / 2);
+        arena_cached[cls] = UTEE_ARENA_CACHE / 2;
+    }
+    arena_cache[cls][arena_cached[cls]++] = offset;
+}
+
+// ---------------------------------------------------------------------------
+uint64_t utee_arena_offset(const void* ptr) {
+    if(!ptr) {
+        return 0;
+    }
+    assert(arena && "Arena not mapped");
+    return (uint64_t)((const char*)ptr - (const char*)arena);
+}
+
+// ---------------------------------------------------------------------------
+void* utee_arena_ptr(uint64_t offset) {
+    if(!arena || offset < UTEE_ARENA_SLAB || offset >= arena_size) {
+        return NULL;
+    }
+    return (char*)arena + offset;
+}
+
+// ---------------------------------------------------------------------------
+size_t utee_arena_size() {
+    return arena ? arena_size : 0;
+}
+
+
+// ---------------------------------------------------------------------------
+// Tracing
+// ---------------------------------------------------------------------------
+
+/** Trace event, timestamped with the TSC */
+typedef struct {
+    uint64_t tsc;
+    uint64_t arg;
+    const char* name;
+    char phase;
+} utee_trace_event_t;
+
+/** Per-thread ring buffer of trace events */
+typedef struct {
+    pid_t tid;
+    uint64_t head;
+    utee_trace_event_t event[UTEE_TRACE_EVENTS];
+} utee_trace_ring_t;
+
+int utee_trace_enabled;
+static char trace_file[256];
+static utee_trace_ring_t* trace_rings[UTEE_TRACE_MAX_THREADS];
+static unsigned int trace_threads;
+static __thread utee_trace_ring_t* trace_ring;
+static uint64_t trace_tsc0, trace_ns0;
+
+// ---------------------------------------------------------------------------
+static inline uint64_t utee_trace_tsc() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return utee_stats_now();
+#endif
+}
+
+// ---------------------------------------------------------------------------
+__attribute__((constructor)) static void utee_trace_init() {
+    const char* file = getenv(UTEE_TRACE_ENV);
+    if(!file || !*file) {
+        return;
+    }
+    strncpy(trace_file, file, sizeof(trace_file) - 1);
+    trace_tsc0 = utee_trace_tsc();
+    trace_ns0 = utee_stats_now();
+    utee_trace_enabled = 1;
+    atexit(utee_trace_dump);
+}
+
+// ---------------------------------------------------------------------------
+void utee_trace_event(const char* name, char phase, uint64_t arg) {
+    utee_trace_ring_t* ring = trace_ring;
+    if(!ring) {
+        unsigned int idx = __sync_fetch_and_add(&trace_threads, 1);
+        if(idx >= UTEE_TRACE_MAX_THREADS) {
+            return;
+        }
+        ring = (utee_trace_ring_t*)calloc(1, sizeof(utee_trace_ring_t));
+        if(!ring) {
+            return;
+        }
+        ring->tid = gettid();
+        trace_rings[idx] = ring;
+        trace_ring = ring;
+    }
+    utee_trace_event_t* ev = &(ring->event[ring->head++ % UTEE_TRACE_EVENTS]);
+    ev->tsc = utee_trace_tsc();
+    ev->arg = arg;
+    ev->name = name;
+    ev->phase = phase;
+}
+
+// ---------------------------------------------------------------------------
+void utee_trace_dump() {
+    if(!utee_trace_enabled) {
+        return;
+    }
+    utee_trace_enabled = 0;
+
+    // the first process of a run starts the JSON array, the others append
+    int fd = open(trace_file, O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0644);
+    if(fd != -1) {
+        if(write(fd, "[\n", 2) != 2) {
+            close(fd);
+            return;
+        }
+    } else {
+        fd = open(trace_file, O_WRONLY | O_APPEND);
+    }
+    if(fd == -1) {
+        fprintf(stderr, "[utee] Could not write trace to '%s'\n", trace_file);
+        return;
+    }
+
+    // convert TSC to the monotonic clock, so the traces of all processes align
+    double ns_per_tick = 1.0;
+    uint64_t tsc1 = utee_trace_tsc(), ns1 = utee_stats_now();
+    if(tsc1 > trace_tsc0) {
+        ns_per_tick = (double)(ns1 - trace_ns0) / (tsc1 - trace_tsc0);
+    }
+
+    char buffer[65536];
+    size_t len = 0;
+    pid_t pid = getpid();
+    len += snprintf(buffer, sizeof(buffer), "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s\"}},\n", pid, program_invocation_short_name);
+    unsigned int threads = trace_threads < UTEE_TRACE_MAX_THREADS ? trace_threads : UTEE_TRACE_MAX_THREADS;
+    for(unsigned int t = 0; t < threads; t++) {
+        utee_trace_ring_t* ring = trace_rings[t];
+        if(!ring) continue;
+        uint64_t first = ring->head > UTEE_TRACE_EVENTS ? ring->head - UTEE_TRACE_EVENTS : 0;
+        for(uint64_t i = first; i < ring->head; i++) {
+            utee_trace_event_t* ev = &(ring->event[i % UTEE_TRACE_EVENTS]);
+            double us = (trace_ns0 + ((int64_t)(ev->tsc - trace_tsc0)) * ns_per_tick) / 1000.0;
+            len += snprintf(buffer + len, sizeof(buffer) - len,
+                "{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d,%s\"args\":{\"id\":%lu}},\n",
+                ev->name, ev->phase, us, pid, ring->tid, ev->phase == 'i' ? "\"s\":\"t\"," : "", (unsigned long)ev->arg);
+            if(len > sizeof(buffer) - 512) {
+                if(write(fd, buffer, len) != (ssize_t)len) break;
+                len = 0;
+            }
+        }
+    }
+    if(len && write(fd, buffer, len) != (ssize_t)len) {
+        fprintf(stderr, "[utee] Could not write trace to '%s'\n", trace_file);
+    }
+    close(fd);
 }
@@ -12,7 +12,69 @@
 /** Maximum size for enclave name */
 #define UTEE_MAX_ENCLAVE_NAME 128
 /** Maximum number of connection retries */
-#define UTEE_MAX_CONNECTION_RETRY 100
+#define UTEE_MAX_CONNECTION_RETRY 1000
+/** Delay between two connection retries in microseconds */
+#define UTEE_CONNECTION_RETRY_DELAY 10000
+/** Maximum number of clients connected to one enclave at the same time */
+#define UTEE_MAX_CLIENTS 16
+/** Maximum number of instances of one enclave running at the same time */
+#define UTEE_MAX_INSTANCES 16
+/** Interval in milliseconds in which channels are checked for dead peers */
+#define UTEE_LIVENESS_INTERVAL 200
+/** Number of slots of the OCALL ring of a client, i.e., OCALLs in flight */
+#define UTEE_OCALL_SLOTS 8
+/** Default number of OCALL handler threads of a client */
+#define UTEE_OCALL_THREADS 4
+/** Environment variable overriding the number of OCALL handler threads */
+#define UTEE_OCALL_THREADS_ENV "UTEE_OCALL_THREADS"
+/** Number of slots of the ECALL ring of a client, i.e., ECALLs in flight */
+#define UTEE_ECALL_SLOTS 8
+/** Number of enclave worker threads, shared by all clients of an instance */
+#define UTEE_WORKERS UTEE_MAX_CLIENTS
+/** Environment variable overriding the number of enclave worker threads */
+#define UTEE_WORKERS_ENV "UTEE_WORKERS"
+/** Number of priority lanes of an enclave */
+#define UTEE_LANES 3
+/** Lane for latency-sensitive ECALLs, e.g., verification or health checks */
+#define UTEE_LANE_HIGH 0
+/** Lane of ECALLs registered without a lane */
+#define UTEE_LANE_NORMAL 1
+/** Lane for long-running bulk ECALLs, e.g., signing */
+#define UTEE_LANE_BULK 2
+/** Use the lane the ECALL was registered with */
+#define UTEE_LANE_DEFAULT -1
+/** Scheduling policy: always serve the highest-priority lane with pending ECALLs first */
+#define UTEE_SCHED_STRICT 0
+/** Scheduling policy: serve the lanes round robin, proportional to their weights */
+#define UTEE_SCHED_WEIGHTED 1
+/** Environment variable with the CPUs of the enclave threads, e.g., "0-3,8" */
+#define UTEE_ENCLAVE_CPUS_ENV "UTEE_ENCLAVE_CPUS"
+/** Environment variable with the CPUs of the helper threads of a client */
+#define UTEE_CLIENT_CPUS_ENV "UTEE_CLIENT_CPUS"
+/** Environment variable with the NUMA node of the shared memory created by the enclave */
+#define UTEE_NUMA_NODE_ENV "UTEE_NUMA_NODE"
+/** Size of a cache line, shared fields written by different sides are separated by this */
+#define UTEE_CACHE_LINE 64
+/** Size of a huge page */
+#define UTEE_HUGEPAGE_SIZE (2ul << 20)
+/** Environment variable that makes the enclave back its channels with huge pages */
+#define UTEE_HUGEPAGES_ENV "UTEE_HUGEPAGES"
+/** Command-line argument that starts an enclave in daemon mode */
+#define UTEE_DAEMON_ARG "--daemon"
+/** Environment variable that makes utee_enclave_load() start enclaves as daemon */
+#define UTEE_DAEMON_ENV "UTEE_DAEMON"
+/** Command-line argument that starts an enclave as fork server */
+#define UTEE_ZYGOTE_ARG "--zygote"
+/** Command-line argument that starts an enclave taking over a running instance (hot restart) */
+#define UTEE_RESTART_ARG "--restart"
+/** Environment variable that makes utee_enclave_load() start a fork server instead of a single instance */
+#define UTEE_ZYGOTE_ENV "UTEE_ZYGOTE"
+/** Environment variable with the default timeout of ECALLs in milliseconds, 0 or unset to wait forever */
+#define UTEE_ECALL_TIMEOUT_ENV "UTEE_ECALL_TIMEOUT"
+/** Environment variable selecting the instance id of an enclave */
+#define UTEE_INSTANCE_ENV "UTEE_INSTANCE"
+/** Maximum size of the state handed over in a hot restart */
+#define UTEE_HANDOFF_SIZE (64ul << 10)
 
 
 /** UTEE message format for ECALL and OCALL */
@@ -33,10 +95,19 @@ typedef struct {
     char data[];
 } utee_msg_t;
 
+/** Maximum length of the additional data of an ECALL/OCALL */
+#define UTEE_MAX_DATA_SIZE (UTEE_MAX_MESSAGE_SIZE - sizeof(utee_msg_t))
+
 /** Function pointer for an ECALL/OCALL callback */
 typedef uint64_t (*utee_call_t)(uint64_t,uint64_t,uint64_t,uint64_t,uint64_t,uint64_t,uint64_t,void*);
 /** Function pointer for a signal-handler callback */
 typedef int (*utee_signal_handler_t)(int, void*);
+/** Function pointer that saves the state of an enclave for its successor, returns the length (0 for none) */
+typedef size_t (*utee_handoff_save_t)(void* buffer, size_t size);
+/** Function pointer that restores the state saved by the predecessor of an enclave */
+typedef void (*utee_handoff_restore_t)(const void* state, size_t len);
+/** Function pointer for background work of an enclave, does one step and returns 1, or 0 if there is nothing to do */
+typedef int (*utee_idle_t)();
 
 /** Macro to suppress warnings for unused function parameters */
 #define UNUSED(x) (void)(x)
@@ -61,12 +132,94 @@ typedef int (*utee_signal_handler_t)(int, void*);
  */
 int utee_enclave_init(const char* name);
 
+/**
+ * Initialize an enclave that takes over a running instance (hot restart)
+ * 
+ * Used instead of utee_enclave_init(), e.g., to upgrade an enclave without
+ * disconnecting its clients. The new enclave attaches to the shared memory
+ * of the instance selected by UTEE_INSTANCE, or of the first running one.
+ * In utee_enclave_start(), it asks the running enclave to hand over: the 
+ * running enclave stops dispatching ECALLs, waits for the running ones, 
+ * saves its state (see utee_register_handoff()), and returns from its 
+ * utee_enclave_start() without removing the shared memory. The new enclave
+ * restores the state and continues with the ECALLs queued in the meantime.
+ * The layout of the shared memory has to be the same for both enclaves.
+ * 
+ * @param name Unique name of the UTEE enclave, should be the file name
+ * @return 0 on success, 1 if there is no compatible instance to take over
+ */
+int utee_enclave_restart(const char* name);
+
+/**
+ * Register the state handed over in a hot restart
+ * 
+ * The save function is called by a running enclave when a successor takes
+ * over, with a private buffer of UTEE_HANDOFF_SIZE bytes. The state is sent
+ * to the successor over a local socket, which both enclaves only accept if
+ * the kernel reports the other one as peer, so it never passes through
+ * memory that clients can access. The restore function is called by the
+ * successor with the saved state before it accepts ECALLs. Both enclaves
+ * should register the same functions.
+ * 
+ * @param save Function saving the state, NULL if there is none
+ * @param restore Function restoring the state, NULL if there is none
+ */
+void utee_register_handoff(utee_handoff_save_t save, utee_handoff_restore_t restore);
+
+/**
+ * Register background work of the enclave
+ * 
+ * The function is called by enclave threads that find no pending ECALL,
+ * before they wait for the next one. It should only do a short step of 
+ * work per call, as a new ECALL is dispatched only after the step. As long
+ * as it returns 1, it is called again when there are still no ECALLs. It 
+ * may be called by several threads at the same time.
+ * 
+ * @param idle Function doing one step of background work, NULL for none
+ */
+void utee_register_idle(utee_idle_t idle);
+
+/**
+ * Detach the enclave into daemon mode
+ * 
+ * Forks the enclave into the background, starts a new session, and detaches
+ * it from the terminal. A daemon enclave is not bound to the lifetime of the
+ * application that started it, it stays resident and serves any number of 
+ * subsequent clients. Has to be called before utee_enclave_init().
+ * 
+ * @return 0 on success (in the daemon process), 1 otherwise
+ */
+int utee_enclave_daemon();
+
+/**
+ * Turn the enclave into a fork server
+ * 
+ * The process stays resident as fork server (zygote) of the enclave and 
+ * forks a new instance whenever a client requests one via 
+ * utee_enclave_spawn() or utee_enclave_load(). Everything the enclave 
+ * prepared before calling this function, e.g., parsed keys, is inherited 
+ * by the instances, so they are ready immediately. Every instance creates
+ * its own channels in utee_enclave_init(). Has to be called before 
+ * utee_enclave_init(), usually after utee_enclave_daemon().
+ * 
+ * @param name Unique name of the UTEE enclave, should be the file name
+ * @return 0 in a new instance, 1 if the fork server could not be started; 
+ *         the fork server itself exits when it is terminated
+ */
+int utee_enclave_zygote(const char* name);
+
 /**
  * Start the enclave
  * 
  * Starts the event-handling loop of the enclave. This function does not
  * return as long as the enclave is running. After this function is called, 
- * the enclave can be used by other applications.
+ * the enclave can be used by other applications. Every connected client
+ * has its own set of channels. The ECALLs of all clients are queued in 
+ * priority lanes and served by a pool of UTEE_WORKERS enclave threads 
+ * (or UTEE_WORKERS from the environment) according to the scheduling 
+ * policy. Channels of clients that died are reclaimed automatically, also
+ * while the enclave is busy. The enclave runs until it gets a terminating
+ * signal (or hands over to a successor), clients cannot stop it.
  * 
  * @return 0 if the enclave exited, 1 if starting the enclave failed
  */
@@ -78,13 +231,53 @@ int utee_enclave_start();
  * Enclaves use this function to register an ECALL, i.e., a function that
  * is provided to other applications. Every ECALL has a unique number, 
  * 6 parameters (all 64-bit unsigned integers), and potential additional 
- * data (up to 4000 bytes). 
+ * data (up to UTEE_MAX_DATA_SIZE bytes). 
  * 
  * @param call Function to be registered as ECALL
  * @return The number of the ECALL (used for calling the ECALL)
  */
 int utee_register_ecall(utee_call_t call);
 
+/**
+ * Register an ECALL in a priority lane
+ * 
+ * Same as utee_register_ecall(), but calls of the ECALL are queued in the 
+ * given lane by default instead of UTEE_LANE_NORMAL. Has to be called after
+ * utee_enclave_init().
+ * 
+ * @param call Function to be registered as ECALL
+ * @param lane Default lane of the ECALL, e.g., UTEE_LANE_HIGH
+ * @return The number of the ECALL (used for calling the ECALL), -1 on error
+ */
+int utee_register_ecall_lane(utee_call_t call, int lane);
+
+/**
+ * Configure the scheduling of the priority lanes
+ * 
+ * Selects how the enclave threads pick the next ECALL. With UTEE_SCHED_STRICT
+ * (default), a lane is only served if all lanes with a higher priority are 
+ * empty. With UTEE_SCHED_WEIGHTED, every lane gets a share of the dispatched
+ * ECALLs proportional to its weight, so low-priority lanes cannot starve.
+ * 
+ * @param policy UTEE_SCHED_STRICT or UTEE_SCHED_WEIGHTED
+ */
+void utee_lane_policy(int policy);
+
+/**
+ * Configure a priority lane
+ * 
+ * Sets the weight of a lane for weighted scheduling, and limits the number
+ * of enclave threads that execute ECALLs of the lane at the same time. A 
+ * limit on the bulk lane keeps threads available for the other lanes, so 
+ * short ECALLs are not blocked behind long-running ones.
+ * 
+ * @param lane Lane to configure
+ * @param weight Weight of the lane for UTEE_SCHED_WEIGHTED, at least 1
+ * @param max_running Maximum number of concurrently executed ECALLs of the lane, 0 for no limit
+ * @return 0 on success, 1 if the lane does not exist
+ */
+int utee_lane_config(int lane, int weight, int max_running);
+
 /**
  * Call an OCALL
  * 
@@ -93,10 +286,64 @@ int utee_register_ecall(utee_call_t call);
  * are used for the OCALL.
  * 
  * @param msg OCALL message to send to application
- * @result The result of the OCALL
+ * @result The result of the OCALL, -1 if the data is too large or the application is gone
  */
 uint64_t utee_ocall(utee_msg_t* msg);
 
+/**
+ * Call an OCALL asynchronously
+ * 
+ * Queues an OCALL for the application and returns immediately without 
+ * waiting for the result (fire-and-forget), e.g., for logging or metrics.
+ * The message is copied, so it can be reused directly after the call.
+ * This function only blocks if all UTEE_OCALL_SLOTS slots are in use.
+ * 
+ * @param msg OCALL message to send to application
+ * @result 0 if the OCALL was queued, 1 if the data is too large or the application is gone
+ */
+int utee_ocall_async(utee_msg_t* msg);
+
+/**
+ * Pin the enclave threads to CPUs
+ * 
+ * Every enclave worker thread is pinned to one of the CPUs, round robin, 
+ * and the main thread may use all of them. The CPUs can also be given in 
+ * UTEE_ENCLAVE_CPUS. Unless UTEE_NUMA_NODE is set, the shared memory of the
+ * enclave is placed on the NUMA node of the first CPU, so this function 
+ * has to be called before utee_enclave_init() to affect the memory. It can
+ * be called again at any time, e.g., from an ECALL, to move the threads.
+ * 
+ * @param cpus List of CPUs, e.g., "0-3,8", NULL or "" to allow all CPUs
+ * @return 0 on success, 1 if the list is invalid
+ */
+int utee_enclave_affinity(const char* cpus);
+
+/**
+ * Check whether the current ECALL was cancelled
+ * 
+ * Returns 1 if the caller of the ECALL that is executed by the calling 
+ * thread gave up waiting for the result, or if the deadline of the call 
+ * passed. The result of such a call is dropped, so long-running ECALLs 
+ * should check this regularly, e.g., between the steps of a computation,
+ * and return early to free the enclave thread for other calls.
+ * 
+ * @return 1 if the result of the current ECALL is not needed anymore, 0 otherwise or outside of an ECALL
+ */
+int utee_ecall_cancelled();
+
+/**
+ * Publish a counter in the statistics of the enclave
+ * 
+ * Counters of the enclave functions, e.g., hits of a cache, are shown by
+ * uteestat next to the ECALL statistics. Requesting a counter that is 
+ * already published, e.g., by the predecessor of a hot restart, returns 
+ * the existing counter. Has to be called after utee_enclave_init().
+ * 
+ * @param name Name of the counter, at most UTEE_STATS_COUNTER_NAME - 1 characters
+ * @return The counter, to be updated with atomic operations, NULL if all UTEE_STATS_COUNTERS counters are used
+ */
+uint64_t* utee_stats_counter(const char* name);
+
 /**
  * Cleanup the enclave
  * 
@@ -118,20 +365,41 @@ void utee_cleanup();
  * 
  * Connect the ECALL/OCALL communication to a running enclave. 
  * Every application that wants to use the enclave has to connect to 
- * the runnig enclave using this function.
+ * the runnig enclave using this function. The application gets a 
+ * channel set of its own, which is released again on exit.
  * 
  * @param name Name of the UTEE enclave, usually the file name
  * @return 0 on success, 1 if it was not possible to connect to the enclave
  */
 int utee_enclave_connect(const char* name);
 
+/**
+ * Disconnect from the enclave
+ * 
+ * Releases the channel set of the application, so that it can be used 
+ * by other clients. Called automatically when the application exits.
+ */
+void utee_enclave_disconnect();
+
+/**
+ * Start a new instance of an enclave
+ * 
+ * Requests a new instance from the fork server of the enclave, e.g., to 
+ * scale out under load. The function does not wait for the instance, 
+ * utee_enclave_connect() attaches to it once it accepts clients.
+ * 
+ * @param name Name of the UTEE enclave, usually the file name
+ * @return 0 if the instance was requested, 1 if there is no fork server
+ */
+int utee_enclave_spawn(const char* name);
+
 /**
  * Register an OCALL
  * 
  * Applications use this function to register an OCALL, i.e., a function that
  * is provided to the enclave. Every OCALL has a unique number, 
  * 6 parameters (all 64-bit unsigned integers), and potential additional 
- * data (up to 4000 bytes). 
+ * data (up to UTEE_MAX_DATA_SIZE bytes). 
  * 
  * @param call Function to be registered as OCALL
  * @return The number of the OCALL (used for calling the OCALL)
@@ -146,26 +414,147 @@ int utee_register_ocall(utee_call_t call);
  * are used for the ECALL.
  * 
  * @param msg ECALL message to send to enclave
- * @result The result of the ECALL
+ * @result The result of the ECALL, -1 if the data is too large or the enclave is gone
  */
 uint64_t utee_ecall(utee_msg_t* msg);
 
+/**
+ * Call an ECALL in a priority lane
+ * 
+ * Same as utee_ecall(), but queues the ECALL in the given lane instead of 
+ * the lane the ECALL was registered with. ECALLs can be called concurrently
+ * from multiple threads of the application, up to UTEE_ECALL_SLOTS at a time.
+ * 
+ * @param msg ECALL message to send to enclave
+ * @param lane Lane of the call, e.g., UTEE_LANE_HIGH, or UTEE_LANE_DEFAULT
+ * @result The result of the ECALL, -1 if the data is too large or the enclave is gone
+ */
+uint64_t utee_ecall_lane(utee_msg_t* msg, int lane);
+
+/**
+ * Call an ECALL with a deadline
+ * 
+ * Same as utee_ecall_lane(), but waits at most the given time for the 
+ * result. If the ECALL has not started when the deadline passes, it is 
+ * withdrawn. Otherwise, it is cancelled: the ECALL can notice this with 
+ * utee_ecall_cancelled(), its result is dropped, and its slot is recycled 
+ * by the enclave when it returns. ECALLs whose deadline passed while they
+ * were queued are not started by the enclave at all.
+ * 
+ * @param msg ECALL message to send to enclave
+ * @param lane Lane of the call, e.g., UTEE_LANE_HIGH, or UTEE_LANE_DEFAULT
+ * @param timeout Timeout in milliseconds, 0 to wait forever, -1 for the timeout of the thread (see utee_ecall_timeout())
+ * @result The result of the ECALL, -1 if the data is too large, the enclave is gone, or the deadline passed (errno is ETIMEDOUT)
+ */
+uint64_t utee_ecall_deadline(utee_msg_t* msg, int lane, int timeout);
+
+/**
+ * Set the timeout of the ECALLs of the calling thread
+ * 
+ * Applies to utee_ecall(), utee_ecall_lane(), and the typed ECALL stubs 
+ * called by the thread, see utee_ecall_deadline(). Without a timeout of 
+ * the thread, the one of UTEE_ECALL_TIMEOUT is used. Batches of ECALLs 
+ * always wait for all results.
+ * 
+ * @param ms Timeout in milliseconds, 0 to wait forever, -1 for the default of the application
+ */
+void utee_ecall_timeout(int ms);
+
+/**
+ * Call multiple ECALLs at once
+ * 
+ * Writes the requests of up to UTEE_ECALL_SLOTS messages into the channel,
+ * rings the enclave once, and waits for all results with a single wakeup. 
+ * Larger batches are split. This amortizes the cost of waking up the other 
+ * side over all calls of the batch, e.g., for many small verifications. 
+ * Every ECALL is queued in the lane it was registered with. The result of
+ * each ECALL is stored in the result member of its message.
+ * 
+ * @param msgs ECALL messages to send to enclave
+ * @param n Number of messages
+ * @result 0 on success, 1 if the data of a message is too large or the enclave is gone
+ */
+int utee_ecall_batch(utee_msg_t** msgs, int n);
+
+/**
+ * Reserve an ECALL slot
+ * 
+ * Claims a slot of the ECALL ring and returns its data buffer in shared 
+ * memory. Arguments written to this buffer are seen by the enclave without 
+ * any further copy. The slot has to be submitted with utee_ecall_commit() 
+ * and released with utee_ecall_release(). Used by the typed ECALL stubs
+ * in utee_call.h.
+ * 
+ * @param slot Receives the number of the reserved slot
+ * @return Data buffer of the slot (UTEE_MAX_DATA_SIZE bytes), NULL if the enclave is gone
+ */
+void* utee_ecall_reserve(int* slot);
+
+/**
+ * Call an ECALL in a reserved slot
+ * 
+ * Calls the ECALL with the data already written to the slot. When the 
+ * function returns, the data buffer of the slot contains the data as left 
+ * by the ECALL, until the slot is released.
+ * 
+ * @param slot Slot reserved with utee_ecall_reserve()
+ * @param call ECALL to call
+ * @param param The 6 parameters of the ECALL, NULL for all 0
+ * @param len Length of the data in the slot
+ * @param lane Lane of the call, e.g., UTEE_LANE_HIGH, or UTEE_LANE_DEFAULT
+ * @result The result of the ECALL, -1 if the data is too large, the enclave is gone, or the timeout of the thread passed
+ */
+uint64_t utee_ecall_commit(int slot, uint64_t call, const uint64_t* param, uint64_t len, int lane);
+
+/**
+ * Check whether the ECALL in a reserved slot completed
+ * 
+ * @param slot Slot committed with utee_ecall_commit()
+ * @return 1 if the data buffer of the slot contains the data left by the ECALL, 0 if the call failed or was cancelled
+ */
+int utee_ecall_completed(int slot);
+
+/**
+ * Release a reserved ECALL slot
+ * 
+ * @param slot Slot reserved with utee_ecall_reserve()
+ */
+void utee_ecall_release(int slot);
+
 /**
  * Start the OCALL listener
  * 
  * If the applications provides at least one OCALL, the OCALL handler
  * has to be started using this function. The OCALL handler is started 
- * as a thread, so it does not block. The function returns immediately.
+ * as a pool of UTEE_OCALL_THREADS threads (or UTEE_OCALL_THREADS from the
+ * environment), so it does not block. The function returns immediately.
  */
 void utee_start_ocall_handler();
 
 
+/**
+ * Pin the helper threads of the application to CPUs
+ * 
+ * Pins the signal-handler and OCALL-handler threads started by UTEE to the 
+ * given CPUs, e.g., the CPUs close to the enclave. The threads of the 
+ * application itself are not changed. The CPUs can also be given in 
+ * UTEE_CLIENT_CPUS. Can be called at any time.
+ * 
+ * @param cpus List of CPUs, e.g., "0-3,8", NULL or "" to allow all CPUs
+ * @return 0 on success, 1 if the list is invalid
+ */
+int utee_client_affinity(const char* cpus);
+
+
 /**
  * Start an enclave and connect to the enclave
  * 
  * This wrapper function instantiates the enclaves, connects to it via
  * utee_enclave_connect(), and starts the OCALL handler via utee_start_ocall_handler() 
  * if the application has at least one OCALL registered. 
+ * If the enclave is already running (e.g., as daemon), the application attaches
+ * to the running instance instead. If the environment variable UTEE_DAEMON is 
+ * set, a newly started enclave is started in daemon mode.
  * 
  * @param filename File name of the enclave to load and start
  * @return -1 on failure, otherwise the process ID (PID) of the enclave
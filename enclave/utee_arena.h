@@ -0,0 +1,125 @@
+#ifndef _UTEE_ARENA_H_
+#define _UTEE_ARENA_H_
+#include <stdint.h>
+#include <stddef.h>
+
+/** Default size of the shared arena of an enclave instance in bytes */
+#define UTEE_ARENA_SIZE (16ul << 20)
+/** Environment variable overriding the size of the arena (in MB), read by the enclave */
+#define UTEE_ARENA_SIZE_ENV "UTEE_ARENA_SIZE"
+/** Size of a slab, i.e., the largest object that can be allocated in the arena */
+#define UTEE_ARENA_SLAB (64ul << 10)
+/** Size of the smallest object class */
+#define UTEE_ARENA_MIN_OBJECT 16
+/** Number of object classes, powers of two from UTEE_ARENA_MIN_OBJECT to UTEE_ARENA_SLAB */
+#define UTEE_ARENA_CLASSES 13
+/** Number of free objects per class kept in the cache of a thread */
+#define UTEE_ARENA_CACHE 32
+
+/**
+ * @defgroup ARENA Shared-memory arena
+ *
+ * Every enclave instance has an arena, a shared segment mapped by the
+ * enclave and all its clients. Objects in the arena can be allocated and
+ * freed by both sides, so requests (also pointer-linked ones) are built in
+ * place instead of being serialized into the data of a call. As the arena
+ * is mapped at different addresses, objects are referenced by their offset
+ * in ECALL parameters, and by offset_ptr inside other arena objects.
+ *
+ * The arena is a slab allocator with power-of-two object classes, lock-free
+ * free lists in the arena, and a per-thread cache of free objects per
+ * class. Objects cached by a process that dies are lost until the enclave
+ * instance is restarted. Every client can write the whole arena, so the
+ * size of the arena is read once when it is mapped, and offsets and object
+ * classes from the arena are checked before they are used. For the same
+ * reason, the enclave never keeps private data in the arena.
+ *
+ * @{
+ */
+
+/**
+ * Allocate an object in the arena
+ *
+ * Can be called by the enclave after utee_enclave_init() and by clients
+ * after connecting to the enclave.
+ *
+ * @param size Size of the object, at most UTEE_ARENA_SLAB bytes
+ * @return The object, NULL if the arena is exhausted or not mapped
+ */
+void* utee_arena_alloc(size_t size);
+
+/**
+ * Free an object of the arena
+ *
+ * Objects can be freed by any process, not only by the one that allocated it.
+ *
+ * @param ptr Object allocated with utee_arena_alloc(), or NULL
+ */
+void utee_arena_free(void* ptr);
+
+/**
+ * Get the offset of an arena object
+ *
+ * The offset identifies the object in all processes, e.g., to pass it as
+ * parameter of an ECALL.
+ *
+ * @param ptr Object in the arena, or NULL
+ * @return Offset of the object, 0 for NULL
+ */
+uint64_t utee_arena_offset(const void* ptr);
+
+/**
+ * Get an arena object by its offset
+ *
+ * @param offset Offset of the object, as returned by utee_arena_offset()
+ * @return The object in the mapping of this process, NULL if the offset is 0 or invalid
+ */
+void* utee_arena_ptr(uint64_t offset);
+
+/**
+ * Get the size of the arena
+ *
+ * @return Size of the arena in bytes, 0 if the arena is not mapped
+ */
+size_t utee_arena_size();
+
+/** @} */
+
+#ifdef __cplusplus
+namespace utee {
+
+/**
+ * Pointer that is valid in every process mapping the arena
+ *
+ * Stores the distance between the pointer itself and the object it points
+ * to, so it can be stored in arena objects, e.g., to build linked lists or
+ * trees that both client and enclave can follow. Both the offset_ptr and
+ * the object have to be in the arena (or both outside of shared memory).
+ */
+template<typename T>
+class offset_ptr {
+    /** Distance to the object, 1 for NULL (the object can never be at offset 1) */
+    intptr_t diff;
+
+    void set(const T* ptr) {
+        diff = ptr ? (intptr_t)ptr - (intptr_t)this : 1;
+    }
+
+public:
+    offset_ptr(const T* ptr = NULL) { set(ptr); }
+    offset_ptr(const offset_ptr& other) { set(other.get()); }
+    offset_ptr& operator=(const offset_ptr& other) { set(other.get()); return *this; }
+    offset_ptr& operator=(const T* ptr) { set(ptr); return *this; }
+
+    /** The object in the mapping of this process */
+    T* get() const { return diff == 1 ? NULL : (T*)((intptr_t)this + diff); }
+    T* operator->() const { return get(); }
+    T& operator*() const { return *get(); }
+    T& operator[](size_t i) const { return get()[i]; }
+    explicit operator bool() const { return diff != 1; }
+};
+
+} // namespace utee
+#endif
+
+#endif
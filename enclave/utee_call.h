@@ -0,0 +1,308 @@
+#ifndef _UTEE_CALL_H_
+#define _UTEE_CALL_H_
+#include <stdint.h>
+#include <string.h>
+#include <array>
+#include <utility>
+#include <type_traits>
+#include "utee.h"
+
+/**
+ * @defgroup TYPED Typed ECALLs and OCALLs
+ *
+ * ECALLs and OCALLs with a regular C++ signature instead of 6 parameters
+ * and a data blob. The wire layout is derived from the signature at compile
+ * time: integral and enum arguments passed by value are transferred in the
+ * parameters of the call (up to 6), all other arguments are placed in the
+ * data of the call, aligned to their natural alignment. Arguments passed by
+ * reference or pointer refer directly to the data in the shared channel,
+ * and non-const ones are copied back to the caller after the call. All
+ * argument types have to be trivially copyable, the return type has to be
+ * void, integral, or an enum.
+ *
+ * Enclave:
+ *     int ecall_verify(const trustlib_signed_data_t& data);
+ *     utee::register_ecall<ecall_verify>();
+ *
+ * Application:
+ *     utee::ecall_stub<int(const trustlib_signed_data_t&)> verify(TRUSTLIB_ECALL_VERIFY);
+ *     int valid = verify(data);
+ *
+ * @{
+ */
+
+namespace utee {
+
+namespace detail {
+
+/** Type that is transferred for an argument type */
+template<typename T> using storage_t = std::remove_cv_t<std::remove_pointer_t<std::remove_reference_t<T>>>;
+
+/** 1 if an argument is transferred in the parameters of the call */
+template<typename T> constexpr bool is_param = std::is_integral_v<T> || std::is_enum_v<T>;
+
+/** 1 if the callee can modify an argument, i.e., it has to be copied back */
+template<typename T> constexpr bool is_output = (std::is_lvalue_reference_v<T> || std::is_pointer_v<T>) && !std::is_const_v<std::remove_pointer_t<std::remove_reference_t<T>>>;
+
+/** Location of one argument: parameter index or offset in the data */
+struct location_t {
+    bool param;
+    size_t index;
+};
+
+/** Wire layout of an argument list, computed at compile time */
+template<typename... A>
+struct layout {
+    static constexpr std::array<location_t, sizeof...(A) + 1> compute() {
+        std::array<location_t, sizeof...(A) + 1> loc{};
+        constexpr bool param[] = { false, is_param<A>... };
+        constexpr size_t size[] = { 0, sizeof(storage_t<A>)... };
+        constexpr size_t align[] = { 1, alignof(storage_t<A>)... };
+        size_t params = 0, offset = 0;
+        for(size_t i = 1; i <= sizeof...(A); i++) {
+            if(param[i] && params < 6) {
+                loc[i] = { true, params++ };
+            } else {
+                offset = (offset + align[i] - 1) & ~(align[i] - 1);
+                loc[i] = { false, offset };
+                offset += size[i];
+            }
+        }
+        // the first entry holds the size of the data
+        loc[0] = { false, offset };
+        return loc;
+    }
+    static constexpr std::array<location_t, sizeof...(A) + 1> loc = compute();
+    /** Size of the data of a call */
+    static constexpr size_t size = loc[0].index;
+
+    static_assert((std::is_trivially_copyable_v<storage_t<A>> && ...), "Arguments of typed calls must be trivially copyable");
+    static_assert(size <= UTEE_MAX_DATA_SIZE, "Arguments of typed calls exceed UTEE_MAX_DATA_SIZE");
+};
+
+/** Signature of a call */
+template<typename F> struct signature;
+template<typename R, typename... A>
+struct signature<R(A...)> {
+    typedef R result;
+    typedef layout<A...> wire;
+
+    static_assert(std::is_void_v<R> || std::is_integral_v<R> || std::is_enum_v<R>, "Typed calls must return void, an integer, or an enum");
+};
+template<typename R, typename... A> struct signature<R(*)(A...)> : signature<R(A...)> {};
+
+// ---------------------------------------------------------------------------
+template<typename W, size_t I, typename T>
+inline void put(uint64_t* param, char* data, T&& arg) {
+    constexpr location_t loc = W::loc[I + 1];
+    typedef std::remove_reference_t<T> arg_t;
+    if constexpr(loc.param) {
+        param[loc.index] = (uint64_t)arg;
+    } else if constexpr(std::is_pointer_v<arg_t>) {
+        if(arg) memcpy(data + loc.index, arg, sizeof(*arg));
+        else memset(data + loc.index, 0, sizeof(*arg));
+    } else {
+        memcpy(data + loc.index, &arg, sizeof(arg));
+    }
+}
+
+// ---------------------------------------------------------------------------
+template<typename W, size_t I, typename A, typename T>
+inline void get(const char* data, T&& arg) {
+    // copy modified arguments back from the channel
+    constexpr location_t loc = W::loc[I + 1];
+    if constexpr(!loc.param && is_output<A>) {
+        if constexpr(std::is_pointer_v<A>) {
+            if(arg) memcpy(arg, data + loc.index, sizeof(*arg));
+        } else {
+            memcpy(&arg, data + loc.index, sizeof(arg));
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+template<typename W, size_t I, typename A>
+inline A arg(const uint64_t* param, char* data) {
+    constexpr location_t loc = W::loc[I + 1];
+    if constexpr(loc.param) {
+        return (A)param[loc.index];
+    } else if constexpr(std::is_pointer_v<A>) {
+        return reinterpret_cast<A>(data + loc.index);
+    } else if constexpr(std::is_reference_v<A>) {
+        return *reinterpret_cast<std::remove_reference_t<A>*>(data + loc.index);
+    } else {
+        storage_t<A> value;
+        memcpy(&value, data + loc.index, sizeof(value));
+        return value;
+    }
+}
+
+// ---------------------------------------------------------------------------
+template<auto F, typename R, typename... A, size_t... I>
+inline uint64_t invoke(const uint64_t* param, char* data, std::index_sequence<I...>) {
+    typedef layout<A...> W;
+    UNUSED(param);
+    UNUSED(data);
+    if constexpr(std::is_void_v<R>) {
+        F(arg<W, I, A>(param, data)...);
+        return 0;
+    } else {
+        return (uint64_t)F(arg<W, I, A>(param, data)...);
+    }
+}
+
+/** Entry point of a typed call, unpacks the arguments in place */
+template<auto F> struct thunk;
+template<typename R, typename... A, R (*F)(A...)>
+struct thunk<F> {
+    static uint64_t call(uint64_t p1, uint64_t p2, uint64_t p3, uint64_t p4, uint64_t p5, uint64_t p6, uint64_t len, void* data) {
+        if(len < layout<A...>::size) {
+            return -1;
+        }
+        const uint64_t param[6] = { p1, p2, p3, p4, p5, p6 };
+        return invoke<F, R, A...>(param, (char*)data, std::index_sequence_for<A...>{});
+    }
+};
+
+} // namespace detail
+
+/**
+ * Register a typed ECALL
+ *
+ * Registers a function with an arbitrary signature as ECALL. The wrapper
+ * that unpacks the arguments is generated at compile time, see utee_register_ecall().
+ *
+ * @tparam F Function to be registered as ECALL
+ * @return The number of the ECALL (used for calling the ECALL)
+ */
+template<auto F>
+int register_ecall() {
+    (void)sizeof(detail::signature<decltype(F)>);
+    return utee_register_ecall(detail::thunk<F>::call);
+}
+
+/**
+ * Register a typed ECALL in a priority lane
+ *
+ * @tparam F Function to be registered as ECALL
+ * @param lane Default lane of the ECALL, see utee_register_ecall_lane()
+ * @return The number of the ECALL (used for calling the ECALL), -1 on error
+ */
+template<auto F>
+int register_ecall(int lane) {
+    (void)sizeof(detail::signature<decltype(F)>);
+    return utee_register_ecall_lane(detail::thunk<F>::call, lane);
+}
+
+/**
+ * Register a typed OCALL
+ *
+ * @tparam F Function to be registered as OCALL
+ * @return The number of the OCALL (used for calling the OCALL)
+ */
+template<auto F>
+int register_ocall() {
+    (void)sizeof(detail::signature<decltype(F)>);
+    return utee_register_ocall(detail::thunk<F>::call);
+}
+
+/**
+ * Typed client stub of an ECALL
+ *
+ * Calling the stub writes the arguments directly into a slot of the
+ * channel, calls the ECALL, and copies non-const reference and pointer
+ * arguments back. The signature has to match the one of the registered
+ * function. If the call fails, e.g., because the timeout of the thread 
+ * passed (see utee_ecall_timeout()), the result is the conversion of -1
+ * and no argument is copied back.
+ *
+ * @tparam S Signature of the ECALL, e.g., int(const trustlib_signed_data_t&)
+ */
+template<typename S> class ecall_stub;
+template<typename R, typename... A>
+class ecall_stub<R(A...)> {
+    typedef detail::layout<A...> W;
+    uint64_t call;
+    int lane;
+
+    template<size_t... I>
+    uint64_t invoke(std::index_sequence<I...>, A... args) const {
+        int slot;
+        char* data = (char*)utee_ecall_reserve(&slot);
+        if(!data) {
+            return -1;
+        }
+        uint64_t param[6] = { 0 };
+        (detail::put<W, I>(param, data, args), ...);
+        uint64_t result = utee_ecall_commit(slot, call, param, W::size, lane);
+        if(utee_ecall_completed(slot)) {
+            (detail::get<W, I, A>(data, args), ...);
+        }
+        utee_ecall_release(slot);
+        return result;
+    }
+
+public:
+    /**
+     * @param call Number of the ECALL
+     * @param lane Lane of the calls, UTEE_LANE_DEFAULT for the lane the ECALL was registered with
+     */
+    ecall_stub(uint64_t call, int lane = UTEE_LANE_DEFAULT) : call(call), lane(lane) {
+        (void)sizeof(detail::signature<R(A...)>);
+    }
+
+    /** Call the ECALL */
+    R operator()(A... args) const {
+        uint64_t result = invoke(std::index_sequence_for<A...>{}, args...);
+        if constexpr(!std::is_void_v<R>) {
+            return (R)result;
+        }
+    }
+};
+
+/**
+ * Typed stub of an OCALL, used from an ECALL
+ *
+ * Same as ecall_stub, but calls an OCALL of the application via utee_ocall().
+ *
+ * @tparam S Signature of the OCALL
+ */
+template<typename S> class ocall_stub;
+template<typename R, typename... A>
+class ocall_stub<R(A...)> {
+    typedef detail::layout<A...> W;
+    uint64_t call;
+
+    template<size_t... I>
+    uint64_t invoke(std::index_sequence<I...>, A... args) const {
+        char buffer[UTEE_MAX_MESSAGE_SIZE];
+        utee_msg_t* msg = (utee_msg_t*)buffer;
+        memset(msg, 0, sizeof(utee_msg_t));
+        msg->call = call;
+        msg->len = W::size;
+        (detail::put<W, I>(msg->param, msg->data, args), ...);
+        uint64_t result = utee_ocall(msg);
+        (detail::get<W, I, A>(msg->data, args), ...);
+        return result;
+    }
+
+public:
+    /** @param call Number of the OCALL */
+    ocall_stub(uint64_t call) : call(call) {
+        (void)sizeof(detail::signature<R(A...)>);
+    }
+
+    /** Call the OCALL */
+    R operator()(A... args) const {
+        uint64_t result = invoke(std::index_sequence_for<A...>{}, args...);
+        if constexpr(!std::is_void_v<R>) {
+            return (R)result;
+        }
+    }
+};
+
+} // namespace utee
+
+/** @} */
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef _UTEE_STATS_H_
+#define _UTEE_STATS_H_
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "utee.h"
+
+/** Magic value of an initialized statistics segment */
+#define UTEE_STATS_MAGIC 0x7574656573746132ull
+/** Number of sub-buckets per power of two, as bits (8 sub-buckets, < 12.5% error) */
+#define UTEE_STATS_SUB_BITS 3
+/** Largest power of two that is tracked by the histograms (2^40 ns, ~18 minutes) */
+#define UTEE_STATS_MAX_EXP 40
+/** Number of buckets of a latency histogram */
+#define UTEE_STATS_BUCKETS ((UTEE_STATS_MAX_EXP - UTEE_STATS_SUB_BITS + 2) << UTEE_STATS_SUB_BITS)
+/** Maximum number of counters published by the enclave */
+#define UTEE_STATS_COUNTERS 16
+/** Maximum length of the name of a counter, including the terminating zero */
+#define UTEE_STATS_COUNTER_NAME 24
+
+/** Log-bucketed latency histogram (HDR-style), all values in nanoseconds */
+typedef struct {
+    /** Number of recorded values */
+    uint64_t count;
+    /** Sum of all recorded values */
+    uint64_t sum;
+    /** Largest recorded value */
+    uint64_t max;
+    /** Number of values per bucket */
+    uint64_t bucket[UTEE_STATS_BUCKETS];
+} utee_histogram_t;
+
+/** Statistics of one ECALL */
+typedef struct {
+    /** Number of completed calls */
+    uint64_t calls;
+    /** Time between submission by the client and start of the ECALL */
+    utee_histogram_t queue;
+    /** Execution time of the ECALL handler */
+    utee_histogram_t exec;
+    /** Time between submission by the client and completion of the ECALL */
+    utee_histogram_t total;
+} utee_ecall_stats_t;
+
+/** Counter published by the enclave, see utee_stats_counter() */
+typedef struct {
+    /** Name of the counter */
+    char name[UTEE_STATS_COUNTER_NAME];
+    /** Value of the counter */
+    uint64_t value;
+} utee_counter_t;
+
+/** Statistics segment of an enclave instance, named <name>.<instance>_stats */
+typedef struct {
+    /** UTEE_STATS_MAGIC once the segment is initialized */
+    uint64_t magic;
+    /** PID of the enclave */
+    pid_t enclave;
+    /** Number of registered ECALLs (including the reserved ECALL 0) */
+    uint32_t ecalls;
+    /** Number of calls to ECALLs that are not registered */
+    uint64_t invalid;
+    /** Number of ECALLs whose result was dropped because the caller stopped waiting */
+    uint64_t cancelled;
+    /** Per-ECALL statistics, indexed by ECALL number */
+    utee_ecall_stats_t ecall[UTEE_MAX_ECALLS];
+    /** Number of published counters */
+    uint32_t counters;
+    /** Counters of the enclave functions, e.g., cache hits */
+    utee_counter_t counter[UTEE_STATS_COUNTERS];
+} utee_stats_t;
+
+/**
+ * Current time
+ *
+ * @return Monotonic time in nanoseconds, comparable between processes
+ */
+static inline uint64_t utee_stats_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Histogram bucket of a value
+ *
+ * @param value The value in nanoseconds
+ * @return The index of the bucket containing the value
+ */
+static inline int utee_stats_bucket(uint64_t value) {
+    if(value < (1ull << UTEE_STATS_SUB_BITS)) return value;
+    int exp = 63 - __builtin_clzll(value);
+    if(exp > UTEE_STATS_MAX_EXP) return UTEE_STATS_BUCKETS - 1;
+    int sub = (value >> (exp - UTEE_STATS_SUB_BITS)) & ((1 << UTEE_STATS_SUB_BITS) - 1);
+    return ((exp - UTEE_STATS_SUB_BITS + 1) << UTEE_STATS_SUB_BITS) + sub;
+}
+
+/**
+ * Largest value of a histogram bucket
+ *
+ * @param bucket The index of the bucket
+ * @return The largest value in nanoseconds that is counted in this bucket
+ */
+static inline uint64_t utee_stats_value(int bucket) {
+    if(bucket < (1 << UTEE_STATS_SUB_BITS)) return bucket;
+    int exp = (bucket >> UTEE_STATS_SUB_BITS) + UTEE_STATS_SUB_BITS - 1;
+    uint64_t sub = bucket & ((1 << UTEE_STATS_SUB_BITS) - 1);
+    return (((1ull << UTEE_STATS_SUB_BITS) + sub + 1) << (exp - UTEE_STATS_SUB_BITS)) - 1;
+}
+
+/**
+ * Record a value in a histogram
+ *
+ * The histogram is updated lock-free, it can be updated by multiple threads
+ * and read by other processes at the same time.
+ *
+ * @param hist The histogram
+ * @param value The value in nanoseconds
+ */
+static inline void utee_stats_record(utee_histogram_t* hist, uint64_t value) {
+    __atomic_fetch_add(&(hist->bucket[utee_stats_bucket(value)]), 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(hist->sum), value, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&(hist->max), __ATOMIC_RELAXED);
+    while(value > max && !__atomic_compare_exchange_n(&(hist->max), &max, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    __atomic_fetch_add(&(hist->count), 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Percentile of a histogram
+ *
+ * @param hist The histogram
+ * @param percentile The percentile, e.g., 99.9
+ * @return The value in nanoseconds below which the given percentage of the values lies
+ */
+static inline uint64_t utee_stats_percentile(const utee_histogram_t* hist, double percentile) {
+    uint64_t count = __atomic_load_n(&(hist->count), __ATOMIC_ACQUIRE);
+    if(!count) return 0;
+    uint64_t rank = (uint64_t)(count * percentile / 100.0 + 0.5);
+    if(rank < 1) rank = 1;
+    uint64_t seen = 0;
+    for(int i = 0; i < UTEE_STATS_BUCKETS; i++) {
+        seen += hist->bucket[i];
+        if(seen >= rank) {
+            uint64_t value = utee_stats_value(i);
+            return value < hist->max ? value : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+#endif
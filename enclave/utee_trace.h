@@ -0,0 +1,45 @@
+#ifndef _UTEE_TRACE_H_
+#define _UTEE_TRACE_H_
+#include <stdint.h>
+
+/** Environment variable with the file the trace is written to, tracing is disabled if not set */
+#define UTEE_TRACE_ENV "UTEE_TRACE"
+/** Number of events per thread kept in the ring buffer */
+#define UTEE_TRACE_EVENTS 16384
+/** Maximum number of traced threads per process */
+#define UTEE_TRACE_MAX_THREADS 64
+
+/** 1 if tracing is enabled for this process */
+extern int utee_trace_enabled;
+
+/**
+ * Record a trace event
+ *
+ * Appends a TSC-timestamped event to the ring buffer of the calling thread.
+ * If the ring buffer is full, the oldest event is overwritten. Use the
+ * UTEE_TRACE_BEGIN/UTEE_TRACE_END macros instead of calling this directly.
+ *
+ * @param name Name of the event, must be a string literal
+ * @param phase 'B' for the begin of a duration, 'E' for its end, 'i' for an instant
+ * @param arg Argument of the event, e.g., the ECALL number
+ */
+void utee_trace_event(const char* name, char phase, uint64_t arg);
+
+/**
+ * Write the trace
+ *
+ * Appends all recorded events of this process as Chrome trace JSON to the
+ * file given in UTEE_TRACE. All processes of a run append to the same file,
+ * which can be opened in chrome://tracing or Perfetto. Called automatically
+ * when the process exits.
+ */
+void utee_trace_dump();
+
+/** Begin a traced duration, a single predictable branch if tracing is disabled */
+#define UTEE_TRACE_BEGIN(name, arg) do { if(__builtin_expect(utee_trace_enabled, 0)) utee_trace_event(name, 'B', arg); } while(0)
+/** End a traced duration */
+#define UTEE_TRACE_END(name, arg) do { if(__builtin_expect(utee_trace_enabled, 0)) utee_trace_event(name, 'E', arg); } while(0)
+/** Trace an instant event */
+#define UTEE_TRACE_INSTANT(name, arg) do { if(__builtin_expect(utee_trace_enabled, 0)) utee_trace_event(name, 'i', arg); } while(0)
+
+#endif
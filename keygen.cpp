@@ -0,0 +1,329 @@
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/random.h>
+#include "trustlib_keyring.h"
+#include "trustlib_wire.h"
+#include "framework.h"
+
+/** Public exponent of generated keys, a prime */
+#define KEYGEN_EXPONENT 65537
+/** Small primes below this bound are sieved out of the candidates */
+#define KEYGEN_SIEVE_BOUND 65536
+/** Number of odd candidates following a random start that are sieved at once */
+#define KEYGEN_WINDOW 16384
+/** Rounds of Miller-Rabin a prime has to pass */
+#define KEYGEN_ROUNDS 40
+/** Smallest supported key size in bits */
+#define KEYGEN_MIN_BITS 256
+/** Default key size in bits, the largest key usable with all message formats */
+#define KEYGEN_DEFAULT_BITS TRUSTLIB_LEGACY_BITS
+
+/** Small primes for the sieve */
+static uint32_t small_prime[KEYGEN_SIEVE_BOUND / 2];
+static int small_primes;
+
+/** Primes found so far, shared by the search threads */
+static pthread_mutex_t found_lock = PTHREAD_MUTEX_INITIALIZER;
+static trustlib_bn_t found[TRUSTLIB_MAX_PRIMES];
+static int found_count;
+static int wanted;
+/** Size of each prime, the sizes add up to the size of the key */
+static int prime_bits[TRUSTLIB_MAX_PRIMES];
+
+// ---------------------------------------------------------------------------
+static void sieve_small_primes() {
+    static uint8_t composite[KEYGEN_SIEVE_BOUND];
+    for(int i = 3; i < KEYGEN_SIEVE_BOUND; i += 2) {
+        if(composite[i]) continue;
+        small_prime[small_primes++] = i;
+        for(long j = (long)i * i; j < KEYGEN_SIEVE_BOUND; j += 2 * i) {
+            composite[j] = 1;
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+static int random_bn(trustlib_bn_t* r, int bits) {
+    uint8_t random[TRUSTLIB_BN_BITS / 8];
+    size_t len = (bits + 7) / 8;
+    if(getrandom(random, len, 0) != (ssize_t)len) {
+        return 1;
+    }
+    trustlib_bn_from_bytes(r, random, len);
+    for(int i = bits; i < (int)len * 8; i++) {
+        r->limb[i / 64] &= ~(1ull << (i % 64));
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+static int is_probable_prime(const trustlib_bn_t* n) {
+    // n - 1 = d * 2^s
+    trustlib_bn_t one, n1, d, n3, a, x;
+    trustlib_mont_t ctx;
+    if(trustlib_mont_init(&ctx, n)) {
+        return 0;
+    }
+    int bits = trustlib_bn_bits(n), s = 0;
+    trustlib_bn_set(&one, 1);
+    trustlib_bn_sub(&n1, n, &one);
+    d = n1;
+    while(!trustlib_bn_bit(&d, 0)) {
+        trustlib_bn_div_word(&d, &d, 2);
+        s++;
+    }
+    trustlib_bn_set(&x, 3);
+    trustlib_bn_sub(&n3, n, &x);
+    for(int round = 0; round < KEYGEN_ROUNDS; round++) {
+        // random base in [2, n - 2]
+        if(random_bn(&a, bits)) {
+            return 0;
+        }
+        trustlib_bn_mod(&a, &a, &n3);
+        trustlib_bn_add(&a, &a, &one);
+        trustlib_bn_add(&a, &a, &one);
+        trustlib_mont_exp_consttime(&ctx, &x, &a, &d, bits);
+        if(!trustlib_bn_cmp(&x, &one) || !trustlib_bn_cmp(&x, &n1)) {
+            continue;
+        }
+        int witness = 1;
+        for(int i = 1; i < s && witness; i++) {
+            trustlib_mont_mulmod(&ctx, &x, &x, &x);
+            witness = trustlib_bn_cmp(&x, &n1) != 0;
+        }
+        if(witness) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// ---------------------------------------------------------------------------
+static int search_prime(trustlib_bn_t* prime, int bits) {
+    // odd candidates start + 2j with the top three bits set, so the product of the primes has the full size
+    static __thread uint8_t composite[KEYGEN_WINDOW];
+    trustlib_bn_t start, step;
+    if(random_bn(&start, bits)) {
+        return 1;
+    }
+    for(int i = bits - 3; i < bits; i++) {
+        start.limb[i / 64] |= 1ull << (i % 64);
+    }
+    start.limb[0] |= 1;
+
+    // j is sieved out if start + 2j is divisible by a small prime, or is 1 mod e (e must not divide p - 1)
+    memset(composite, 0, sizeof(composite));
+    for(int i = 0; i <= small_primes; i++) {
+        uint64_t p = i < small_primes ? small_prime[i] : KEYGEN_EXPONENT;
+        uint64_t r = trustlib_bn_div_word(&step, &start, p);
+        uint64_t target = i < small_primes ? 0 : 1;
+        // 2j = target - r mod p, the inverse of 2 is (p + 1) / 2
+        uint64_t j = ((target + p - r) % p) * ((p + 1) / 2) % p;
+        for(; j < KEYGEN_WINDOW; j += p) {
+            composite[j] = 1;
+        }
+    }
+    for(int j = 0; j < KEYGEN_WINDOW; j++) {
+        if(composite[j]) {
+            continue;
+        }
+        if(__atomic_load_n(&found_count, __ATOMIC_RELAXED) >= wanted) {
+            return 1;
+        }
+        trustlib_bn_set(&step, 2 * j);
+        trustlib_bn_add(prime, &start, &step);
+        if(trustlib_bn_bits(prime) == bits && is_probable_prime(prime)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// ---------------------------------------------------------------------------
+static void* search_thread(void* arg) {
+    UNUSED(arg);
+    while(__atomic_load_n(&found_count, __ATOMIC_RELAXED) < wanted) {
+        int index = __atomic_load_n(&found_count, __ATOMIC_RELAXED);
+        trustlib_bn_t prime;
+        if(index >= wanted || search_prime(&prime, prime_bits[index])) {
+            continue;
+        }
+        // the prime is taken for the next place of its size, if it is new
+        pthread_mutex_lock(&found_lock);
+        int duplicate = 0;
+        for(int i = 0; i < found_count; i++) {
+            duplicate |= !trustlib_bn_cmp(&found[i], &prime);
+        }
+        if(found_count < wanted && prime_bits[found_count] == prime_bits[index] && !duplicate) {
+            found[found_count] = prime;
+            __atomic_store_n(&found_count, found_count + 1, __ATOMIC_RELAXED);
+        }
+        pthread_mutex_unlock(&found_lock);
+    }
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+static int compute_key(trustlib_bn_t* n, trustlib_bn_t* e, trustlib_bn_t* d) {
+    trustlib_bn_t one, phi, p1, k;
+    trustlib_bn_set(&one, 1);
+    trustlib_bn_set(n, 1);
+    trustlib_bn_set(&phi, 1);
+    trustlib_bn_set(e, KEYGEN_EXPONENT);
+    for(int i = 0; i < wanted; i++) {
+        trustlib_bn_mul(n, n, &found[i]);
+        trustlib_bn_sub(&p1, &found[i], &one);
+        trustlib_bn_mul(&phi, &phi, &p1);
+    }
+    // d = (1 + k * phi) / e, with k = -phi^-1 mod e, as e is a small prime
+    unsigned __int128 r = trustlib_bn_div_word(&k, &phi, KEYGEN_EXPONENT), inv = 1;
+    for(int bit = 16; bit >= 0; bit--) {
+        inv = inv * inv % KEYGEN_EXPONENT;
+        if(((KEYGEN_EXPONENT - 2) >> bit) & 1) {
+            inv = inv * r % KEYGEN_EXPONENT;
+        }
+    }
+    trustlib_bn_set(&k, (KEYGEN_EXPONENT - (uint64_t)inv) % KEYGEN_EXPONENT);
+    trustlib_bn_mul(d, &k, &phi);
+    trustlib_bn_add(d, d, &one);
+    if(trustlib_bn_div_word(d, d, KEYGEN_EXPONENT)) {
+        return 1;
+    }
+
+    // (2^d)^e has to be 2 again
+    trustlib_mont_t ctx;
+    trustlib_bn_t two, check;
+    trustlib_bn_set(&two, 2);
+    if(trustlib_mont_init(&ctx, n)) {
+        return 1;
+    }
+    trustlib_mont_exp_consttime(&ctx, &check, &two, d, trustlib_bn_bits(n));
+    trustlib_mont_exp(&ctx, &check, &check, e);
+    return trustlib_bn_cmp(&check, &two) != 0;
+}
+
+// ---------------------------------------------------------------------------
+static int write_key(const char* output, int force, const trustlib_bn_t* n, const trustlib_bn_t* e, const trustlib_bn_t* d) {
+    // the format of key.params, followed by the primes for CRT signing
+    char number[TRUSTLIB_BN_BITS / 3 + 2];
+    std::string text;
+    const trustlib_bn_t* field[3] = { n, e, d };
+    for(int i = 0; i < 3 + wanted; i++) {
+        trustlib_bn_to_dec(i < 3 ? field[i] : &found[i - 3], number, sizeof(number));
+        text += (i ? " " : "") + std::string(number);
+    }
+    text += "\n";
+
+    // the file contains the private key and is only readable by the owner
+    int fd = open(output, O_WRONLY | O_CREAT | (force ? O_TRUNC : O_EXCL), 0600);
+    if(fd == -1) {
+        fprintf(stderr, TAG_FAIL "Could not create file '%s'%s\n", output, force ? "" : ", use -f to overwrite it");
+        return 3;
+    }
+    int failed = write(fd, text.data(), text.size()) != (ssize_t)text.size();
+    if(close(fd) || failed) {
+        fprintf(stderr, TAG_FAIL "Could not write to file '%s'\n", output);
+        return 4;
+    }
+    return 0;
+}
+
+/**
+ * Generate an RSA key for the trustlib enclave
+ *
+ * The key is written in the format of key.params, i.e., decimal "n e d",
+ * followed by the prime factors of n, which the enclave uses for CRT
+ * signing. The primes are searched by one thread per CPU: every thread
+ * sieves the odd numbers following a random start with the small primes,
+ * and tests the remaining candidates with Miller-Rabin.
+ * With -b, the size of the key in bits is set (default KEYGEN_DEFAULT_BITS,
+ * at most 8 * TRUSTLIB_SIGNATURE_SIZE, i.e., 4096), with -p the number of
+ * primes (default 2, more primes make a multi-prime key), with -t the
+ * number of threads. An existing key file is only overwritten with -f.
+ *
+ * Keys above TRUSTLIB_LEGACY_BITS bits do not fit into the original message
+ * format, they only sign messages in the binary format and documents
+ * (signer -2, -k, and -d).
+ */
+int main(int argc, char* argv[]) {
+    int bits = KEYGEN_DEFAULT_BITS, force = 0, arg = 1;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    wanted = 2;
+    while(arg < argc) {
+        if(!strcmp(argv[arg], "-b") && arg + 1 < argc) {
+            bits = atoi(argv[arg + 1]);
+            arg += 2;
+        } else if(!strcmp(argv[arg], "-p") && arg + 1 < argc) {
+            wanted = atoi(argv[arg + 1]);
+            arg += 2;
+        } else if(!strcmp(argv[arg], "-t") && arg + 1 < argc) {
+            threads = atoi(argv[arg + 1]);
+            arg += 2;
+        } else if(!strcmp(argv[arg], "-f")) {
+            force = 1;
+            arg++;
+        } else {
+            break;
+        }
+    }
+    if(arg < argc - 1 || bits < KEYGEN_MIN_BITS || bits > 8 * TRUSTLIB_SIGNATURE_SIZE || wanted < 2 || wanted > TRUSTLIB_MAX_PRIMES || threads < 1) {
+        fprintf(stderr, "Usage: %s [-b <bits, %d to %d>] [-p <primes, 2 to %d>] [-t <threads>] [-f] [<output file>]\n",
+                argv[0], KEYGEN_MIN_BITS, 8 * TRUSTLIB_SIGNATURE_SIZE, TRUSTLIB_MAX_PRIMES);
+        return 1;
+    }
+    const char* output = arg < argc ? argv[arg] : "key.params";
+    if(!force && !access(output, F_OK)) {
+        fprintf(stderr, TAG_FAIL "File '%s' exists, use -f to overwrite it\n", output);
+        return 3;
+    }
+    for(int i = 0; i < wanted; i++) {
+        prime_bits[i] = bits / wanted + (i < bits % wanted);
+    }
+    printf(TAG_INFO "Generating a %d-bit key with %d primes on %ld threads\n", bits, wanted, threads);
+    if(bits > TRUSTLIB_LEGACY_BITS) {
+        printf(TAG_INFO "Keys above %d bits only sign in the binary formats (signer -2 and -d)\n", TRUSTLIB_LEGACY_BITS);
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    sieve_small_primes();
+    pthread_t thread[threads];
+    for(long i = 0; i < threads; i++) {
+        if(pthread_create(&thread[i], NULL, search_thread, NULL)) {
+            fprintf(stderr, TAG_FAIL "Could not start thread\n");
+            return 2;
+        }
+    }
+    for(long i = 0; i < threads; i++) {
+        pthread_join(thread[i], NULL);
+    }
+    trustlib_bn_t n, e, d;
+    if(compute_key(&n, &e, &d)) {
+        fprintf(stderr, TAG_FAIL "Generated key is invalid\n");
+        return 2;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    int result = write_key(output, force, &n, &e, &d);
+    if(result) {
+        return result;
+    }
+    // the key id selects the key in the keyring, e.g., signer -k
+    char n_hex[TRUSTLIB_BN_BITS / 4 + 1], e_hex[TRUSTLIB_BN_BITS / 4 + 1];
+    uint8_t id[TRUSTLIB_FINGERPRINT_SIZE];
+    trustlib_bn_to_hex(&n, n_hex, sizeof(n_hex));
+    trustlib_bn_to_hex(&e, e_hex, sizeof(e_hex));
+    trustlib_fingerprint_hex(n_hex, sizeof(n_hex), e_hex, sizeof(e_hex), id);
+    printf(TAG_OK "Key written to '%s' in %.2f s, key id ", output, (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+    for(int i = 0; i < TRUSTLIB_FINGERPRINT_SIZE; i++) {
+        printf("%02x", id[i]);
+    }
+    printf("\n");
+    return 0;
+}
@@ -1,27 +1,116 @@
 #include <stdio.h>
 #include <string.h>
+#include <fcntl.h>
 #include "trustlib_enclave.h"
 #include "framework.h"
 
+/**
+ * Sign a document of arbitrary length and save the signature
+ * 
+ * The document is streamed through the shared arena and hashed in the 
+ * enclave, the detached signature is stored in the given file.
+ * 
+ * @param path The document
+ * @param output File for the signature
+ * @param fingerprint Key id of the key to sign with, all zero for the default key
+ * @return Exit code of the program
+ */
+static int sign_document(const char* path, const char* output, const uint8_t* fingerprint) {
+    int fd = open(path, O_RDONLY);
+    if(fd == -1) {
+        fprintf(stderr, TAG_FAIL "Could not open file '%s'\n", path);
+        return 3;
+    }
+    trustlib_doc_signature_t signature;
+    memset(&signature, 0, sizeof(signature));
+    memcpy(signature.fingerprint, fingerprint, sizeof(signature.fingerprint));
+    
+    if(trustlib_init() == -1) {
+        fprintf(stderr, TAG_FAIL "Failed to initialize the enclave\n");
+        return 2;
+    }
+    uint64_t stream = trustlib_stream_begin_enclave(TRUSTLIB_UNTRUSTED);
+    if(stream && trustlib_stream_fd_enclave(stream, fd)) {
+        trustlib_stream_abort_enclave(stream);
+        stream = 0;
+    }
+    close(fd);
+    if(!stream || trustlib_sign_stream_enclave(stream, &signature)) {
+        fprintf(stderr, TAG_FAIL "Failed to sign the document\n");
+        return 5;
+    }
+    printf(TAG_OK "Document signed!\n");
+    
+    FILE* f = fopen(output, "wb");
+    if(!f) {
+        fprintf(stderr, TAG_FAIL "Could not open file '%s'\n", output);
+        return 3;
+    }
+    if(fwrite(&signature, sizeof(signature), 1, f) != 1) {
+        fprintf(stderr, TAG_FAIL "Could not write to file '%s'\n", output);
+        return 4;
+    }
+    fclose(f);
+    return 0;
+}
+
 /**
  * Sign a message and save signed message
  * 
  * The program takes a message, signs the message with TRUSTLIB_UNTRUSTED
  * as issuer, and stores the signed message in the given file.
  * The actual signature is done by the trustlib enclave. 
+ * With -2, the signed message is stored in the compact binary format.
+ * With -k, the message is signed with the key of the enclave keyring with 
+ * the given id (the hex-encoded fingerprint), implies -2.
+ * With -d, the first argument is a document of arbitrary length, which is 
+ * signed with a detached signature.
  */
 int main(int argc, char* argv[]) {
-    if(argc != 3) {
-        fprintf(stderr, "Usage: %s <message> <output file>\n", argv[0]);
+    int binary = 0, document = 0, arg = 1;
+    const char* key_id = NULL;
+    while(arg < argc - 2) {
+        if(!strcmp(argv[arg], "-2")) {
+            binary = 1;
+            arg++;
+        } else if(!strcmp(argv[arg], "-k") && arg + 1 < argc - 2) {
+            key_id = argv[arg + 1];
+            binary = 1;
+            arg += 2;
+        } else if(!strcmp(argv[arg], "-d")) {
+            document = 1;
+            arg++;
+        } else {
+            break;
+        }
+    }
+    // the key id is the fingerprint as shown by the verifier, 2 hex digits per byte
+    uint8_t fingerprint[TRUSTLIB_FINGERPRINT_SIZE] = { 0 };
+    int valid_id = !key_id || (strlen(key_id) == 2 * TRUSTLIB_FINGERPRINT_SIZE && strspn(key_id, "0123456789abcdefABCDEF") == strlen(key_id));
+    for(int i = 0; key_id && valid_id && i < TRUSTLIB_FINGERPRINT_SIZE; i++) {
+        unsigned int byte;
+        sscanf(key_id + 2 * i, "%2x", &byte);
+        fingerprint[i] = byte;
+    }
+    if(arg != argc - 2 || !valid_id) {
+        fprintf(stderr, "Usage: %s [-2] [-k <key id>] [-d] <message or document> <output file>\n", argv[0]);
         return 1;
     }
+    const char* text = argv[arg];
+    const char* output = argv[arg + 1];
+    if(document) {
+        return sign_document(text, output, fingerprint);
+    }
 
     // copy message to a trustlib_signed_data_t struct
     trustlib_signed_data_t message;
     memset(&message, 0, sizeof(message));
     message.data.issuer = TRUSTLIB_UNTRUSTED;
     memset(message.data.message, 0, sizeof(message.data.message));
-    strncpy(message.data.message, argv[1], sizeof(message.data.message) - 1);
+    strncpy(message.data.message, text, sizeof(message.data.message) - 1);
+    trustlib_wire_t wire;
+    trustlib_wire_init(&wire, TRUSTLIB_UNTRUSTED, text);
+    memcpy(wire.fingerprint, fingerprint, sizeof(fingerprint));
     
     // initialize the enclave, and let the enclave sign the message
     if(trustlib_init() == -1) {
@@ -29,17 +118,21 @@ int main(int argc, char* argv[]) {
         return 2;
     }
     printf(TAG_INFO "Please wait, message is signed. This can take multiple seconds.\n");
-    trustlib_sign_enclave(&message);
+    if(binary ? trustlib_sign_enclave_wire(&wire) : (trustlib_sign_enclave(&message), !message.signature[0])) {
+        // e.g., UTEE_ECALL_TIMEOUT passed before the enclave finished
+        fprintf(stderr, TAG_FAIL "Failed to sign the message\n");
+        return 5;
+    }
     printf(TAG_OK "Message signed!\n");
     
     // store the signed message
-    FILE* f = fopen(argv[2], "wb");
+    FILE* f = fopen(output, "wb");
     if(!f) {
-        fprintf(stderr, TAG_FAIL "Could not open file '%s'\n", argv[2]);
+        fprintf(stderr, TAG_FAIL "Could not open file '%s'\n", output);
         return 3;
     }
-    if(fwrite(&message, sizeof(message), 1, f) != 1) {
-        fprintf(stderr, TAG_FAIL "Could not write to file '%s'\n", argv[2]);
+    if(binary ? fwrite(&wire, trustlib_wire_size(&wire), 1, f) != 1 : fwrite(&message, sizeof(message), 1, f) != 1) {
+        fprintf(stderr, TAG_FAIL "Could not write to file '%s'\n", output);
         return 4;
     }
     fclose(f);
@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "utee_stats.h"
+#include "framework.h"
+
+/**
+ * Format a latency
+ *
+ * @param ns Latency in nanoseconds
+ * @param buffer Buffer receiving the formatted latency
+ * @param len Size of the buffer
+ * @return The buffer
+ */
+static const char* format_latency(uint64_t ns, char* buffer, size_t len) {
+    if(ns < 1000) snprintf(buffer, len, "%luns", (unsigned long)ns);
+    else if(ns < 1000000) snprintf(buffer, len, "%.1fus", ns / 1e3);
+    else if(ns < 1000000000) snprintf(buffer, len, "%.1fms", ns / 1e6);
+    else snprintf(buffer, len, "%.1fs", ns / 1e9);
+    return buffer;
+}
+
+/**
+ * Print p50, p99, and p999 of a histogram
+ *
+ * @param hist The histogram
+ */
+static void print_percentiles(const utee_histogram_t* hist) {
+    char p50[16], p99[16], p999[16];
+    printf(" | %9s %9s %9s",
+        format_latency(utee_stats_percentile(hist, 50.0), p50, sizeof(p50)),
+        format_latency(utee_stats_percentile(hist, 99.0), p99, sizeof(p99)),
+        format_latency(utee_stats_percentile(hist, 99.9), p999, sizeof(p999)));
+}
+
+/**
+ * Print the statistics of one enclave instance
+ *
+ * @param name Name of the enclave
+ * @param instance Instance id
+ * @param stats Statistics segment of the instance
+ */
+static void print_stats(const char* name, int instance, const utee_stats_t* stats) {
+    printf(TAG_INFO "%s.%d (PID %d), %u ECALLs, %lu invalid calls, %lu cancelled calls\n", name, instance,
+        stats->enclave, stats->ecalls - 1, (unsigned long)stats->invalid, (unsigned long)stats->cancelled);
+    printf("  ECALL        calls | %29s | %29s | %29s\n", "queue p50/p99/p999", "exec p50/p99/p999", "total p50/p99/p999");
+    for(uint32_t i = 0; i < stats->ecalls && i < UTEE_MAX_ECALLS; i++) {
+        const utee_ecall_stats_t* s = &(stats->ecall[i]);
+        if(!s->calls) continue;
+        printf("  %5u %12lu", i, (unsigned long)s->calls);
+        print_percentiles(&(s->queue));
+        print_percentiles(&(s->exec));
+        print_percentiles(&(s->total));
+        printf("\n");
+    }
+    uint32_t counters = __atomic_load_n(&(stats->counters), __ATOMIC_ACQUIRE);
+    for(uint32_t i = 0; i < counters && i < UTEE_STATS_COUNTERS; i++) {
+        printf("  %-*.*s %12lu\n", UTEE_STATS_COUNTER_NAME, UTEE_STATS_COUNTER_NAME - 1, stats->counter[i].name, (unsigned long)stats->counter[i].value);
+    }
+}
+
+/**
+ * Show live ECALL statistics of a running enclave
+ *
+ * The tool attaches to the statistics segments of all running instances of
+ * an enclave and periodically prints the number of calls, and the p50, p99,
+ * and p999 of the queueing, execution, and total latency of every ECALL,
+ * followed by the counters published by the enclave.
+ */
+int main(int argc, char* argv[]) {
+    if(argc > 3) {
+        fprintf(stderr, "Usage: %s [enclave name] [interval in seconds, 0 to print once]\n", argv[0]);
+        return 1;
+    }
+    const char* name = argc > 1 ? argv[1] : "trustlib_enclave";
+    int interval = argc > 2 ? atoi(argv[2]) : 1;
+
+    // attach to the statistics of all instances
+    const utee_stats_t* stats[UTEE_MAX_INSTANCES] = { NULL };
+    int found = 0;
+    for(int i = 0; i < UTEE_MAX_INSTANCES; i++) {
+        char key[UTEE_MAX_ENCLAVE_NAME + 32];
+        snprintf(key, sizeof(key), "%s.%d_stats", name, i);
+        int fd = shm_open(key, O_RDONLY, 0);
+        if(fd == -1) continue;
+        struct stat st;
+        if(!fstat(fd, &st) && (size_t)st.st_size >= sizeof(utee_stats_t)) {
+            void* mem = mmap(NULL, sizeof(utee_stats_t), PROT_READ, MAP_SHARED, fd, 0);
+            if(mem != MAP_FAILED) {
+                stats[i] = (const utee_stats_t*)mem;
+                found++;
+            }
+        }
+        close(fd);
+    }
+    if(!found) {
+        fprintf(stderr, TAG_FAIL "No running instance of '%s' found\n", name);
+        return 2;
+    }
+
+    do {
+        if(interval) printf("\x1b[H\x1b[2J");
+        for(int i = 0; i < UTEE_MAX_INSTANCES; i++) {
+            if(stats[i] && stats[i]->magic == UTEE_STATS_MAGIC) {
+                print_stats(name, i, stats[i]);
+            }
+        }
+        fflush(stdout);
+    } while(interval && !sleep(interval));
+
+    return 0;
+}
@@ -1,34 +1,86 @@
 #include <stdio.h>
 #include <string.h>
+#include <fcntl.h>
+#include <libgen.h>
 #include "trustlib_enclave.h"
 #include "framework.h"
 
+/**
+ * Verify the detached signature of a document
+ * 
+ * @param signature The signature
+ * @param path The document
+ * @return 1 if the signature is valid, 0 otherwise
+ */
+static int verify_document(const trustlib_doc_signature_t* signature, const char* path) {
+    int fd = open(path, O_RDONLY);
+    if(fd == -1) {
+        fprintf(stderr, TAG_FAIL "Could not open file '%s'\n", path);
+        return 0;
+    }
+    uint64_t stream = trustlib_stream_begin_enclave((trustlib_issuer_t)signature->issuer);
+    if(stream && trustlib_stream_fd_enclave(stream, fd)) {
+        trustlib_stream_abort_enclave(stream);
+        stream = 0;
+    }
+    close(fd);
+    return stream && trustlib_verify_stream_enclave(stream, signature);
+}
+
 /**
  * Check the signature of a file, and print the message
  * 
- * This tool loads a signed message and verifies the signature. 
+ * This tool loads a signed message, in the original or in the compact 
+ * binary format, and verifies the signature. 
  * If the signature is correct, the message is displayed. 
  * The formatting of the displayed message depends on whether
  * the issuer is trusted or untrusted.
+ * For the detached signature of a document, the document is given as 
+ * second argument, and its name is displayed instead of a message.
  */
 int main(int argc, char* argv[]) {
-    if(argc != 2) {
-        fprintf(stderr, "Usage: %s <message file>\n", argv[0]);
+    if(argc != 2 && argc != 3) {
+        fprintf(stderr, "Usage: %s <message file> | <signature file> <document>\n", argv[0]);
         return 1;
     }
 
-    // load signed message from file
+    // load signed message from file, the binary format is smaller than the original one
     trustlib_signed_data_t message;
+    trustlib_wire_t wire;
+    static_assert(sizeof(wire) <= sizeof(message), "Binary format must not be larger than the original one");
     FILE* f = fopen(argv[1], "rb");
     if(!f) {
         fprintf(stderr, TAG_FAIL "Could not open file '%s'\n", argv[1]);
         return 2;
     }
-    if(fread(&message, sizeof(message), 1, f) != 1) {
+    size_t len = fread(&message, 1, sizeof(message), f);
+    fclose(f);
+    int binary = (len >= sizeof(wire.magic) && ((trustlib_wire_t*)&message)->magic == TRUSTLIB_WIRE_MAGIC);
+    int document = (len == sizeof(trustlib_doc_signature_t) && ((trustlib_doc_signature_t*)&message)->magic == TRUSTLIB_DOC_MAGIC);
+    trustlib_doc_signature_t signature;
+    if(document != (argc == 3)) {
+        fprintf(stderr, TAG_FAIL "Signature of a document requires the document, and only such a signature\n");
+        return 1;
+    }
+    if(document) {
+        memcpy(&signature, &message, sizeof(signature));
+        // the name of the document is displayed as message
+        memset(&message, 0, sizeof(message));
+        message.data.issuer = (trustlib_issuer_t)signature.issuer;
+        strncpy(message.data.message, basename(argv[2]), sizeof(message.data.message) - 1);
+    } else if(binary) {
+        memset(&wire, 0, sizeof(wire));
+        memcpy(&wire, &message, len < sizeof(wire) ? len : sizeof(wire));
+        if(trustlib_wire_check(&wire, len)) {
+            fprintf(stderr, TAG_FAIL "Invalid message in file '%s'\n", argv[1]);
+            return 3;
+        }
+        // only the message and issuer are displayed
+        trustlib_from_wire(&wire, NULL, &message);
+    } else if(len != sizeof(message)) {
         fprintf(stderr, TAG_FAIL "Could not read from file '%s'\n", argv[1]);
         return 3;
     }
-    fclose(f);
     
     // initialize enclave
     if(trustlib_init() == -1) {
@@ -36,8 +88,17 @@ int main(int argc, char* argv[]) {
         return 2;
     }
     
-    if(trustlib_verify_enclave(&message)) {
-        printf(TAG_OK "Signature verified!\n\n");
+    if(document ? verify_document(&signature, argv[2]) : binary ? trustlib_verify_enclave_wire(&wire) : trustlib_verify_enclave(&message)) {
+        printf(TAG_OK "Signature verified!\n");
+        if(binary || document) {
+            // the key id, e.g., for signer -k
+            printf(TAG_INFO "Signed with key ");
+            for(int i = 0; i < TRUSTLIB_FINGERPRINT_SIZE; i++) {
+                printf("%02x", document ? signature.fingerprint[i] : wire.fingerprint[i]);
+            }
+            printf("\n");
+        }
+        printf("\n");
         
         if(message.data.issuer == TRUSTLIB_TRUSTED) {
             printf("           ______________________________________        \n");